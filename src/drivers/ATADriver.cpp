@@ -19,127 +19,519 @@
 
 #include <constants.h>
 #include <types.h>
+#include <errno.h>
 #include <AutoDisable.h>
 #include <ATADriver.h>
 #include <io_utils.h>
 #include <mem_utils.h>
+#include <PhysicalMemManager.h>
 #include <Debug.h>
 
 
-ATADriver::ATADriver(ushort controller, uchar device, ulong baseAddress)
-	: requestSemaphore(1), ide(controller), dev(device), lbaBase(baseAddress)
+ATADriver::ATADriver(ushort controller, uchar device, ATAChannel *theChannel, ulong baseAddress)
+	: channel(theChannel), ide(controller), dev(device), lbaBase(baseAddress), blockLimit(0), wholeDisk(NULL), useDMA(false),
+	  useLBA48(false), multipleCount(0)
 { ; }
 
 ATADriver::ATADriver(const ATADriver &driver)
-	: BlockDevice(), requestSemaphore(1), ide(driver.ide), dev(driver.dev), lbaBase(driver.lbaBase)
+	: BlockDevice(), channel(driver.channel), ide(driver.ide), dev(driver.dev), lbaBase(driver.lbaBase),
+	  blockLimit(driver.blockLimit), wholeDisk(driver.wholeDisk != NULL ? driver.wholeDisk : const_cast<ATADriver*>(&driver)),
+	  useDMA(driver.useDMA), useLBA48(driver.useLBA48), multipleCount(driver.multipleCount)
 { ; }
 
+/// Done callback for ReadBlocks and WriteBlocks, wakes the waiting thread
+static void SignalDone(BlockRequest *request)
+{
+	reinterpret_cast<Semaphore*>(request->arg)->Signal();
+}
+
 int ATADriver::ReadBlocks(ulong address, int blockCount, void *dest)
 {
-	requestSemaphore.Wait();	// wait until the device is ready
+	return(SubmitAndWait(address, blockCount, reinterpret_cast<uchar*>(dest), false));
+}
+
+int ATADriver::WriteBlocks(ulong address, int blockCount, void *src)
+{
+	return(SubmitAndWait(address, blockCount, reinterpret_cast<uchar*>(src), true));
+}
+
+int ATADriver::SubmitAndWait(ulong address, int blockCount, uchar *buff, bool write)
+{
+	BlockRequest	request;
+	Semaphore	done;
 	
-	AutoDisable	lock;
-	int		totalBlocksRead = 0;
-	uchar		statusReg;
+	request.address = address;
+	request.blockCount = blockCount;
+	request.buff = buff;
+	request.write = write;
+	request.Done = SignalDone;
+	request.arg = &done;
 	
-// 	DEBUG("ASKED FOR: %u\n", address);
-// 	DEBUG("OFFSET: %u\n", lbaBase);
+	SubmitRequest(&request);
 	
-	// update the address
-	address += lbaBase;
+	done.Wait();	// already signaled if it was done right away
 	
-// 	DEBUG("READING BLOCK: %u\n", address);
+	return(request.result);
+}
 
-	// we can only read 255 blocks at a time
-	for(int curBlockCount = MIN(blockCount, MAX_BLOCK_COUNT);
-		   totalBlocksRead < blockCount;
-		   totalBlocksRead += curBlockCount)
+void ATADriver::SubmitRequest(BlockRequest *request)
+{
+	request->device = this;
+	request->unit = dev;
+	
+	// don't let a partition reach outside itself
+	if(blockLimit != 0 &&
+	   (request->address >= blockLimit || ulong(request->blockCount) > blockLimit - request->address))
 	{
-		curBlockCount = MIN(blockCount - totalBlocksRead, MAX_BLOCK_COUNT);
+		request->nextMerged = NULL;
+		BlockRequestQueue::Complete(request, -1 * EINVAL);
+		return;
+	}
+	
+	request->address += lbaBase;
+	
+	// nobody to hand it to yet during boot, so do it right here
+	// syscalls come in with interrupts off too, but waiting on done switches threads so they still queue
+	if(!channel->workerRunning)
+	{
+		request->nextMerged = NULL;
 		
-		do { statusReg = inb(ide | ALT_STATUS_REG); } while(statusReg & BUSY);
+		channel->commandLock.Wait();
+		int	ret = Execute(request);
+		channel->commandLock.Signal();
 		
-		asm ("cli");	// clear interrupts
+		BlockRequestQueue::Complete(request, ret);
+		return;
+	}
+	
+	channel->queue.Submit(request);
+}
+
+void ATADriver::ChannelWorker(void *arg)
+{
+	ATAChannel	*channel = reinterpret_cast<ATAChannel*>(arg);
+	
+	// this thread lives as long as the kernel
+	while(1)
+	{
+		// every mode can do MAX_BLOCK_COUNT in one command
+		BlockRequest	*command = channel->queue.Next(MAX_BLOCK_COUNT);
 		
-		// wait until the drive is ready
-		do { statusReg = inb(ide | ALT_STATUS_REG); } while(!(statusReg & DRIVE_READY));
+		channel->commandLock.Wait();
+		int	ret = static_cast<ATADriver*>(command->device)->Execute(command);
+		channel->commandLock.Signal();
 		
-		// set the number of blocks to read
-		outb(ide | SECTOR_COUNT_REG, curBlockCount);
+		// the waiters see the drive's error instead of their block count
+		BlockRequestQueue::Complete(command, ret);
+	}
+}
+
+int ATADriver::Flush()
+{
+	channel->commandLock.Wait();
+	
+	SelectDevice(0);
+	
+	{
+		AutoDisable	lock;
 		
-		// set the 1st byte of the LBA
-		outb(ide | SECTOR_NUMBER_REG, (address+totalBlocksRead) & 0xFF);
+		ExpectInterrupt();
 		
-		// set the 2nd byte of the LBA
-		outb(ide | CYLINDER_LOW_REG, ((address+totalBlocksRead) >> 8) & 0xFF);
+		outb(ide | COMMAND_REG, useLBA48 ? FLUSH_CACHE_EXT : FLUSH_CACHE);
+	}
+	
+	uchar	statusReg = WaitForInterrupt();
+	
+	channel->commandLock.Signal();
+	
+	// drives without a write cache may not know the command
+	if(statusReg & (ERROR | DRIVE_FAULT))
+	{
+		WARN("ATA FLUSH CACHE ERROR: %x\n", inb(ide | ERROR_REG));
+		return(-1 * EIO);
+	}
+	
+	return(0);
+}
+
+int ATADriver::Execute(BlockRequest *command)
+{
+	// requests merged by the queue always fit in one command
+	if(command->nextMerged != NULL)
+	{
+		if(useDMA && TransferDMA(command))
+			return(0);
 		
-		// set the 3rd byte of the LBA
-		outb(ide | CYLINDER_HIGH_REG, ((address+totalBlocksRead) >> 16) & 0xFF);
+		return(TransferPIO(command));
+	}
+	
+	int		ret = 0;
+	int		totalBlocks = 0;
+	BlockRequest	piece = *command;	// a piece of the request that fits in one command
+	
+	while(totalBlocks < command->blockCount)
+	{
+		// 28-bit commands can only transfer 255 blocks at a time, 48-bit ones 65536
+		piece.address = command->address + totalBlocks;
+		piece.buff = command->buff + totalBlocks * 512;
+		piece.blockCount = MIN(command->blockCount - totalBlocks, useLBA48 ? MAX_BLOCK_COUNT_EXT : MAX_BLOCK_COUNT);
 		
-		// select the device and the high 4 bits of the LBA
-		outb(ide | DRIVE_HEAD_REG, dev | (((address+totalBlocksRead) >> 24) & 0x0F));
+		// DMA also needs it to fit in the PRD table
+		if(useDMA)
+		{
+			piece.blockCount = MIN(piece.blockCount, MAX_DMA_BLOCK_COUNT);
+			
+			if(!TransferDMA(&piece))
+				ret = TransferPIO(&piece);
+		}
 		
-		// send the READ SECTOR WITH RETRIES command
-		outb(ide | COMMAND_REG, READ_SECTOR_RETRY);
+		else
+			ret = TransferPIO(&piece);
 		
-		asm("sti");	// enable interrupts
+		if(ret < 0)
+			return(ret);
+		
+		totalBlocks += piece.blockCount;
+	}
+	
+	return(0);
+}
+
+int ATADriver::TransferPIO(BlockRequest *request)
+{
+	uchar		statusReg;
+	int		blockSize = MAX(multipleCount, 1);	// sectors per interrupt
+	uchar		command;
+	bool		write = request->write;
+	int		sectorCount = 0;
+	BlockRequest	*seg = request;		// the request the next sector goes to or from
+	int		segSector = 0;		// the sector in that request
+	
+	for(BlockRequest *it = request; it != NULL; it = it->nextMerged)
+		sectorCount += it->blockCount;
+	
+	if(write && multipleCount > 0)
+		command = useLBA48 ? WRITE_MULTIPLE_EXT : WRITE_MULTIPLE;
+	else if(write)
+		command = useLBA48 ? WRITE_SECTOR_EXT : WRITE_SECTOR_RETRY;
+	else if(multipleCount > 0)
+		command = useLBA48 ? READ_MULTIPLE_EXT : READ_MULTIPLE;
+	else
+		command = useLBA48 ? READ_SECTOR_EXT : READ_SECTOR_RETRY;
+	
+	SetupTransfer(request->address, sectorCount);
+	
+	{
+		AutoDisable	lock;	// the IRQ can't beat us to the wait queue
 		
-		for(int i=0; i < curBlockCount; ++i)
+		if(!write)	// writes don't interrupt until the first block is sent
+			ExpectInterrupt();
+		
+		outb(ide | COMMAND_REG, command);
+	}
+	
+	if(write)	// wait for the drive to ask for the first block
+	{
+		Delay400ns(ide);
+		
+		do { statusReg = inb(ide | ALT_STATUS_REG); }
+		while((statusReg & BUSY) || !(statusReg & (DATA_READY | ERROR | DRIVE_FAULT)));
+		
+		if(statusReg & (ERROR | DRIVE_FAULT))
 		{
-			// INT HAPPENS HERE
+			WARN("ATA WRITE ERROR: %x\n", inb(ide | ERROR_REG));
+			return(-1 * EIO);
+		}
+	}
+	
+	// the drive interrupts once per block, when it has the data or has taken it
+	for(int i=0; i < sectorCount; i += blockSize)
+	{
+		int	curSectors = MIN(sectorCount - i, blockSize);
+		
+		if(!write)
+		{
+			statusReg = WaitForInterrupt();
 			
-			asm("cli");	// clear interrupts
+			if(statusReg & (ERROR | DRIVE_FAULT))	// we have an error, the drive gave up on the command
+			{
+				WARN("ATA READ ERROR: %x\n", inb(ide | ERROR_REG));
+				return(-1 * EIO);
+			}
 			
-			// read the ALT_STATUS_REG so we don't mess up the INT
-			do { statusReg = inb(ide | ALT_STATUS_REG); } while(statusReg & BUSY);
+			// the next block's interrupt can come as soon as this one is read
+			if(i + curSectors < sectorCount)
+				ExpectInterrupt();
 			
-			// poll to see if ready
-			do { statusReg = inb(ide | ALT_STATUS_REG); }
-			while(!(statusReg & DRIVE_READY) &&
-			       (statusReg & DATA_READY));
+			// read in the whole block, 1 sector = 256 words or 512 bytes
+			for(int j=0; j < curSectors; ++j)
+			{
+				insw(ide | DATA_REG, seg->buff + segSector * 512, 256);
+				
+				if(++segSector == seg->blockCount)
+				{
+					seg = seg->nextMerged;
+					segSector = 0;
+				}
+			}
+		}
+		
+		else
+		{
+			ExpectInterrupt();
 			
-			if(statusReg & 0x01)	// we have an error
+			for(int j=0; j < curSectors; ++j)
 			{
-				statusReg = inb(ide | ERROR_REG);
-				PANIC("ATA READ ERROR: %x\n", statusReg);
+				outsw(ide | DATA_REG, seg->buff + segSector * 512, 256);
+				
+				if(++segSector == seg->blockCount)
+				{
+					seg = seg->nextMerged;
+					segSector = 0;
+				}
 			}
 			
-			// read in 1 (ONE) SECTOR of data, 1 block = 256 words or 512 bytes
-			insw(ide | DATA_REG,
-			     reinterpret_cast<uchar*>(dest) + (i*512) + (totalBlocksRead*512),
-			     256);
+			statusReg = WaitForInterrupt();
 			
-			// read the primary status register ONCE PER INT
-			statusReg = inb(ide | STATUS_REG);
+			if(statusReg & (ERROR | DRIVE_FAULT))
+			{
+				WARN("ATA WRITE ERROR: %x\n", inb(ide | ERROR_REG));
+				return(-1 * EIO);
+			}
+		}
+	}
+	
+	return(0);
+}
+
+bool ATADriver::TransferDMA(BlockRequest *request)
+{
+	ushort	bm = channel->busMaster;
+	bool	write = request->write;
+	uchar	direction = write ? 0 : BM_READ;
+	int	sectorCount = 0;
+	
+	for(BlockRequest *it = request; it != NULL; it = it->nextMerged)
+	{
+		// DMA needs word aligned buffers
+		if(reinterpret_cast<ulong>(it->buff) & 0x1)
+			return(false);
+		
+		sectorCount += it->blockCount;
+	}
+	
+	if(!BuildPRDTable(request))
+		return(false);
+	
+	// point the controller at the table, set the direction and clear the old status
+	outl(bm + BM_PRD_TABLE_REG, channel->prdTablePhys);
+	outb(bm + BM_COMMAND_REG, direction);
+	outb(bm + BM_STATUS_REG, inb(bm + BM_STATUS_REG) | BM_ERROR | BM_INTERRUPT);
+	
+	SetupTransfer(request->address, sectorCount);
+	
+	{
+		AutoDisable	lock;	// the IRQ can't beat us to the wait queue
+		
+		ExpectInterrupt();
+		
+		if(useLBA48)
+			outb(ide | COMMAND_REG, write ? WRITE_DMA_EXT : READ_DMA_EXT);
+		else
+			outb(ide | COMMAND_REG, write ? WRITE_DMA : READ_DMA);
+		outb(bm + BM_COMMAND_REG, direction | BM_START);
+	}
+	
+	// one interrupt for the whole transfer
+	uchar	statusReg = WaitForInterrupt();
+	uchar	bmStatus = inb(bm + BM_STATUS_REG);
+	
+	// stop the controller and clear the interrupt and error bits
+	outb(bm + BM_COMMAND_REG, direction);
+	outb(bm + BM_STATUS_REG, bmStatus | BM_ERROR | BM_INTERRUPT);
+	
+	if((statusReg & (ERROR | DRIVE_FAULT)) || (bmStatus & BM_ERROR))
+	{
+		WARN("ATA DMA ERROR: %x %x, using PIO\n", statusReg, bmStatus);
+		useDMA = false;
+		return(false);
+	}
+	
+	return(true);
+}
+
+bool ATADriver::BuildPRDTable(BlockRequest *request)
+{
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+	ulong			runStart = 0, runLength = 0;	// the entry being built
+	uint			numEntries = 0;
+	
+	for(; request != NULL; request = request->nextMerged)
+	{
+		ulong	addr = reinterpret_cast<ulong>(request->buff);
+		ulong	end = addr + request->blockCount * 512;
+		
+		// go a page at a time, merging physically contiguous pages
+		while(addr < end)
+		{
+			ulong	phys = physMemMan->VirtualToPhysical(addr);
+			ulong	len = MIN(end - addr, PAGE_SIZE - (addr % PAGE_SIZE));
+			
+			if(phys == 0)
+				return(false);
 			
-			if(statusReg & 0x01)	// we have an error
+			// continue the run if it's contiguous and stays in the same 64K
+			if(runLength != 0 && runStart + runLength == phys &&
+			   runStart / PRD_BOUNDARY == (phys + len - 1) / PRD_BOUNDARY)
 			{
-				statusReg = inb(ide | ERROR_REG);
-				PANIC("ATA READ ERROR: %x\n", statusReg);
+				runLength += len;
 			}
 			
-			asm("sti");	// endable interrupts
+			else
+			{
+				if(runLength != 0)
+				{
+					if(numEntries == MAX_PRD_ENTRIES)
+						return(false);
+					
+					channel->prdTable[numEntries].physAddr = runStart;
+					channel->prdTable[numEntries].byteCount = runLength;	// 64K wraps to 0
+					channel->prdTable[numEntries].flags = 0;
+					++numEntries;
+				}
+				
+				runStart = phys;
+				runLength = len;
+			}
 			
-			// need to delay for 400ns
-			Delay400ns(ide);
+			addr += len;
 		}
 	}
+	
+	if(numEntries == MAX_PRD_ENTRIES)
+		return(false);
+	
+	channel->prdTable[numEntries].physAddr = runStart;
+	channel->prdTable[numEntries].byteCount = runLength;
+	channel->prdTable[numEntries].flags = PRD_END;
+	
+	return(true);
+}
+
+void ATADriver::SetupBusMaster(ATAChannel *theChannel, ushort busMasterBase)
+{
+	// align the table to its size so it never crosses a 64K boundary (never freed)
+	ulong	tableSize = MAX_PRD_ENTRIES * sizeof(PRDEntry);	// a page
+	uchar	*mem = new uchar[tableSize * 2];
+	
+	mem += tableSize - (reinterpret_cast<ulong>(mem) % tableSize);
+	
+	theChannel->prdTable = reinterpret_cast<PRDEntry*>(mem);
+	theChannel->prdTablePhys = PhysicalMemManager::GetInstancePtr()->VirtualToPhysical(reinterpret_cast<ulong>(mem));
+	theChannel->busMaster = busMasterBase;
+}
+
+bool ATADriver::SetMultipleMode(uchar sectorCount)
+{
+	channel->commandLock.Wait();
+	
+	SelectDevice(0);
+	
+	outb(ide | SECTOR_COUNT_REG, sectorCount);
+	
+	{
+		AutoDisable	lock;
+		
+		ExpectInterrupt();
+		
+		outb(ide | COMMAND_REG, SET_MULTIPLE_MODE);
+	}
+	
+	uchar	statusReg = WaitForInterrupt();
+	
+	channel->commandLock.Signal();
+	
+	if(statusReg & (ERROR | DRIVE_FAULT))
+		return(false);
+	
+	multipleCount = sectorCount;
+	
+	return(true);
+}
 
+void ATADriver::SelectDevice(ulong address)
+{
+	uchar	statusReg;
 	
-	requestSemaphore.Signal();	// let other commands be issued
+	// select the device and the high 4 bits of a 28-bit LBA, 48-bit ones don't use them
+	outb(ide | DRIVE_HEAD_REG, useLBA48 ? dev : dev | ((address >> 24) & 0x0F));
+	
+	Delay400ns(ide);
+	
+	// wait until the drive is ready
+	do { statusReg = inb(ide | ALT_STATUS_REG); }
+	while((statusReg & BUSY) || !(statusReg & DRIVE_READY));
+}
 
-	return(blockCount);
+void ATADriver::SetupTransfer(ulong address, int sectorCount)
+{
+	SelectDevice(address);
+	
+	// the registers are FIFOs for 48-bit commands, the high bytes go in first
+	if(useLBA48)
+	{
+		// 65536 sectors is sent as 0
+		outb(ide | SECTOR_COUNT_REG, (sectorCount >> 8) & 0xFF);
+		
+		// set the 4th byte of the LBA, our addresses don't have a 5th or 6th
+		outb(ide | SECTOR_NUMBER_REG, (address >> 24) & 0xFF);
+		outb(ide | CYLINDER_LOW_REG, 0);
+		outb(ide | CYLINDER_HIGH_REG, 0);
+	}
+	
+	// set the number of blocks to transfer
+	outb(ide | SECTOR_COUNT_REG, sectorCount & 0xFF);
+	
+	// set the 1st byte of the LBA
+	outb(ide | SECTOR_NUMBER_REG, address & 0xFF);
+	
+	// set the 2nd byte of the LBA
+	outb(ide | CYLINDER_LOW_REG, (address >> 8) & 0xFF);
+	
+	// set the 3rd byte of the LBA
+	outb(ide | CYLINDER_HIGH_REG, (address >> 16) & 0xFF);
 }
 
-int ATADriver::WriteBlocks(ulong address, int blockCount, void *src)
+void ATADriver::ExpectInterrupt()
 {
-	(void) address;
-	(void) blockCount;
-	(void) src;
+	AutoDisable	lock;
 	
-	PANIC("ATA Write support not done.\n");
+	channel->waiting = true;
+}
+
+uchar ATADriver::WaitForInterrupt()
+{
+	// early in boot there is no other thread to run, so poll like the IDENTIFY does
+	if(!channel->useIRQ || !channel->workerRunning)
+	{
+		uchar	statusReg;
+		
+		Delay400ns(ide);
+		
+		do { statusReg = inb(ide | ALT_STATUS_REG); } while(statusReg & BUSY);
+		
+		channel->waiting = false;
+		
+		// reading the primary status register clears the drive's interrupt
+		return(inb(ide | STATUS_REG));
+	}
 	
-	return(0);
+	// other threads run while the drive seeks, the IRQ signals us. System calls and page
+	// faults get here with interrupts off, Wait switches threads anyway and the next one
+	// turns them back on
+	channel->irqSignal.Wait();
+	
+	return(channel->status);
 }
 
 void ATADriver::Delay400ns(ushort ide)
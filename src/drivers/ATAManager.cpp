@@ -19,109 +19,182 @@
 
 #include <constants.h>
 #include <types.h>
+#include <i386.h>
 #include <ATAManager.h>
+#include <Partition.h>
+#include <PCIDriver.h>
+#include <ProcessManager.h>
 #include <AutoDisable.h>
 #include <io_utils.h>
 #include <mem_utils.h>
+#include <printf.h>
 #include <Debug.h>
 
+ATAManager::ATAManager()
+	: primaryChannel(PRIMARY_IDE), secondaryChannel(SECONDARY_IDE)
+{ ; }
+
 int ATAManager::Startup()
 {
 	DeviceInfo	tmpInfo;
 	
+	// we're installed on IRQ 14 & 15, so the drivers can sleep until the drive is ready
+	primaryChannel.useIRQ = true;
+	secondaryChannel.useIRQ = true;
+	
+	bool	haveBusMaster = SetupBusMaster();
+	
 	// poll the hardware and insert each device into the map
 	if(GetDeviceInformation(PRIMARY_IDE, DEVICE_0, tmpInfo))
 	{
-		ATADrivers.insert(pair<string, ATADriver*>(string("/dev/hda"), new ATADriver(PRIMARY_IDE, DEVICE_0)));
+		ATADrivers.insert(pair<string, ATADriver*>(string("/dev/hda"), new ATADriver(PRIMARY_IDE, DEVICE_0, &primaryChannel)));
 		ATAInformation.insert(pair<string, DeviceInfo>(string("/dev/hda"), tmpInfo));
 // 		PrintATAInfo(tmpInfo);
 	}
 	
 	if(GetDeviceInformation(PRIMARY_IDE, DEVICE_1, tmpInfo))
 	{
-		ATADrivers.insert(pair<string, ATADriver*>(string("/dev/hdb"), new ATADriver(PRIMARY_IDE, DEVICE_1)));
+		ATADrivers.insert(pair<string, ATADriver*>(string("/dev/hdb"), new ATADriver(PRIMARY_IDE, DEVICE_1, &primaryChannel)));
 		ATAInformation.insert(pair<string, DeviceInfo>(string("/dev/hdb"), tmpInfo));
 // 		PrintATAInfo(tmpInfo);
 	}
 	
 	if(GetDeviceInformation(SECONDARY_IDE, DEVICE_0, tmpInfo))
 	{
-		ATADrivers.insert(pair<string, ATADriver*>(string("/dev/hdc"), new ATADriver(SECONDARY_IDE, DEVICE_0)));
+		ATADrivers.insert(pair<string, ATADriver*>(string("/dev/hdc"), new ATADriver(SECONDARY_IDE, DEVICE_0, &secondaryChannel)));
 		ATAInformation.insert(pair<string, DeviceInfo>(string("/dev/hdc"), tmpInfo));
 // 		PrintATAInfo(tmpInfo);
 	}
 	
 	if(GetDeviceInformation(SECONDARY_IDE, DEVICE_1, tmpInfo))
 	{
-		ATADrivers.insert(pair<string, ATADriver*>(string("/dev/hdd"), new ATADriver(SECONDARY_IDE, DEVICE_1)));
+		ATADrivers.insert(pair<string, ATADriver*>(string("/dev/hdd"), new ATADriver(SECONDARY_IDE, DEVICE_1, &secondaryChannel)));
 		ATAInformation.insert(pair<string, DeviceInfo>(string("/dev/hdd"), tmpInfo));
 // 		PrintATAInfo(tmpInfo);
 	}
 	
+	// setup the transfer modes on the drives, the partitions copy these from them
+	for(map<string, ATADriver*>::iterator it = ATADrivers.begin(); it != ATADrivers.end(); ++it)
+	{
+		DeviceInfo	info = (*ATAInformation.find((*it).first)).second;
+		
+		(*it).second->useDMA = haveBusMaster && info.DMASupported;
+		(*it).second->useLBA48 = info.LBA48Supported;
+		(*it).second->ChangeBaseAddress(0, GetSectorCount(info));
+		
+		// move as many sectors as we can per interrupt for PIO
+		if(info.maxSectorsForMultiple > 1)
+			(*it).second->SetMultipleMode(info.maxSectorsForMultiple);
+	}
+	
+	// from here on requests go through the queues
+	StartWorker(primaryChannel);
+	StartWorker(secondaryChannel);
+	
 	// once we have all the drives installed, go through and partition them
-	list<ulong>	addrList;
+	list<string>	driveNames;
 	
-	for(map<string, ATADriver*>::iterator it = ATADrivers.begin(), end = ATADrivers.end(); it != end; ++it)
-	{
-		addrList.clear();	// clear out the list first
-		GetPartitionAddresses((*it).second, addrList);	// get the addresses
+	// the partitions go into the same map, so get the names of the drives first
+	for(map<string, ATADriver*>::iterator it = ATADrivers.begin(); it != ATADrivers.end(); ++it)
+		driveNames.push_back((*it).first);
 	
-		char	charCounter = '1';
+	for(list<string>::iterator it = driveNames.begin(); it != driveNames.end(); ++it)
+		AddPartitions(*it, (*ATADrivers.find(*it)).second);
 	
-		// go through the list and make devices for each of these
-		for(list<ulong>::iterator jt = addrList.begin(); jt != addrList.end(); ++jt)
-		{
-			ATADriver	*tmp = new ATADriver(*((*it).second));	// copy this device
-			string		tmpStr(1, charCounter);
-			
-			tmp->ChangeBaseAddress(*jt);	// change it's base address
-			
-			// insert the device with it's new name into the manager
-			ATADrivers.insert(pair<string, ATADriver*>((*it).first + tmpStr, tmp));
-			
-			++charCounter;
-		}
+	return(0);
+}
+
+void ATAManager::AddPartitions(string name, ATADriver *drive)
+{
+	vector<Partition::PartitionInfo>	partitions;
+	
+	if(Partition::Scan(drive, drive->GetBlockCount(), partitions) <= 0)
+		return;
+	
+	for(vector<Partition::PartitionInfo>::iterator it = partitions.begin(); it != partitions.end(); ++it)
+	{
+		ATADriver	*tmp = new ATADriver(*drive);	// copy this device
+		char		number[12];
+		
+		// the partition can't reach outside itself
+		tmp->ChangeBaseAddress((*it).start, (*it).size);
+		
+		sprintf(number, "%d", (*it).number);
+		
+		// insert the device with it's new name into the manager
+		ATADrivers.insert(pair<string, ATADriver*>(name + number, tmp));
 	}
+}
+
+ulong ATAManager::GetSectorCount(const DeviceInfo &info)
+{
+	if(!info.LBA48Supported)
+		return(info.totalAddressableSectors);
 	
-	return(0);
+	// our addresses are only 32-bits
+	if((info.totalAddressableSectors48 >> 32) != 0)
+		return(0xFFFFFFFF);
+	
+	return(ulong(info.totalAddressableSectors48));
 }
 
-int ATAManager::GetPartitionAddresses(ATADriver *blockDevice, list<ulong> &addrList)
+int ATAManager::IRQSignaled(Registers *regs)
 {
-	uchar			*buff = new uchar[1024];
-	PartitionDescriptor	*partDes;
+	ATAChannel	&channel = regs->int_no == IRQ_14 ? primaryChannel : secondaryChannel;
 	
-	// assumes 512 blocks
-	blockDevice->ReadBlocks(0, 2, buff);
-// 	blockDevice->ReadBlocks(116, 2, buff);
+	// reading the primary status register acknowledges the interrupt
+	uchar	statusReg = inb(channel.ide | ATADriver::STATUS_REG);
 	
-	// sanity check
-	if(buff[510] != 0x55 || buff[511] != 0xAA)
+	// IDENTIFY and polled commands raise interrupts nobody is waiting for
+	if(channel.waiting)
 	{
-		PANIC("BAD PARTITION\n", false);
-		return(-1);
+		channel.waiting = false;
+		channel.status = statusReg;
+		channel.irqSignal.Signal();
 	}
+	
+	return(0);
+}
 
-	for(int i=0; i < 4; ++i)
+void ATAManager::StartWorker(ATAChannel &channel)
+{
+	// only if there is a drive on the channel
+	for(map<string, ATADriver*>::iterator it = ATADrivers.begin(); it != ATADrivers.end(); ++it)
 	{
-		partDes = reinterpret_cast<PartitionDescriptor*>(&buff[446+(i*16)]);
-		
-		if(partDes->lbaPartitionStart != 0)
+		if((*it).second->channel == &channel)
 		{
-// 			DEBUG("GOT %d\n", partDes->lbaPartitionStart);
-// 			DEBUG("MAKING IT: %d\n", partDes->lbaPartitionStart + 116);
-			
-			addrList.push_back(partDes->lbaPartitionStart);
+			ProcessManager::GetInstance().CreateThread(ATADriver::ChannelWorker, &channel, Thread::KERNEL, KERNEL_PID);
+			channel.workerRunning = true;
+			return;
 		}
 	}
+}
+
+bool ATAManager::SetupBusMaster()
+{
+	PCIDriver			pciDriver(0);
+	PCIDriver::DeviceConfig		ideConfig;
+	
+	if(!pciDriver.FindDevice(PCIDriver::CLASS_MASS_STORAGE, PCIDriver::SUBCLASS_IDE, ideConfig))
+		return(false);
 	
+	// BAR4 has to be in I/O space
+	if((ideConfig.baseAddr4 & 0x1) == 0 || (ideConfig.baseAddr4 & 0xFFFC) == 0)
+		return(false);
+	
+	ushort	base = ideConfig.baseAddr4 & 0xFFFC;
+	
+	pciDriver.EnableBusMaster(ideConfig);
 	
-	delete [] buff;
+	// the secondary channel's registers follow the primary's
+	ATADriver::SetupBusMaster(&primaryChannel, base);
+	ATADriver::SetupBusMaster(&secondaryChannel, base + 8);
 	
-	return 0;
+	DEBUG("ATA: bus-master IDE at 0x%x\n", base);
+	
+	return(true);
 }
 
-
 int ATAManager::Shutdown()
 {
 	// go through the map and delete all the devices
@@ -306,6 +379,11 @@ bool ATAManager::GetDeviceInformation(ushort controller, uchar device, DeviceInf
 	MemCopy(&devInfo.totalAddressableSectors, &tmpBuf[60], sizeof(devInfo.totalAddressableSectors));
 
 	devInfo.ATAVersion = tmpBuf[80];
+	devInfo.DMASupported = tmpBuf[49] & 0x0100;
+	devInfo.LBA48Supported = tmpBuf[83] & 0x0400;
+	
+	if(devInfo.LBA48Supported)
+		MemCopy(&devInfo.totalAddressableSectors48, &tmpBuf[100], sizeof(devInfo.totalAddressableSectors48));
 	
 	return(true);	
 }
@@ -336,5 +414,8 @@ void ATAManager::PrintATAInfo(const DeviceInfo &info)
 	DEBUG("NUM SEC FOR MULT: %d\n", info.curNumSectorsForMultiple);
 	DEBUG("TOTAL SECTORS: %d\n", info.totalAddressableSectors);
 	DEBUG("ATA VERSION: %d\n", info.ATAVersion);
+	DEBUG("DMA: %s\n", info.DMASupported ? "YES" : "NO");
+	DEBUG("LBA48: %s\n", info.LBA48Supported ? "YES" : "NO");
+	DEBUG("TOTAL SECTORS (48): 0x%x%08x\n", ulong(info.totalAddressableSectors48 >> 32), ulong(info.totalAddressableSectors48));
 }
 
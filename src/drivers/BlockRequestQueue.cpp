@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file BlockRequestQueue.cpp
+ *
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <AutoDisable.h>
+#include <BlockRequestQueue.h>
+#include <Debug.h>
+
+BlockRequestQueue::BlockRequestQueue()
+	: pendingCount(0), numUnits(0)
+{ ; }
+
+ulong &BlockRequestQueue::HeadPosition(ulong unit)
+{
+	uint	i;
+
+	for(i=0; i < numUnits; ++i)
+		if(headUnit[i] == unit)
+			return(headPosition[i]);
+
+	// a new unit starts at the beginning of the drive
+	if(numUnits == MAX_UNITS)
+		PANIC("Too many units on one queue: 0x%x\n", unit);
+
+	headUnit[numUnits] = unit;
+	headPosition[numUnits] = 0;
+
+	return(headPosition[numUnits++]);
+}
+
+void BlockRequestQueue::Submit(BlockRequest *request)
+{
+	request->nextMerged = NULL;
+	request->passedOver = 0;
+	request->result = 0;
+
+	{
+		AutoDisable	lock;
+
+		pending.push_back(request);
+	}
+
+	pendingCount.Signal();	// wake the worker
+}
+
+BlockRequest *BlockRequestQueue::Next(int maxBlocks)
+{
+	pendingCount.Wait();	// wait for at least one request
+
+	AutoDisable			lock;
+	list<BlockRequest*>::iterator	chosen = pending.end();
+	list<BlockRequest*>::iterator	lowest = pending.end();
+	list<BlockRequest*>::iterator	it;
+
+	// the oldest request is at the front, it goes first if it has waited long enough
+	if((*pending.begin())->passedOver >= MAX_PASSED_OVER)
+		chosen = pending.begin();
+
+	else
+	{
+		// the lowest address past its unit's heads, or the lowest one overall if there isn't one
+		for(it = pending.begin(); it != pending.end(); ++it)
+		{
+			ulong	addr = (*it)->address;
+
+			if(addr >= HeadPosition((*it)->unit) && (chosen == pending.end() || addr < (*chosen)->address))
+				chosen = it;
+
+			if(lowest == pending.end() || addr < (*lowest)->address)
+				lowest = it;
+		}
+
+		if(chosen == pending.end())
+			chosen = lowest;
+	}
+
+	BlockRequest	*command = *chosen;
+	BlockRequest	*tail = command;
+	int		totalBlocks = command->blockCount;
+	bool		merged = true;
+
+	pending.erase(chosen);
+
+	// chain on the requests that pick up where the command leaves off
+	while(merged)
+	{
+		merged = false;
+
+		for(it = pending.begin(); it != pending.end(); ++it)
+		{
+			BlockRequest	*req = *it;
+
+			if(req->unit == command->unit &&
+			   req->write == command->write &&
+			   req->address == tail->address + tail->blockCount &&
+			   totalBlocks + req->blockCount <= maxBlocks)
+			{
+				tail->nextMerged = req;
+				tail = req;
+				totalBlocks += req->blockCount;
+
+				pending.erase(it);
+				pendingCount.Wait();	// it was counted, this never blocks
+
+				merged = true;
+				break;
+			}
+		}
+	}
+
+	tail->nextMerged = NULL;
+
+	// everything still waiting was passed over once more
+	for(it = pending.begin(); it != pending.end(); ++it)
+		++(*it)->passedOver;
+
+	HeadPosition(command->unit) = tail->address + tail->blockCount;
+
+	return(command);
+}
+
+void BlockRequestQueue::Complete(BlockRequest *command, int result)
+{
+	while(command != NULL)
+	{
+		// Done can free the request, so get the next one first
+		BlockRequest	*next = command->nextMerged;
+
+		command->result = result < 0 ? result : command->blockCount;
+
+		if(command->Done != NULL)
+			command->Done(command);
+
+		command = next;
+	}
+}
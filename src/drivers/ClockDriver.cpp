@@ -21,6 +21,7 @@
 #include <types.h>
 #include <ClockDriver.h>
 #include <io_utils.h>
+#include <AutoDisable.h>
 #include <Debug.h>
 
 #include <ProcessManager.h>
@@ -29,6 +30,10 @@
 const seconds_t	ClockDriver::SECONDS_PER_MONTH[12] =
 { 0, 2678400, 2419200, 2678400, 2592000, 2678400, 2592000, 2678400, 2678400, 2592000, 2678400, 2592000 };	
 
+ClockDriver::ClockDriver()
+	: ticks(0), seconds(0), numSecondCallbacks(0)
+{ ; }
+
 int ClockDriver::Startup()
 {
 	// we want to set our clock to 100Hz
@@ -101,11 +106,26 @@ int ClockDriver::IRQSignaled(Registers *regs)
 	{
 //		DEBUG("SECOND\n");
 		seconds++;
+		
+		for(int i=0; i < numSecondCallbacks; ++i)
+			secondCallbacks[i]();
 	}
 
 	return(0);
 }
 
+int ClockDriver::AddSecondCallback(void (*callback)())
+{
+	AutoDisable	lock;	// the interrupt walks the array
+	
+	if(numSecondCallbacks == MAX_SECOND_CALLBACKS)
+		return(-1);
+	
+	secondCallbacks[numSecondCallbacks++] = callback;
+	
+	return(0);
+}
+
 int ClockDriver::Shutdown()
 {
 	// at some point this should be setup to reset the clock to the default
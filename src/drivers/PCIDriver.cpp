@@ -104,18 +104,55 @@ void PCIDriver::GetDeviceConfiguration(DeviceConfig &config, uchar device)
 			config.minGrant = (tmp >> 16) & 0xFF;
 			config.maxLatency = tmp >> 24;
 			
+			config.deviceNum = device;
+			config.functionNum = func;
+			
+			devices.push_back(config);
+			
 			DEBUG("%d:%d:%d\n", bus, device, func);
 			DEBUG("  DEV: %x VEN: %x CLASS: %d SUB CLASS: %d\n",
 				config.deviceID, config.vendorID, config.classCode, config.subClass);
-			DEBUG("  ADDR0: 0x%x ADDR1: 0x%x ADDR2: 0x%x ADDR3: 0x%x ADDR4: 0x%x ADDR5: 0x%x \n", config.baseAddr0, config.baseAddr1, config.baseAddr2, config.baseAddr3, config.baseAddr4, config.baseAddr5);
+			DEBUG("  ADDR0: 0x%x ADDR1: 0x%x ADDR2: 0x%x ADDR3: 0x%x ADDR4: 0x%x ADDR5: 0x%x \n",
+				config.baseAddr0, config.baseAddr1, config.baseAddr2,
+				config.baseAddr3, config.baseAddr4, config.baseAddr5);
 			DEBUG("INT LINE: %d INT PIN: %d\n", config.intLine, config.intPin);
 		}
 	}
 }
 
+bool PCIDriver::FindDevice(uchar classCode, uchar subClass, DeviceConfig &config)
+{
+	for(uint i=0; i < devices.size(); ++i)
+	{
+		if(devices[i].classCode == classCode && devices[i].subClass == subClass)
+		{
+			config = devices[i];
+			return(true);
+		}
+	}
+	
+	return(false);
+}
+
+void PCIDriver::EnableBusMaster(const DeviceConfig &config)
+{
+	// the command register is the low word of register 4
+	ConfigRegister	theConfigReg(bus, config.deviceNum, config.functionNum, 4);
+	ulong		tmp = ReadConfig(theConfigReg);
+	
+	if(!(tmp & COMMAND_BUS_MASTER))
+		WriteConfig(theConfigReg, (tmp & 0xFFFF) | COMMAND_BUS_MASTER);	// don't write 1s to clear the status
+}
+
 ulong PCIDriver::ReadConfig(const ConfigRegister &reg)
 {
 	outl(CONFIG_ADDRESS, reg.theReg.config);	// write out the register
 	return inl(CONFIG_DATA);			// read and return the data
 }
 
+void PCIDriver::WriteConfig(const ConfigRegister &reg, ulong value)
+{
+	outl(CONFIG_ADDRESS, reg.theReg.config);	// write out the register
+	outl(CONFIG_DATA, value);			// write the data
+}
+
@@ -0,0 +1,860 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file BufferCache.cpp
+ *
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <errno.h>
+#include <mem_utils.h>
+#include <AutoDisable.h>
+#include <Devices.h>
+#include <ClockDriver.h>
+#include <ProcessManager.h>
+#include <BufferCache.h>
+#include <LRUList.h>
+#include <Debug.h>
+
+BufferCache::BufferCache()
+	: lruHead(NULL), lruTail(NULL), usedMemory(0), dirtyMemory(0), maxMemory(DEFAULT_MAX_MEMORY), largestBuffer(1),
+	  flushSignal(0), flusherRunning(false)
+{
+	for(uint i=0; i < NUM_BUCKETS; ++i)
+		buckets[i] = NULL;
+}
+
+Buffer *BufferCache::Get(BlockDevice *device, ulong address, int blockCount, bool read)
+{
+	if(!ToWholeDevice(device, address, blockCount))
+		return(NULL);
+
+	Buffer	*buffer = Acquire(device, address, blockCount);
+
+	if(buffer == NULL)
+		return(NULL);
+
+	if(read)
+	{
+		buffer->ioLock.Wait();	// someone else might be reading it in
+
+		if(!buffer->valid)
+		{
+			if(device->ReadBlocks(address, blockCount, buffer->data) < 0)
+			{
+				buffer->ioLock.Signal();
+				Release(buffer);
+				return(NULL);
+			}
+
+			buffer->valid = true;
+		}
+
+		buffer->ioLock.Signal();
+	}
+
+	if(usedMemory > maxMemory)
+		Shrink();
+
+	return(buffer);
+}
+
+void BufferCache::Release(Buffer *buffer)
+{
+	AutoDisable	lock;
+
+	if(buffer->refCount == 0)
+		PANIC("Released a buffer that wasn't held\n");
+
+	--buffer->refCount;
+}
+
+void BufferCache::MarkDirty(Buffer *buffer)
+{
+	AutoDisable	lock;
+
+	buffer->valid = true;
+
+	if(buffer->dirty)
+		return;
+
+	buffer->dirty = true;
+	buffer->dirtyTime = ClockDriver::GetInstance().GetTimeInSeconds();
+
+	dirtyMemory += buffer->size;
+
+	// don't wait for the clock if too much is dirty
+	if(dirtyMemory > maxMemory / DIRTY_RATIO)
+		WakeFlusher();
+}
+
+int BufferCache::Read(BlockDevice *device, ulong address, int blocksPerBuffer, ulong numBuffers, uchar *dest)
+{
+	ulong	bufferSize = blocksPerBuffer * device->GetBlockSize();
+	ulong	i = 0;
+
+	if(!ToWholeDevice(device, address, numBuffers * blocksPerBuffer))
+		return(-1 * EINVAL);
+
+	while(i < numBuffers)
+	{
+		Buffer	*buffer = NULL;
+
+		// use the cached copy if there is one
+		{
+			AutoDisable	lock;
+
+			if((buffer = Lookup(device, address + i * blocksPerBuffer, blocksPerBuffer)) != NULL)
+			{
+				++buffer->refCount;
+				Touch(buffer);
+			}
+		}
+
+		if(buffer != NULL)
+		{
+			// it might still be on its way in from a readahead
+			if(!buffer->valid)
+			{
+				Release(buffer);
+
+				if((buffer = Get(device, address + i * blocksPerBuffer, blocksPerBuffer)) == NULL)
+					return(-1 * EIO);
+			}
+
+			MemCopy(dest + i * bufferSize, buffer->data, bufferSize);
+			Release(buffer);
+			++i;
+			continue;
+		}
+
+		// find the run of blocks that aren't cached and read them all at once
+		ulong	run = 1;
+
+		while(i + run < numBuffers)
+		{
+			AutoDisable	lock;
+
+			if(Lookup(device, address + (i + run) * blocksPerBuffer, blocksPerBuffer) != NULL)
+				break;
+
+			++run;
+		}
+
+		// a buffer of another size might have newer data for these blocks
+		int ret = EvictOverlaps(device, address + i * blocksPerBuffer, run * blocksPerBuffer, blocksPerBuffer);
+
+		if(ret < 0)
+			return(ret);
+
+		ret = device->ReadBlocks(address + i * blocksPerBuffer, run * blocksPerBuffer, dest + i * bufferSize);
+
+		if(ret < 0)
+			return(ret);
+
+		// put what was read into the cache
+		for(ulong j=i; j < i + run; ++j)
+		{
+			if((buffer = Acquire(device, address + j * blocksPerBuffer, blocksPerBuffer)) == NULL)
+				continue;	// it just isn't cached
+
+			buffer->ioLock.Wait();
+
+			// if it showed up while we were reading, it is newer than the disk
+			if(buffer->valid)
+				MemCopy(dest + j * bufferSize, buffer->data, bufferSize);
+
+			else
+			{
+				MemCopy(buffer->data, dest + j * bufferSize, bufferSize);
+				buffer->valid = true;
+			}
+
+			buffer->ioLock.Signal();
+
+			Release(buffer);
+		}
+
+		i += run;
+	}
+
+	if(usedMemory > maxMemory)
+		Shrink();
+
+	return(numBuffers * blocksPerBuffer);
+}
+
+void BufferCache::ReadAhead(BlockDevice *device, ulong address, int blocksPerBuffer, ulong numBuffers)
+{
+	ReadAheadRequest	*readAhead = NULL;
+	ulong			deviceBlocks = device->GetBlockCount();
+
+	// don't read past the end of the device (or partition)
+	if(deviceBlocks != 0)
+	{
+		if(address >= deviceBlocks)
+			return;
+
+		numBuffers = MIN(numBuffers, (deviceBlocks - address) / blocksPerBuffer);
+	}
+
+	if(!ToWholeDevice(device, address, numBuffers * blocksPerBuffer))
+		return;
+
+	for(ulong i=0; i < numBuffers; ++i)
+	{
+		ulong	bufferAddress = address + i * blocksPerBuffer;
+		Buffer	*buffer = NULL;
+		bool	cached;
+
+		// don't bother making a buffer for something that is already here
+		{
+			AutoDisable	lock;
+
+			cached = Lookup(device, bufferAddress, blocksPerBuffer) != NULL;
+		}
+
+		// a buffer of another size with these blocks is treated like a cached one, it isn't worth the write
+		if(!cached)
+		{
+			AutoDisable	lock;
+
+			cached = FindOverlap(device, bufferAddress, blocksPerBuffer, blocksPerBuffer) != NULL;
+		}
+
+		if(!cached)
+		{
+			buffer = NewBuffer(device, bufferAddress, blocksPerBuffer);
+			buffer->ioLock.Wait();	// held until the read is done, this never blocks
+
+			{
+				AutoDisable	lock;
+
+				if(!(cached = Lookup(device, bufferAddress, blocksPerBuffer) != NULL ||
+					      FindOverlap(device, bufferAddress, blocksPerBuffer, blocksPerBuffer) != NULL))
+					Insert(buffer);
+			}
+
+			if(cached)
+				Free(buffer);
+		}
+
+		// a cached block breaks the run
+		if(cached)
+		{
+			if(readAhead != NULL)
+				SubmitReadAhead(readAhead);
+
+			readAhead = NULL;
+			continue;
+		}
+
+		if(readAhead != NULL && (readAhead->count + 1) * blocksPerBuffer > MAX_READAHEAD_BLOCKS)
+		{
+			SubmitReadAhead(readAhead);
+			readAhead = NULL;
+		}
+
+		if(readAhead == NULL)
+		{
+			readAhead = new ReadAheadRequest;
+			readAhead->count = 0;
+		}
+
+		readAhead->buffers[readAhead->count++] = buffer;
+	}
+
+	if(readAhead != NULL)
+		SubmitReadAhead(readAhead);
+
+	if(usedMemory > maxMemory)
+		Shrink();
+}
+
+void BufferCache::SubmitReadAhead(ReadAheadRequest *readAhead)
+{
+	Buffer	*first = readAhead->buffers[0];
+	int	totalBlocks = readAhead->count * first->blockCount;
+
+	// a single buffer can be read right into place
+	if(readAhead->count == 1)
+		readAhead->bounce = NULL;
+	else
+		readAhead->bounce = new uchar[readAhead->count * first->size];
+
+	readAhead->request.address = first->address;
+	readAhead->request.blockCount = totalBlocks;
+	readAhead->request.buff = readAhead->bounce == NULL ? first->data : readAhead->bounce;
+	readAhead->request.write = false;
+	readAhead->request.Done = ReadAheadDone;
+	readAhead->request.arg = readAhead;
+
+	first->device->SubmitRequest(&readAhead->request);
+}
+
+void BufferCache::ReadAheadDone(BlockRequest *request)
+{
+	BufferCache		&cache = GetInstance();
+	ReadAheadRequest	*readAhead = reinterpret_cast<ReadAheadRequest*>(request->arg);
+
+	for(int i=0; i < readAhead->count; ++i)
+	{
+		Buffer	*buffer = readAhead->buffers[i];
+
+		// on an error they stay invalid, and Get will try again
+		if(request->result >= 0)
+		{
+			if(readAhead->bounce != NULL)
+				MemCopy(buffer->data, readAhead->bounce + i * buffer->size, buffer->size);
+
+			buffer->valid = true;
+		}
+
+		buffer->ioLock.Signal();
+		cache.Release(buffer);
+	}
+
+	if(readAhead->bounce != NULL)
+		delete [] readAhead->bounce;
+
+	delete readAhead;
+}
+
+int BufferCache::Write(BlockDevice *device, ulong address, int blocksPerBuffer, ulong numBuffers, uchar *src)
+{
+	ulong	bufferSize = blocksPerBuffer * device->GetBlockSize();
+
+	if(!ToWholeDevice(device, address, numBuffers * blocksPerBuffer))
+		return(-1 * EINVAL);
+
+	for(ulong i=0; i < numBuffers; ++i)
+	{
+		Buffer	*buffer = Acquire(device, address + i * blocksPerBuffer, blocksPerBuffer);
+
+		if(buffer == NULL)
+			return(-1 * EIO);
+
+		buffer->ioLock.Wait();	// don't let a read in progress clobber the new data
+
+		MemCopy(buffer->data, src + i * bufferSize, bufferSize);
+		MarkDirty(buffer);
+
+		buffer->ioLock.Signal();
+
+		Release(buffer);
+	}
+
+	if(usedMemory > maxMemory)
+		Shrink();
+
+	return(numBuffers * blocksPerBuffer);
+}
+
+int BufferCache::Sync(BlockDevice *device)
+{
+	return(WriteDirty(device, true));
+}
+
+void BufferCache::StartFlusher()
+{
+	{
+		AutoDisable	lock;
+
+		if(flusherRunning)
+			return;
+
+		flusherRunning = true;
+	}
+
+	ProcessManager::GetInstance().CreateThread(Flusher, this, Thread::KERNEL, KERNEL_PID);
+	ClockDriver::GetInstance().AddSecondCallback(Tick);
+}
+
+void BufferCache::Invalidate(BlockDevice *device)
+{
+	Buffer	*dropped = NULL;
+
+	{
+		AutoDisable	lock;
+		Buffer		*buffer = lruHead;
+
+		while(buffer != NULL)
+		{
+			Buffer	*next = buffer->lruNext;
+
+			if(OnDevice(device, buffer))
+			{
+				if(buffer->refCount != 0)
+					WARN("Invalidating a buffer that is still held\n");
+
+				else
+				{
+					ClearDirty(buffer);	// any changes are thrown away
+					Unlink(buffer);
+
+					buffer->hashNext = dropped;	// keep a list so they can be freed later
+					dropped = buffer;
+				}
+			}
+
+			buffer = next;
+		}
+	}
+
+	while(dropped != NULL)
+	{
+		Buffer	*next = dropped->hashNext;
+
+		Free(dropped);
+		dropped = next;
+	}
+}
+
+void BufferCache::SetMaxMemory(ulong bytes)
+{
+	maxMemory = bytes;
+
+	if(usedMemory > maxMemory)
+		Shrink();
+}
+
+bool BufferCache::ToWholeDevice(BlockDevice *&device, ulong &address, ulong numBlocks)
+{
+	ulong	deviceBlocks = device->GetBlockCount();
+
+	// don't let a partition reach outside itself
+	if(deviceBlocks != 0 && (address >= deviceBlocks || numBlocks > deviceBlocks - address))
+		return(false);
+
+	address += device->GetWholeDeviceOffset();
+	device = device->GetWholeDevice();
+
+	return(true);
+}
+
+bool BufferCache::OnDevice(BlockDevice *device, Buffer *buffer)
+{
+	if(device == NULL)
+		return(true);
+
+	if(buffer->device != device->GetWholeDevice())
+		return(false);
+
+	ulong	start = device->GetWholeDeviceOffset();
+	ulong	deviceBlocks = device->GetBlockCount();
+
+	return(buffer->address >= start && (deviceBlocks == 0 || buffer->address - start < deviceBlocks));
+}
+
+Buffer *BufferCache::Lookup(BlockDevice *device, ulong address, int blockCount)
+{
+	for(Buffer *buffer = buckets[Hash(device, address)]; buffer != NULL; buffer = buffer->hashNext)
+	{
+		if(buffer->device == device && buffer->address == address && buffer->blockCount == blockCount)
+			return(buffer);
+	}
+
+	return(NULL);
+}
+
+Buffer *BufferCache::FindOverlap(BlockDevice *device, ulong address, ulong numBlocks, int blocksPerBuffer)
+{
+	// a buffer that reaches into the range starts at most largestBuffer - 1 blocks before it
+	ulong	first = address > ulong(largestBuffer - 1) ? address - (largestBuffer - 1) : 0;
+
+	for(ulong addr = first; addr < address + numBlocks; ++addr)
+	{
+		for(Buffer *buffer = buckets[Hash(device, addr)]; buffer != NULL; buffer = buffer->hashNext)
+		{
+			if(buffer->device != device || buffer->address != addr || addr + buffer->blockCount <= address)
+				continue;
+
+			// one of the buffers the range is made of
+			if(addr >= address && buffer->blockCount == blocksPerBuffer && (addr - address) % blocksPerBuffer == 0)
+				continue;
+
+			return(buffer);
+		}
+	}
+
+	return(NULL);
+}
+
+int BufferCache::EvictOverlaps(BlockDevice *device, ulong address, ulong numBlocks, int blocksPerBuffer)
+{
+	while(1)
+	{
+		Buffer	*victim;
+
+		{
+			AutoDisable	lock;
+
+			if((victim = FindOverlap(device, address, numBlocks, blocksPerBuffer)) == NULL)
+				return(0);
+
+			if(victim->refCount == 0 && !victim->dirty)
+				Unlink(victim);
+
+			else
+				++victim->refCount;	// hold it while it is written out or its holders finish
+		}
+
+		if(victim->refCount == 0)
+		{
+			Free(victim);
+			continue;
+		}
+
+		int	ret = WriteBack(victim);
+
+		// a readahead holds it until the data is in
+		victim->ioLock.Wait();
+		victim->ioLock.Signal();
+
+		bool	held;
+
+		{
+			AutoDisable	lock;
+
+			held = victim->refCount > 1;
+		}
+
+		Release(victim);
+
+		if(ret < 0)
+			return(ret);
+
+		// someone is copying in or out of it, let them finish before trying again
+		if(held)
+			ProcessManager::GetInstance().PerformTaskSwitch();
+	}
+}
+
+Buffer *BufferCache::Acquire(BlockDevice *device, ulong address, int blockCount)
+{
+	Buffer	*buffer = NULL;
+	Buffer	*newBuffer = NULL;
+
+	while(1)
+	{
+		{
+			AutoDisable	lock;
+
+			// someone might have beaten us to it
+			if((buffer = Lookup(device, address, blockCount)) != NULL)
+			{
+				++buffer->refCount;
+				Touch(buffer);
+				break;
+			}
+
+			if(newBuffer != NULL && FindOverlap(device, address, blockCount, blockCount) == NULL)
+			{
+				Insert(newBuffer);
+				return(newBuffer);
+			}
+		}
+
+		// no other buffer can have any of its blocks
+		if(EvictOverlaps(device, address, blockCount, blockCount) < 0)
+			break;
+
+		// make the new buffer with interrupts on
+		if(newBuffer == NULL)
+			newBuffer = NewBuffer(device, address, blockCount);
+	}
+
+	if(newBuffer != NULL)
+		Free(newBuffer);
+
+	return(buffer);
+}
+
+Buffer *BufferCache::NewBuffer(BlockDevice *device, ulong address, int blockCount)
+{
+	Buffer	*buffer = new Buffer;
+
+	buffer->device = device;
+	buffer->address = address;
+	buffer->blockCount = blockCount;
+	buffer->size = blockCount * device->GetBlockSize();
+	buffer->data = new uchar[buffer->size];
+	buffer->refCount = 1;
+	buffer->valid = false;
+	buffer->dirty = false;
+	buffer->dirtyTime = 0;
+	buffer->hashNext = buffer->lruPrev = buffer->lruNext = NULL;
+
+	return(buffer);
+}
+
+void BufferCache::Insert(Buffer *buffer)
+{
+	uint	bucket = Hash(buffer->device, buffer->address);
+
+	buffer->hashNext = buckets[bucket];
+	buckets[bucket] = buffer;
+
+	Touch(buffer);
+
+	usedMemory += buffer->size;
+
+	if(buffer->blockCount > largestBuffer)
+		largestBuffer = buffer->blockCount;
+}
+
+void BufferCache::Unlink(Buffer *buffer)
+{
+	// take it out of the hash chain
+	Buffer	**link = &buckets[Hash(buffer->device, buffer->address)];
+
+	while(*link != buffer)
+		link = &(*link)->hashNext;
+
+	*link = buffer->hashNext;
+
+	LRUUnlink(buffer, lruHead, lruTail);
+
+	usedMemory -= buffer->size;
+}
+
+void BufferCache::Touch(Buffer *buffer)
+{
+	LRUTouch(buffer, lruHead, lruTail);
+}
+
+int BufferCache::WriteBack(Buffer *buffer)
+{
+	{
+		AutoDisable	lock;
+
+		if(!buffer->dirty)
+			return(0);
+
+		ClearDirty(buffer);	// changes made during the write will mark it again
+	}
+
+	int ret = buffer->device->WriteBlocks(buffer->address, buffer->blockCount, buffer->data);
+
+	if(ret < 0)
+		MarkDirty(buffer);
+
+	return(ret);
+}
+
+int BufferCache::WriteDirty(BlockDevice *device, bool all)
+{
+	seconds_t	now = ClockDriver::GetInstance().GetTimeInSeconds();
+	Buffer		*run[MAX_FLUSH_BLOCKS];
+
+	while(1)
+	{
+		int	count;
+
+		// find the oldest buffer that needs to go out and hold it with its neighbors
+		{
+			AutoDisable	lock;
+			Buffer		*buffer;
+			bool		pressure = dirtyMemory > maxMemory / DIRTY_RATIO;
+
+			for(buffer = lruTail; buffer != NULL; buffer = buffer->lruPrev)
+			{
+				if(buffer->dirty &&
+				   OnDevice(device, buffer) &&
+				   (all || pressure || now - buffer->dirtyTime >= DIRTY_AGE))
+					break;
+			}
+
+			if(buffer == NULL)
+				return(0);
+
+			count = HoldDirtyRun(buffer, run);
+		}
+
+		int	ret;
+
+		if(count == 1)
+			ret = WriteBack(run[0]);
+
+		else
+		{
+			// copy the run into one piece of memory so it goes out in one request
+			BlockDevice	*runDevice = run[0]->device;
+			ulong		blockSize = runDevice->GetBlockSize();
+			int		totalBlocks = 0;
+
+			for(int i=0; i < count; ++i)
+				totalBlocks += run[i]->blockCount;
+
+			uchar	*bounce = new uchar[totalBlocks * blockSize];
+			uchar	*pos = bounce;
+
+			for(int i=0; i < count; ++i)
+			{
+				{
+					AutoDisable	lock;
+
+					ClearDirty(run[i]);	// changes made during the write will mark it again
+				}
+
+				MemCopy(pos, run[i]->data, run[i]->size);
+				pos += run[i]->size;
+			}
+
+			ret = runDevice->WriteBlocks(run[0]->address, totalBlocks, bounce);
+
+			if(ret < 0)
+			{
+				for(int i=0; i < count; ++i)
+					MarkDirty(run[i]);
+			}
+
+			delete [] bounce;
+		}
+
+		for(int i=0; i < count; ++i)
+			Release(run[i]);
+
+		if(ret < 0)
+			return(ret);
+	}
+}
+
+int BufferCache::HoldDirtyRun(Buffer *buffer, Buffer *run[])
+{
+	Buffer	*first = buffer;
+	int	maxBack = MAX_FLUSH_BLOCKS / buffer->blockCount - 1;
+
+	// back up to the start of the run, but not so far that buffer won't fit
+	for(int i=0; i < maxBack && first->address >= ulong(first->blockCount); ++i)
+	{
+		Buffer	*prev = Lookup(first->device, first->address - first->blockCount, first->blockCount);
+
+		if(prev == NULL || !prev->dirty)
+			break;
+
+		first = prev;
+	}
+
+	int	count = 0;
+	int	blocks = 0;
+
+	for(Buffer *cur = first; cur != NULL; cur = Lookup(cur->device, cur->address + cur->blockCount, cur->blockCount))
+	{
+		if(!cur->dirty)
+			break;
+
+		if(count != 0 && blocks + cur->blockCount > MAX_FLUSH_BLOCKS)
+			break;
+
+		++cur->refCount;
+		run[count++] = cur;
+		blocks += cur->blockCount;
+	}
+
+	return(count);
+}
+
+void BufferCache::ClearDirty(Buffer *buffer)
+{
+	if(!buffer->dirty)
+		return;
+
+	buffer->dirty = false;
+	dirtyMemory -= buffer->size;
+}
+
+void BufferCache::Flusher(void *arg)
+{
+	BufferCache	*cache = reinterpret_cast<BufferCache*>(arg);
+
+	// this thread lives as long as the kernel
+	while(1)
+	{
+		cache->flushSignal.Wait();
+
+		cache->WriteDirty(NULL, false);
+	}
+}
+
+void BufferCache::Tick()
+{
+	BufferCache	&cache = GetInstance();
+
+	if(cache.dirtyMemory != 0)
+		cache.WakeFlusher();
+}
+
+void BufferCache::WakeFlusher()
+{
+	AutoDisable	lock;
+
+	// one signal is enough to get it to look at everything
+	if(flusherRunning && flushSignal.GetValue() == 0)
+		flushSignal.Signal();
+}
+
+void BufferCache::Shrink()
+{
+	while(usedMemory > maxMemory)
+	{
+		Buffer	*victim;
+
+		{
+			AutoDisable	lock;
+
+			// the least recently used buffer nobody is holding
+			for(victim = lruTail; victim != NULL; victim = victim->lruPrev)
+			{
+				if(victim->refCount == 0)
+					break;
+			}
+
+			if(victim == NULL)
+				return;	// everything is held, we'll have to go over for now
+
+			if(victim->dirty)
+				++victim->refCount;	// hold it while it is written out
+
+			else
+				Unlink(victim);
+		}
+
+		if(victim->refCount == 0)
+		{
+			Free(victim);
+			continue;
+		}
+
+		// it stays at the end of the list, so it is freed next time around
+		ulong	address = victim->address;
+		int	ret = WriteBack(victim);
+
+		Release(victim);
+
+		if(ret < 0)
+		{
+			WARN("Couldn't write back buffer for block %u\n", address);
+			return;
+		}
+	}
+}
+
+void BufferCache::Free(Buffer *buffer)
+{
+	delete [] buffer->data;
+	delete buffer;
+}
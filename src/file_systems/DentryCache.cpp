@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+
+/** @file DentryCache.cpp
+ *
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <mem_utils.h>
+#include <AutoDisable.h>
+#include <DentryCache.h>
+#include <LRUList.h>
+#include <Debug.h>
+
+DentryCache::DentryCache()
+	: freeList(NULL), lruHead(NULL), lruTail(NULL)
+{
+	for(uint i=0; i < NUM_BUCKETS; ++i)
+		buckets[i] = NULL;
+
+	// everything starts out free
+	for(uint i=0; i < NUM_DENTRIES; ++i)
+	{
+		entries[i].fileSystem = NULL;
+		entries[i].hashNext = freeList;
+		freeList = &entries[i];
+	}
+}
+
+bool DentryCache::Find(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength, ulong &inode)
+{
+	if(nameLength > MAX_NAME_LENGTH)
+		return(false);
+
+	uint		bucket = Hash(fileSystem, parent, name, nameLength);
+	AutoDisable	lock;
+	Dentry		*dentry = Lookup(fileSystem, parent, name, nameLength, bucket);
+
+	if(dentry == NULL)
+		return(false);
+
+	Touch(dentry);
+	inode = dentry->inode;
+
+	return(true);
+}
+
+void DentryCache::Add(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength, ulong inode)
+{
+	if(nameLength > MAX_NAME_LENGTH)
+		return;
+
+	uint		bucket = Hash(fileSystem, parent, name, nameLength);
+	AutoDisable	lock;
+	Dentry		*dentry = Lookup(fileSystem, parent, name, nameLength, bucket);
+
+	// someone else might have added it
+	if(dentry != NULL)
+	{
+		dentry->inode = inode;
+		Touch(dentry);
+		return;
+	}
+
+	// take a free one, or reuse the least recently used
+	if(freeList != NULL)
+	{
+		dentry = freeList;
+		freeList = dentry->hashNext;
+	}
+
+	else
+	{
+		dentry = lruTail;
+		Unlink(dentry);
+	}
+
+	dentry->fileSystem = fileSystem;
+	dentry->parent = parent;
+	dentry->inode = inode;
+	dentry->nameLength = nameLength;
+	MemCopy(dentry->name, name, nameLength);
+
+	dentry->hashNext = buckets[bucket];
+	buckets[bucket] = dentry;
+
+	dentry->lruPrev = dentry->lruNext = NULL;
+	Touch(dentry);
+}
+
+void DentryCache::Remove(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength)
+{
+	if(nameLength > MAX_NAME_LENGTH)
+		return;
+
+	uint		bucket = Hash(fileSystem, parent, name, nameLength);
+	AutoDisable	lock;
+	Dentry		*dentry = Lookup(fileSystem, parent, name, nameLength, bucket);
+
+	if(dentry == NULL)
+		return;
+
+	Unlink(dentry);
+
+	dentry->fileSystem = NULL;
+	dentry->hashNext = freeList;
+	freeList = dentry;
+}
+
+void DentryCache::Purge(FileSystemBase *fileSystem)
+{
+	AutoDisable	lock;
+
+	for(uint i=0; i < NUM_DENTRIES; ++i)
+	{
+		if(entries[i].fileSystem != fileSystem)
+			continue;
+
+		Unlink(&entries[i]);
+
+		entries[i].fileSystem = NULL;
+		entries[i].hashNext = freeList;
+		freeList = &entries[i];
+	}
+}
+
+Dentry *DentryCache::Lookup(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength, uint bucket)
+{
+	for(Dentry *dentry = buckets[bucket]; dentry != NULL; dentry = dentry->hashNext)
+	{
+		if(dentry->fileSystem == fileSystem &&
+		   dentry->parent == parent &&
+		   dentry->nameLength == nameLength &&
+		   MemEqual(dentry->name, const_cast<char*>(name), nameLength))
+			return(dentry);
+	}
+
+	return(NULL);
+}
+
+void DentryCache::Unlink(Dentry *dentry)
+{
+	// take it out of the hash chain
+	Dentry	**link = &buckets[Hash(dentry->fileSystem, dentry->parent, dentry->name, dentry->nameLength)];
+
+	while(*link != dentry)
+		link = &(*link)->hashNext;
+
+	*link = dentry->hashNext;
+
+	LRUUnlink(dentry, lruHead, lruTail);
+}
+
+void DentryCache::Touch(Dentry *dentry)
+{
+	LRUTouch(dentry, lruHead, lruTail);
+}
+
+uint DentryCache::Hash(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength)
+{
+	ulong	hash = 2166136261UL ^ parent ^ (reinterpret_cast<ulong>(fileSystem) >> 4);
+
+	for(uint i=0; i < nameLength; ++i)
+	{
+		hash ^= uchar(name[i]);
+		hash *= 16777619UL;
+	}
+
+	return(hash % NUM_BUCKETS);
+}
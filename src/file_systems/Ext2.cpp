@@ -27,24 +27,31 @@
 #else
 
 #include <Ext2.h>
+#include <LRUList.h>
+#include <AutoDisable.h>
+#include <mem_utils.h>
+#include <errno.h>
 #include <Debug.h>
 
 #endif
 
 // the fd will be changed to a block device
 ext2::ext2(BlockDevice *theDrive, ulong baseAddress)
-	: FileSystemBase(theDrive, baseAddress)
+	: FileSystemBase(theDrive, baseAddress), inodeLRUHead(NULL), inodeLRUTail(NULL), numCachedInodes(0), allocLock(1),
+	  superBlockDirty(false)
 {
-	uchar		*buff = new uchar[1024];	// 2 block buffer, assume 512 byte blocks for ATA driver
+	for(uint i=0; i < NUM_INODE_BUCKETS; ++i)
+		inodeBuckets[i] = NULL;
 	
-	//
-	// CLEAN THIS UP & DOUBLE CHECK
-	//
-	ReadBlocks(2, 2, buff);
+	uchar		*buff = new uchar[SUPER_BLOCK_SIZE];
+	
+	// read it as block 1 of a 1K file system, on a 1K file system that is the same buffer every
+	// later access uses, and on a bigger one the cache drops it when block 0 is read
+	SetFileSystemBlockSize(SUPER_BLOCK_SIZE);
+	
+	if(ReadBlocks(SUPER_BLOCK_OFFSET / SUPER_BLOCK_SIZE, 1, buff) < 0)
+		PANIC("Couldn't read the super block\n");
 	
-/*	for(int i=0; i < 100; ++i)
-		printf("%x ", buff[i]);
-	*/
 	MemCopy(&theSuperBlock, buff, sizeof(SuperBlock));	// copy over the super block
 	
 	delete [] buff;	// delete this memory
@@ -73,6 +80,12 @@ ext2::ext2(BlockDevice *theDrive, ulong baseAddress)
 	// set the addresses per block
 	addrPerBlock = blockSize / sizeof(ulong);
 	
+	// rev 0 inodes are always 128 bytes, rev 1 says how big they are
+	inodeSize = theSuperBlock.revisionLevel == 0 ? sizeof(Inode) : theSuperBlock.inode_size;
+	
+	if(inodeSize < sizeof(Inode) || inodeSize > blockSize)
+		PANIC("Unknown inode size: %d\n", inodeSize);
+	
 /*	DEBUG("BLOCK SIZE: %d\n", blockSize);
 	DEBUG("BLOCK MUL: %d\n", blockMultiplier);
 	
@@ -107,7 +120,8 @@ ext2::ext2(BlockDevice *theDrive, ulong baseAddress)
 	//
 	// Figure out how many blocks there are for all the group descriptors
 	//
-	ulong			numGroups = DivUp(theSuperBlock.blockCount, theSuperBlock.blocksPerGroup);
+	numGroups = DivUp(theSuperBlock.blockCount - theSuperBlock.firstDataBlock, theSuperBlock.blocksPerGroup);
+	
 	ulong			blocksForGroupDescriptors = DivUp(numGroups*sizeof(GroupDescriptor), blockSize);
 	uchar			*groupBlocks = new uchar[blocksForGroupDescriptors * blockSize];
 	GroupDescriptor		*tmpDescriptor;
@@ -118,18 +132,11 @@ ext2::ext2(BlockDevice *theDrive, ulong baseAddress)
 	printf("SIZE: %d\n", blocksForGroupDescriptors * blockSize);
 */	
 	
-	int	groupAddr = 0;
-	
-	// I have no idea how to calculate this value
-	switch(blockSize)
-	{
-		case 1024: groupAddr += 2; break;
-		case 4096: groupAddr += 4; break;
-		default: PANIC("Unknown block size\n", false);
-	}
+	// the descriptors are in the block after the super block
+	groupDescriptorBlock = theSuperBlock.firstDataBlock + 1;
 	
 	// read in the group
-	ReadBlocks(groupAddr, blocksForGroupDescriptors, groupBlocks);
+	ReadBlocks(groupDescriptorBlock, blocksForGroupDescriptors, groupBlocks);
 	
 	for(ulong i=0; i < numGroups; ++i)
 	{
@@ -143,11 +150,39 @@ ext2::ext2(BlockDevice *theDrive, ulong baseAddress)
 		DEBUG("USED DIR: %d\n\n", tmpDescriptor->usedDirCount);
 */
 		theGroupDescriptors.push_back(*tmpDescriptor);	// add it to our list
+		
+		// the bitmaps are read in when they are first needed
+		blockBitmaps.push_back(NULL);
 	}
 	
 	delete [] groupBlocks;	// free up some memory
 }
 
+ext2::~ext2()
+{
+	// everything should be closed by now, so just write out what changed
+	while(inodeLRUHead != NULL)
+	{
+		CachedInode	*cachedInode = inodeLRUHead;
+		
+		DiscardPreallocation(cachedInode);
+		
+		if(cachedInode->dirty)
+			WriteInode(cachedInode->number, cachedInode);
+		
+		UnlinkInode(cachedInode);
+		delete cachedInode;
+	}
+	
+	WriteSuperBlock();
+	
+	for(ulong i=0; i < numGroups; ++i)
+	{
+		if(blockBitmaps[i] != NULL)
+			delete [] blockBitmaps[i];
+	}
+}
+
 FileDescriptorBase *ext2::CreateFileDescriptor(FileSystemBase *fsBase)
 {
 	return reinterpret_cast<FileDescriptorBase*>(new FileDescriptor(fsBase));
@@ -176,324 +211,1319 @@ int ext2::FindInodeByPath(string path)
 	{
 // 		DEBUG("DIR: %s\n", (*it).c_str());
 		
-		curInode = FindByNameInInode(curInode, *it);
+		curInode = FindByNameInInode(curInode, (*it).c_str(), (*it).size());
 	
 // 		DEBUG("CUR INODE: %d\n", curInode);
 
-		if(curInode == -1)
+		if(curInode <= 0)
 			return(-1);
 	}
 	
 	return(curInode);	
 }
 
-int ext2::FindByNameInInode(ulong inode, string name)
+int ext2::FindByNameInInode(ulong inode, const char *name, uint nameLength)
 {
-	Inode		theInode;
-	ushort		curSize;
-	DirEntry	*tmpDir;
-	uchar		*buff = new uchar[blockSize];
+	CachedInode	*dirInode = GetInode(inode);
 	int		ret = -1;
 	
-	ReadInode(inode, &theInode);	// read in the inode
+	if(dirInode == NULL)
+		return(-1);
 	
-// 	DEBUG("INODE SIZE: %d\n", theInode.size);
-// 	DEBUG("INODE BLOCK COUNT: %d\n", theInode.blockCount);
-		
-	//
-	// TODO: Need to change when this stops...
-	//
-	for(int i=0; i < NUM_BLOCK_PTRS; ++i)
+// 	DEBUG("INODE SIZE: %d\n", dirInode->size);
+// 	DEBUG("INODE BLOCK COUNT: %d\n", dirInode->blockCount);
+	
+	// an indexed directory only needs the blocks on the way to the name
+	if((theSuperBlock.feature_compat & FEATURE_COMPAT_DIR_INDEX) &&
+	   (dirInode->fileFlags & INDEX_FILE_FLAG))
+		ret = FindByNameInHTree(dirInode, name, nameLength);
+	
+	// the leaves are regular directory blocks, so a bad index can still be searched
+	if(ret < 0)
+		ret = FindByNameLinear(dirInode, name, nameLength);
+	
+	PutInode(dirInode);
+	
+	return(ret);
+}
+
+int ext2::FindByNameLinear(CachedInode *dirInode, const char *name, uint nameLength)
+{
+	ulong	numBlocks = DivUp(dirInode->size, blockSize);
+	uchar	*buff = new uchar[blockSize];
+	int	ret = 0;
+	
+	for(ulong i=0; i < numBlocks && ret == 0; ++i)
 	{
-		if(theInode.blockPointers[i] == 0)
+		ulong	addr = FindAddressByBlockNumber(i, dirInode);
+		
+		if(addr == 0)	// a hole
 			continue;
 		
 		// read in the data block
-		if(ReadDataBlock(i, theInode.blockPointers, buff) < 0)
+		if(ReadBlocks(addr, 1, buff) < 0)
 		{
 			WARN("Error reading data block: %d\n", i);
+			ret = -1;
+			break;
+		}
+		
+		ret = SearchDirBlock(buff, name, nameLength);
+	}
+	
+	delete [] buff;	// free up our memory
+	
+	return(ret);
+}
+
+int ext2::FindByNameInHTree(CachedInode *dirInode, const char *name, uint nameLength)
+{
+	uchar	*buff = new uchar[blockSize * (MAX_HTREE_LEVELS + 1)];	// the root, a node and a leaf
+	DXEntry	*entries[MAX_HTREE_LEVELS];
+	uint	counts[MAX_HTREE_LEVELS];
+	uint	at[MAX_HTREE_LEVELS];
+	
+	// the root is the first block, after the "." and ".." entries
+	if(ReadDirBlock(dirInode, 0, buff) < 0)
+	{
+		delete [] buff;
+		return(-1);
+	}
+	
+	DXRootInfo	*info = reinterpret_cast<DXRootInfo*>(&buff[24]);
+	DXCountLimit	*countLimit = reinterpret_cast<DXCountLimit*>(&buff[24 + sizeof(DXRootInfo)]);
+	
+	if(info->reservedZero != 0 ||
+	   info->infoLength != sizeof(DXRootInfo) ||
+	   info->hashVersion > DX_HASH_TEA ||
+	   info->indirectLevels >= MAX_HTREE_LEVELS ||
+	   countLimit->count == 0 ||
+	   countLimit->count > countLimit->limit ||
+	   countLimit->limit > (blockSize - 32) / sizeof(DXEntry))
+	{
+		WARN("Bad htree root in inode %d\n", dirInode->number);
+		delete [] buff;
+		return(-1);
+	}
+	
+	int	hashVersion = info->hashVersion;
+	int	levels = info->indirectLevels + 1;
+	
+	if(theSuperBlock.flags & UNSIGNED_HASH_FLAG)
+		hashVersion += DX_HASH_LEGACY_UNSIGNED;
+	
+	ulong	hash = DirHash(name, nameLength, hashVersion);
+	
+	entries[0] = reinterpret_cast<DXEntry*>(countLimit);
+	counts[0] = countLimit->count;
+	
+	// go down the tree, taking the entry that covers our hash at each level
+	for(int level=0; level < levels; ++level)
+	{
+		at[level] = FindDXEntry(entries[level], counts[level], hash);
+		
+		if(level + 1 < levels &&
+		   !ReadDXNode(dirInode, &entries[level][at[level]], &buff[blockSize * (level + 1)], entries[level + 1], counts[level + 1]))
+		{
+			delete [] buff;
 			return(-1);
 		}
+	}
+	
+	uchar	*leaf = &buff[blockSize * levels];
+	int	ret;
+	
+	while(true)
+	{
+		if(ReadDirBlock(dirInode, entries[levels - 1][at[levels - 1]].block & DX_BLOCK_MASK, leaf) < 0)
+		{
+			ret = -1;
+			break;
+		}
 		
-		curSize = 0;
+		if((ret = SearchDirBlock(leaf, name, nameLength)) != 0)
+			break;
 		
-		while(curSize < blockSize)
+		// names with the same hash can carry on into the next leaf
+		int	level = levels - 1;
+		
+		while(level >= 0 && at[level] + 1 >= counts[level])
+			--level;
+		
+		if(level < 0)
+			break;
+		
+		++at[level];
+		
+		if((entries[level][at[level]].hash & ~1UL) != hash)
+			break;
+		
+		// read in the nodes under the next entry
+		for(; level + 1 < levels; ++level)
 		{
-			tmpDir = reinterpret_cast<DirEntry *>(&buff[curSize]);
+			if(!ReadDXNode(dirInode, &entries[level][at[level]], &buff[blockSize * (level + 1)], entries[level + 1], counts[level + 1]))
+			{
+				ret = -1;
+				break;
+			}
 			
-			if(tmpDir->inode != 0)
+			at[level + 1] = 0;
+		}
+		
+		if(ret < 0)
+			break;
+	}
+	
+	delete [] buff;
+	
+	return(ret);
+}
+
+bool ext2::ReadDXNode(CachedInode *dirInode, DXEntry *entry, uchar *node, DXEntry *&entries, uint &count)
+{
+	if(ReadDirBlock(dirInode, entry->block & DX_BLOCK_MASK, node) < 0)
+		return(false);
+	
+	// the node starts with an empty entry that covers the whole block
+	DXCountLimit	*countLimit = reinterpret_cast<DXCountLimit*>(&node[8]);
+	
+	if(countLimit->count == 0 ||
+	   countLimit->count > countLimit->limit ||
+	   countLimit->limit > (blockSize - 8) / sizeof(DXEntry))
+	{
+		WARN("Bad htree node in inode %d\n", dirInode->number);
+		return(false);
+	}
+	
+	entries = reinterpret_cast<DXEntry*>(countLimit);
+	count = countLimit->count;
+	
+	return(true);
+}
+
+uint ext2::FindDXEntry(DXEntry *entries, uint count, ulong hash)
+{
+	// the first entry doesn't have a hash, it covers everything below the second
+	uint	low = 1;
+	uint	high = count - 1;
+	
+	while(low <= high)
+	{
+		uint	mid = (low + high) / 2;
+		
+		if(entries[mid].hash > hash)
+			high = mid - 1;
+		else
+			low = mid + 1;
+	}
+	
+	return(low - 1);
+}
+
+int ext2::SearchDirBlock(uchar *block, const char *name, uint nameLength)
+{
+	ulong	curSize = 0;
+	
+	while(curSize + 8 <= blockSize)
+	{
+		DirEntry	*tmpDir = reinterpret_cast<DirEntry *>(&block[curSize]);
+		
+		if(tmpDir->recordLength < 8 || curSize + tmpDir->recordLength > blockSize)
+		{
+			WARN("Bad directory entry\n");
+			return(-1);
+		}
+		
+// 		DEBUG("NAME: %s\n", tmpDir->name);
+// 		DEBUG("INODE: %d\n", tmpDir->inode);
+// 		DEBUG("TYPE: %d\n", tmpDir->fileType);
+		
+		// we found the dir we were looking for
+		if(tmpDir->inode != 0 &&
+		   tmpDir->nameLength == nameLength &&
+		   MemEqual(tmpDir->name, const_cast<char*>(name), nameLength))
+			return(tmpDir->inode);
+		
+		curSize += tmpDir->recordLength;
+	}
+	
+	return(0);
+}
+
+int ext2::ReadDirBlock(CachedInode *dirInode, ulong blockNumber, uchar *dest)
+{
+	if(blockNumber >= DivUp(dirInode->size, blockSize))
+		return(-1);
+	
+	ulong	addr = FindAddressByBlockNumber(blockNumber, dirInode);
+	
+	if(addr == 0)
+		return(-1);
+	
+	return ReadBlocks(addr, 1, dest);
+}
+
+//
+// The htree hashes, these have to match what Linux and e2fsprogs put on the disk
+//
+static void Str2HashBuf(const char *name, int nameLength, ulong *buf, int num, bool isUnsigned)
+{
+	ulong	pad = ulong(nameLength) | (ulong(nameLength) << 8);
+	ulong	val;
+	
+	pad |= pad << 16;
+	val = pad;
+	
+	if(nameLength > num * 4)
+		nameLength = num * 4;
+	
+	for(int i=0; i < nameLength; ++i)
+	{
+		int	c = isUnsigned ? int(uchar(name[i])) : int(static_cast<signed char>(name[i]));
+		
+		val = ulong(c) + (val << 8);
+		
+		if(i % 4 == 3)
+		{
+			*buf++ = val;
+			val = pad;
+			--num;
+		}
+	}
+	
+	if(--num >= 0)
+		*buf++ = val;
+	
+	while(--num >= 0)
+		*buf++ = pad;
+}
+
+static inline ulong RotateLeft(ulong word, int shift)
+{ return((word << shift) | (word >> (32 - shift))); }
+
+static void HalfMD4Transform(ulong buf[4], ulong in[8])
+{
+	const ulong	K2 = 013240474631UL;
+	const ulong	K3 = 015666365641UL;
+	ulong		a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+	
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = RotateLeft(a, s))
+	
+	ROUND(F, a, b, c, d, in[0], 3);
+	ROUND(F, d, a, b, c, in[1], 7);
+	ROUND(F, c, d, a, b, in[2], 11);
+	ROUND(F, b, c, d, a, in[3], 19);
+	ROUND(F, a, b, c, d, in[4], 3);
+	ROUND(F, d, a, b, c, in[5], 7);
+	ROUND(F, c, d, a, b, in[6], 11);
+	ROUND(F, b, c, d, a, in[7], 19);
+	
+	ROUND(G, a, b, c, d, in[1] + K2, 3);
+	ROUND(G, d, a, b, c, in[3] + K2, 5);
+	ROUND(G, c, d, a, b, in[5] + K2, 9);
+	ROUND(G, b, c, d, a, in[7] + K2, 13);
+	ROUND(G, a, b, c, d, in[0] + K2, 3);
+	ROUND(G, d, a, b, c, in[2] + K2, 5);
+	ROUND(G, c, d, a, b, in[4] + K2, 9);
+	ROUND(G, b, c, d, a, in[6] + K2, 13);
+	
+	ROUND(H, a, b, c, d, in[3] + K3, 3);
+	ROUND(H, d, a, b, c, in[7] + K3, 9);
+	ROUND(H, c, d, a, b, in[2] + K3, 11);
+	ROUND(H, b, c, d, a, in[6] + K3, 15);
+	ROUND(H, a, b, c, d, in[1] + K3, 3);
+	ROUND(H, d, a, b, c, in[5] + K3, 9);
+	ROUND(H, c, d, a, b, in[0] + K3, 11);
+	ROUND(H, b, c, d, a, in[4] + K3, 15);
+	
+#undef F
+#undef G
+#undef H
+#undef ROUND
+	
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+static void TEATransform(ulong buf[4], ulong in[4])
+{
+	ulong	sum = 0;
+	ulong	b0 = buf[0], b1 = buf[1];
+	
+	for(int n=0; n < 16; ++n)
+	{
+		sum += 0x9E3779B9UL;
+		b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+		b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+	}
+	
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+ulong ext2::DirHash(const char *name, uint nameLength, int hashVersion)
+{
+	ulong	buf[4] = { 0x67452301UL, 0xEFCDAB89UL, 0x98BADCFEUL, 0x10325476UL };
+	ulong	in[8];
+	ulong	hash = 0;
+	bool	isUnsigned = hashVersion >= DX_HASH_LEGACY_UNSIGNED;
+	
+	// use the file system's seed if it has one
+	if(theSuperBlock.hashSeed[0] || theSuperBlock.hashSeed[1] || theSuperBlock.hashSeed[2] || theSuperBlock.hashSeed[3])
+		MemCopy(buf, theSuperBlock.hashSeed, sizeof(buf));
+	
+	switch(hashVersion)
+	{
+		case DX_HASH_LEGACY:
+		case DX_HASH_LEGACY_UNSIGNED:
+		{
+			ulong	hash0 = 0x12A3FE2DUL, hash1 = 0x37ABE8F9UL;
+			
+			for(uint i=0; i < nameLength; ++i)
 			{
-// 				DEBUG("NAME: %s\n", tmpDir->name);
-// 				DEBUG("INODE: %d\n", tmpDir->inode);
-// 				DEBUG("TYPE: %d\n", tmpDir->fileType);
+				int	c = isUnsigned ? int(uchar(name[i])) : int(static_cast<signed char>(name[i]));
+				
+				hash = hash1 + (hash0 ^ ulong(c * 7152373));
 				
-				// we found the dir we were looking for
-				if(name == string(tmpDir->name, tmpDir->nameLength))
-				{
-					// found what we're looking for, cleanup and return
-					int	ret = tmpDir->inode;
-					
-					delete [] buff;
-					
-					return(ret);	// return the inode
-				}
+				if(hash & 0x80000000UL)
+					hash -= 0x7FFFFFFFUL;
+				
+				hash1 = hash0;
+				hash0 = hash;
+			}
+			
+			hash = hash0 << 1;
+			break;
+		}
+		
+		case DX_HASH_HALF_MD4:
+		case DX_HASH_HALF_MD4_UNSIGNED:
+			for(int len = nameLength, pos = 0; len > 0; len -= 32, pos += 32)
+			{
+				Str2HashBuf(name + pos, len, in, 8, isUnsigned);
+				HalfMD4Transform(buf, in);
+			}
+			
+			hash = buf[1];
+			break;
+		
+		case DX_HASH_TEA:
+		case DX_HASH_TEA_UNSIGNED:
+			for(int len = nameLength, pos = 0; len > 0; len -= 16, pos += 16)
+			{
+				Str2HashBuf(name + pos, len, in, 4, isUnsigned);
+				TEATransform(buf, in);
+			}
+			
+			hash = buf[0];
+			break;
+	}
+	
+	hash &= ~1UL;
+	
+	// the end of directory marker can't be used as a hash
+	if(hash == (0x7FFFFFFFUL << 1))
+		hash = (0x7FFFFFFFUL - 1) << 1;
+	
+	return(hash);
+}
+
+ulong ext2::FindAddressByBlockNumber(ulong blockNumber, CachedInode *theInode)
+{
+	ulong	addr;
+	
+	// make sure the request isn't larger then the largest block number
+	if(blockNumber >= ulong(INDIRECT_BLOCK_PTR) + addrPerBlock + (addrPerBlock * addrPerBlock) + (addrPerBlock * addrPerBlock * addrPerBlock))
+		return(0);
+	
+	// direct data block
+	if(blockNumber <= ulong(DIRECT_BLOCK_PTRS))
+		return(theInode->blockPointers[blockNumber]);
+	
+	theInode->mapLock.Wait();
+	
+	// only go to the indirect blocks the first time
+	if(!LookupBlockMap(theInode, blockNumber, addr))
+	{
+		FillBlockMap(theInode, blockNumber);
+		
+		if(!LookupBlockMap(theInode, blockNumber, addr))
+			addr = 0;
+	}
+	
+	theInode->mapLock.Signal();
+	
+	return(addr);
+}
+
+bool ext2::LookupBlockMap(CachedInode *theInode, ulong blockNumber, ulong &addr)
+{
+	vector<BlockExtent>	&blockMap = theInode->blockMap;
+	uint			i = theInode->blockMapHint;
+	
+	// a sequential reader is in the same extent as last time, or the next one
+	if(i < blockMap.size() && blockNumber >= blockMap[i].logical && blockNumber - blockMap[i].logical < blockMap[i].count)
+		;
+	
+	else if(i + 1 < blockMap.size() && blockNumber >= blockMap[i + 1].logical && blockNumber - blockMap[i + 1].logical < blockMap[i + 1].count)
+		++i;
+	
+	else
+	{
+		// find the last extent that starts at or before the block
+		uint	low = 0;
+		uint	high = blockMap.size();
+		
+		while(low < high)
+		{
+			uint	mid = (low + high) / 2;
+			
+			if(blockMap[mid].logical <= blockNumber)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		
+		if(low == 0)
+			return(false);
+		
+		i = low - 1;
+		
+		if(blockNumber - blockMap[i].logical >= blockMap[i].count)
+			return(false);
+	}
+	
+	theInode->blockMapHint = i;
+	
+	addr = blockMap[i].physical == 0 ? 0 : blockMap[i].physical + (blockNumber - blockMap[i].logical);
+	
+	return(true);
+}
+
+void ext2::FillBlockMap(CachedInode *theInode, ulong blockNumber)
+{
+	ulong	relative = blockNumber - INDIRECT_BLOCK_PTR;
+	ulong	next;
+	int	levels;
+	
+	// single indirection
+	if(relative < addrPerBlock)
+	{
+		next = theInode->blockPointers[INDIRECT_BLOCK_PTR];
+		levels = 1;
+	}
+	
+	// double indirection
+	else if((relative -= addrPerBlock) < addrPerBlock * addrPerBlock)
+	{
+		next = theInode->blockPointers[DOUBLE_INDIRECT_BLOCK_PTR];
+		levels = 2;
+	}
+	
+	// tripple indirection
+	else
+	{
+		relative -= addrPerBlock * addrPerBlock;
+		next = theInode->blockPointers[TRIPPLE_INDIRECT_BLOCK_PTR];
+		levels = 3;
+	}
+	
+	// make space for our addresses
+	ulong	*addrs = new ulong[addrPerBlock];
+	
+	// walk down to the last indirect block, a zero address anywhere is a hole
+	for(int level = levels - 1; level >= 0 && next != 0; --level)
+	{
+		ulong	index = relative;
+		
+		for(int i=0; i < level; ++i)
+			index /= addrPerBlock;
+		
+		if(ReadBlocks(next, 1, reinterpret_cast<uchar*>(addrs)) < 0)
+		{
+			WARN("Couldn't read indirect block %d\n", next);
+			delete [] addrs;
+			return;
+		}
+		
+		// the last one is the block we map
+		if(level != 0)
+			next = addrs[index % addrPerBlock];
+	}
+	
+	// the whole block's worth of addresses is a hole
+	if(next == 0)
+		MemSet(addrs, 0, addrPerBlock * sizeof(ulong));
+	
+	// make room if this inode has a lot of small extents
+	if(theInode->blockMap.size() >= MAX_MAP_EXTENTS)
+		ForgetBlockMap(theInode);
+	
+	// find where the extents go
+	ulong	first = blockNumber - (relative % addrPerBlock);
+	uint	pos = 0;
+	
+	while(pos < theInode->blockMap.size() && theInode->blockMap[pos].logical < first)
+		++pos;
+	
+	// turn the addresses into extents
+	BlockExtent	extent;
+	
+	extent.logical = first;
+	extent.physical = addrs[0];
+	extent.count = 1;
+	
+	for(ulong i=1; i <= addrPerBlock; ++i)
+	{
+		if(i < addrPerBlock &&
+		   ((extent.physical == 0 && addrs[i] == 0) ||
+		    (extent.physical != 0 && addrs[i] == extent.physical + extent.count)))
+		{
+			++extent.count;
+			continue;
+		}
+		
+		theInode->blockMap.insert(theInode->blockMap.begin() + pos, extent);
+		++pos;
+		
+		if(i < addrPerBlock)
+		{
+			extent.logical = first + i;
+			extent.physical = addrs[i];
+			extent.count = 1;
+		}
+	}
+	
+	delete [] addrs;
+}
+
+void ext2::ForgetBlockMap(CachedInode *theInode)
+{
+	theInode->blockMap.clear();
+	theInode->blockMapHint = 0;
+}
+
+
+//
+// Inode cache
+//
+ext2::CachedInode *ext2::GetInode(ulong inode)
+{
+	CachedInode	*cachedInode;
+	
+	{
+		AutoDisable	lock;
+		
+		if((cachedInode = LookupInode(inode)) != NULL)
+		{
+			++cachedInode->refCount;
+			TouchInode(cachedInode);
+			
+			return(cachedInode);
+		}
+	}
+	
+	// read it in with interrupts on
+	CachedInode	*newInode = new CachedInode;
+	
+	if(ReadInode(inode, newInode) < 0)
+	{
+		delete newInode;
+		return(NULL);
+	}
+	
+	newInode->number = inode;
+	newInode->refCount = 1;
+	newInode->dirty = false;
+	newInode->lruPrev = newInode->lruNext = NULL;
+	
+	{
+		AutoDisable	lock;
+		
+		// someone might have read it in while we were
+		if((cachedInode = LookupInode(inode)) != NULL)
+		{
+			++cachedInode->refCount;
+			TouchInode(cachedInode);
+		}
+		
+		else
+		{
+			newInode->hashNext = inodeBuckets[inode % NUM_INODE_BUCKETS];
+			inodeBuckets[inode % NUM_INODE_BUCKETS] = newInode;
+			
+			TouchInode(newInode);
+			++numCachedInodes;
+			
+			cachedInode = newInode;
+			newInode = NULL;
+		}
+	}
+	
+	if(newInode != NULL)
+		delete newInode;
+	
+	if(numCachedInodes > MAX_CACHED_INODES)
+		ShrinkInodeCache();
+	
+	return(cachedInode);
+}
+
+void ext2::PutInode(CachedInode *cachedInode)
+{
+	bool	writeBack;
+	bool	lastHolder;
+	
+	{
+		AutoDisable	lock;
+		
+		lastHolder = cachedInode->refCount == 1;
+		writeBack = lastHolder && cachedInode->dirty;
+		
+		if(writeBack)
+			cachedInode->dirty = false;
+	}
+	
+	// nobody is writing the file anymore, so the blocks it didn't use go back
+	if(lastHolder && cachedInode->preallocCount != 0)
+	{
+		cachedInode->mapLock.Wait();
+		DiscardPreallocation(cachedInode);
+		cachedInode->mapLock.Signal();
+	}
+	
+	// write it out while we still hold it so it can't be dropped
+	if(writeBack && WriteInode(cachedInode->number, cachedInode) < 0)
+		cachedInode->dirty = true;
+	
+	AutoDisable	lock;
+	
+	if(cachedInode->refCount == 0)
+		PANIC("Released an inode that wasn't held\n");
+	
+	--cachedInode->refCount;
+}
+
+ext2::CachedInode *ext2::LookupInode(ulong inode)
+{
+	for(CachedInode *cachedInode = inodeBuckets[inode % NUM_INODE_BUCKETS]; cachedInode != NULL; cachedInode = cachedInode->hashNext)
+	{
+		if(cachedInode->number == inode)
+			return(cachedInode);
+	}
+	
+	return(NULL);
+}
+
+void ext2::TouchInode(CachedInode *cachedInode)
+{
+	LRUTouch(cachedInode, inodeLRUHead, inodeLRUTail);
+}
+
+void ext2::UnlinkInode(CachedInode *cachedInode)
+{
+	// take it out of the hash chain
+	CachedInode	**link = &inodeBuckets[cachedInode->number % NUM_INODE_BUCKETS];
+	
+	while(*link != cachedInode)
+		link = &(*link)->hashNext;
+	
+	*link = cachedInode->hashNext;
+	
+	LRUUnlink(cachedInode, inodeLRUHead, inodeLRUTail);
+	
+	--numCachedInodes;
+}
+
+void ext2::ShrinkInodeCache()
+{
+	while(numCachedInodes > MAX_CACHED_INODES)
+	{
+		CachedInode	*victim;
+		
+		{
+			AutoDisable	lock;
+			
+			// unused inodes are always clean, PutInode wrote them out
+			for(victim = inodeLRUTail; victim != NULL; victim = victim->lruPrev)
+			{
+				if(victim->refCount == 0 && !victim->dirty)
+					break;
+			}
+			
+			if(victim == NULL)
+				return;
+			
+			UnlinkInode(victim);
+		}
+		
+		delete victim;
+	}
+}
+
+
+//
+// Read functions
+//
+void ext2::FindInodeLocation(ulong inode, ulong &block, ulong &offset)
+{
+	// decrease inode because array index at zero and inodes at one
+	ulong	groupNumber = (inode - 1) / theSuperBlock.inodesPerGroup;
+	ulong	tableOffset = ((inode - 1) % theSuperBlock.inodesPerGroup) * inodeSize;
+	
+	block = theGroupDescriptors[groupNumber].inodeTableAddress + tableOffset / blockSize;
+	offset = tableOffset % blockSize;
+}
+
+int ext2::ReadInode(ulong inode, Inode *theInode)
+{
+	if(inode < 2 || inode > theSuperBlock.inodeCount)
+	{
+		WARN("Tried to get inode %u\n", inode);
+		return(-1);
+	}
+	
+	ulong	block, offset;
+	uchar	*buff = new uchar[blockSize];
+	
+	FindInodeLocation(inode, block, offset);
+	
+	// only the block with the inode in it
+	int ret = ReadBlocks(block, 1, buff);
+	
+	if(ret >= 0)
+		MemCopy(theInode, buff + offset, sizeof(Inode));
+	
+	delete [] buff;
+	
+	return(ret);
+}
+
+// this function reads a data block performing indirection if necessary
+int ext2::ReadDataBlock(ulong blockNumber, CachedInode *theInode, uchar *dest)
+{
+// 	DEBUG("BLOCK NUM: %u\n", blockNumber);
+	
+	ulong	addr = FindAddressByBlockNumber(blockNumber, theInode);
+	
+	// holes and blocks past the end read as zeros
+	if(addr == 0)
+	{
+		MemSet(dest, 0, blockSize);
+		return(0);
+	}
+	
+	return ReadBlocks(addr, 1, dest);
+}
+
+int ext2::ReadDataBlocks(ulong blockNumber, ulong numBlocks, CachedInode *theInode, uchar *dest)
+{
+	ulong	i = 0;
+	
+	while(i < numBlocks)
+	{
+		ulong	addr = FindAddressByBlockNumber(blockNumber + i, theInode);
+		
+		if(addr == 0)
+		{
+			MemSet(dest + i * blockSize, 0, blockSize);
+			++i;
+			continue;
+		}
+		
+		// find how many blocks follow it on the disk
+		ulong	run = 1;
+		
+		while(i + run < numBlocks && FindAddressByBlockNumber(blockNumber + i + run, theInode) == addr + run)
+			++run;
+		
+		int ret = ReadBlocks(addr, run, dest + i * blockSize);
+		
+		if(ret < 0)
+			return(ret);
+		
+		i += run;
+	}
+	
+	return(numBlocks);
+}
+
+int ext2::LoadBlockData(FileDescriptor *fd)
+{
+	if(fd->blockData != NULL)
+		return(0);
+	
+	fd->blockData = new uchar[blockSize];
+	
+	return ReadDataBlock(fd->blockNumber, fd->fileInode, fd->blockData);
+}
+
+void ext2::ReadAhead(FileDescriptor *fd)
+{
+	// there is still enough read ahead of the reader
+	if(fd->readAheadStart > fd->blockNumber + fd->readAheadWindow / 2)
+		return;
+	
+	// the current block has already been read
+	if(fd->readAheadStart <= fd->blockNumber)
+		fd->readAheadStart = fd->blockNumber + 1;
+	
+	fd->readAheadWindow = fd->readAheadWindow == 0 ? MIN_READAHEAD_WINDOW : MIN(fd->readAheadWindow * 2, MAX_READAHEAD_WINDOW);
+	
+	ulong	end = MIN(fd->readAheadStart + fd->readAheadWindow, DivUp(fd->fileInode->size, blockSize));
+	ulong	runStart = 0;
+	ulong	runLength = 0;
+	
+	// group the blocks into runs that are next to each other on the disk
+	for(ulong i = fd->readAheadStart; i < end; ++i)
+	{
+		ulong	addr = FindAddressByBlockNumber(i, fd->fileInode);
+		
+		if(runLength != 0 && addr == runStart + runLength)
+		{
+			++runLength;
+			continue;
+		}
+		
+		if(runLength != 0)
+			ReadAheadBlocks(runStart, runLength);
+		
+		// holes don't start a run
+		runStart = addr;
+		runLength = addr == 0 ? 0 : 1;
+	}
+	
+	if(runLength != 0)
+		ReadAheadBlocks(runStart, runLength);
+	
+	fd->readAheadStart = MAX(end, ulong(fd->readAheadStart));
+}
+
+
+//
+// Write functions
+//
+int ext2::WriteInode(ulong inode, Inode *theInode)
+{
+	if(inode < 2 || inode > theSuperBlock.inodeCount)
+	{
+		ERROR("Tried to write inode %u\n", inode);
+		return(-1);
+	}
+	
+	ulong	block, offset;
+	uchar	*buff = new uchar[blockSize];
+	
+	FindInodeLocation(inode, block, offset);
+	
+	// read the block with the inode, the other inodes in it have to stay the same
+	int ret = ReadBlocks(block, 1, buff);
+	
+	// check for an error on the read
+	if(ret < 0)
+	{
+		delete [] buff;
+		return ret;
+	}
+	
+	// anything past sizeof(Inode) in a rev 1 inode is left alone
+	MemCopy(buff + offset, theInode, sizeof(Inode));
+	
+	// write this back out to disk
+	ret = WriteBlocks(block, 1, buff);
+	
+	delete [] buff;
+	
+	return(ret);
+}
+
+
+int ext2::WriteDataBlock(ulong blockNumber, FileDescriptor *fd, uchar *src)
+{
+	// find if we need to allocate a block or not
+	ulong	addr = FindAddressByBlockNumber(blockNumber, fd->fileInode);
+	
+	if(addr == 0)	// we need to allocate a new block
+	{
+		if((addr = AllocateNewDataBlock(blockNumber, fd)) == 0)
+			return(-1 * ENOSPC);
+	}
+	
+	// write the block out to disk
+	return WriteBlocks(addr, 1, src);
+}
+
+ulong ext2::AllocateNewDataBlock(ulong blockNumber, FileDescriptor *fd)
+{
+	CachedInode	*theInode = fd->fileInode;
+	ulong		goal = FindGoalBlock(theInode, blockNumber);
+	ulong		addr;
+	
+	if(blockNumber >= ulong(INDIRECT_BLOCK_PTR) + addrPerBlock + (addrPerBlock * addrPerBlock) + (addrPerBlock * addrPerBlock * addrPerBlock))
+		return(0);
+	
+	theInode->mapLock.Wait();
+	
+	// direct data block
+	if(blockNumber <= ulong(DIRECT_BLOCK_PTRS))
+	{
+		if((addr = AllocateFileBlock(theInode, goal)) != 0)
+			theInode->blockPointers[blockNumber] = addr;
+	}
+	
+	else
+	{
+		ulong	relative = blockNumber - INDIRECT_BLOCK_PTR;
+		ulong	*pointer;
+		int	levels;
+		
+		// find which tree the block is in
+		if(relative < addrPerBlock)
+		{
+			pointer = &theInode->blockPointers[INDIRECT_BLOCK_PTR];
+			levels = 1;
+		}
+		
+		else if((relative -= addrPerBlock) < addrPerBlock * addrPerBlock)
+		{
+			pointer = &theInode->blockPointers[DOUBLE_INDIRECT_BLOCK_PTR];
+			levels = 2;
+		}
+		
+		else
+		{
+			relative -= addrPerBlock * addrPerBlock;
+			pointer = &theInode->blockPointers[TRIPPLE_INDIRECT_BLOCK_PTR];
+			levels = 3;
+		}
+		
+		ulong	*addrs = new ulong[addrPerBlock];
+		ulong	cur = *pointer;
+		
+		addr = 0;
+		
+		// the top indirect block hangs off the inode
+		if(cur == 0 && (cur = *pointer = AllocateIndirectBlock(theInode, goal)) != 0)
+			goal = cur + 1;
+		
+		// walk down the indirect blocks, filling in any that are missing
+		for(int level = levels - 1; level >= 0 && cur != 0; --level)
+		{
+			ulong	index = relative;
+			
+			for(int i=0; i < level; ++i)
+				index /= addrPerBlock;
+			
+			index %= addrPerBlock;
+			
+			if(ReadBlocks(cur, 1, reinterpret_cast<uchar*>(addrs)) < 0)
+				break;
+			
+			ulong	next = addrs[index];
+			
+			if(next == 0)
+			{
+				next = level == 0 ? AllocateFileBlock(theInode, goal) : AllocateIndirectBlock(theInode, goal);
+				
+				if(next == 0)
+					break;
+				
+				addrs[index] = next;
+				WriteBlocks(cur, 1, reinterpret_cast<uchar*>(addrs));
+				
+				goal = next + 1;
+			}
+			
+			if(level == 0)
+				addr = next;
 			
-			}
-				
-			curSize += tmpDir->recordLength;
+			cur = next;
 		}
+		
+		delete [] addrs;
 	}
 	
-	delete [] buff;	// free up our memory
+	if(addr != 0)
+		theInode->blockCount += blockSize / 512;	// counted in 512 byte sectors
+	
+	// the pointers changed, the map has to be filled in again
+	ForgetBlockMap(theInode);
+	MarkInodeDirty(theInode);
+	
+	theInode->mapLock.Signal();
 	
-	return(ret);	
+	if(addr == 0)
+		ERROR("FILE SYSTEM FULL\n");
+	
+	return(addr);
 }
 
-ulong ext2::FindAddressByBlockNumber(ulong blockNumber, ulong blockPointers[])
+ulong ext2::FindGoalBlock(CachedInode *theInode, ulong blockNumber)
 {
-	ulong	addr = 0;
-	ulong	*addrs = NULL;
+	// right after the block before this one keeps the file in order on the disk
+	if(blockNumber > 0)
+	{
+		ulong	prev = FindAddressByBlockNumber(blockNumber - 1, theInode);
+		
+		if(prev != 0)
+			return(prev + 1);
+	}
 	
-	// make sure the request isn't larger then the largest block number
-	if(blockNumber >= ulong(DIRECT_BLOCK_PTRS) + (addrPerBlock * addrPerBlock * addrPerBlock))
+	// otherwise near the inode
+	return(GroupFirstBlock((theInode->number - 1) / theSuperBlock.inodesPerGroup));
+}
+
+ulong ext2::AllocateIndirectBlock(CachedInode *theInode, ulong goal)
+{
+	ulong	addr = AllocateFileBlock(theInode, goal);
+	
+	if(addr == 0)
 		return(0);
 	
-	// direct data block
-	if(blockNumber <= ulong(DIRECT_BLOCK_PTRS))
-		addr = blockPointers[blockNumber];
+	uchar	*zeros = new uchar[blockSize];
 	
-	// single indirection
-	else if(blockNumber < ulong(INDIRECT_BLOCK_PTR + addrPerBlock))
+	MemSet(zeros, 0, blockSize);
+	WriteBlocks(addr, 1, zeros);
+	
+	delete [] zeros;
+	
+	theInode->blockCount += blockSize / 512;
+	
+	return(addr);
+}
+
+ulong ext2::AllocateFileBlock(CachedInode *theInode, ulong goal)
+{
+	// a sequential writer always wants the window's next block
+	if(theInode->preallocCount != 0 && theInode->preallocStart != goal)
+		DiscardPreallocation(theInode);
+	
+	if(theInode->preallocCount == 0)
 	{
-// 		DEBUG("\nSINGLE INDIRECT\n");
-// 		DEBUG("BLOCK NUM: %d\n", blockNumber);
+		ulong	count = PREALLOC_BLOCKS;
 		
-		// make space for our inodes
-		addrs = new ulong[blockSize/sizeof(ulong)];
+		if((theInode->preallocStart = AllocateBlocks(goal, count)) == 0)
+			return(0);
 		
-		// read in the indirect blocks
-		ReadBlocks(blockPointers[INDIRECT_BLOCK_PTR], 1, reinterpret_cast<uchar*>(addrs));
-		
-		// update the block number
-		blockNumber -= INDIRECT_BLOCK_PTR;
-		
-// 		DEBUG("ASKING FOR: %d\n", addrs[blockNumber % addrPerBlock]);
-		
-		addr = addrs[blockNumber % addrPerBlock];
+		theInode->preallocCount = count;
 	}
 	
-	// double indirection
-	else if(blockNumber < ulong(INDIRECT_BLOCK_PTR + (addrPerBlock * addrPerBlock)))
+	--theInode->preallocCount;
+	
+	return(theInode->preallocStart++);
+}
+
+void ext2::DiscardPreallocation(CachedInode *theInode)
+{
+	if(theInode->preallocCount != 0)
+		FreeBlocks(theInode->preallocStart, theInode->preallocCount);
+	
+	theInode->preallocStart = 0;
+	theInode->preallocCount = 0;
+}
+
+ulong ext2::AllocateBlocks(ulong goal, ulong &count)
+{
+	if(goal < theSuperBlock.firstDataBlock || goal >= theSuperBlock.blockCount)
+		goal = theSuperBlock.firstDataBlock;
+	
+	ulong	goalGroup = (goal - theSuperBlock.firstDataBlock) / theSuperBlock.blocksPerGroup;
+	ulong	start = (goal - theSuperBlock.firstDataBlock) % theSuperBlock.blocksPerGroup;
+	
+	allocLock.Wait();
+	
+	// try from the goal to the end of its group, then the other groups, then the start of the goal's group
+	for(ulong i=0; i <= numGroups; ++i, start = 0)
 	{
-// 		DEBUG("\nDOUBLE INDIRECT\n");
-// 		DEBUG("BLOCK NUM: %d\n", blockNumber);
+		ulong	group = (goalGroup + i) % numGroups;
+		
+		if(theGroupDescriptors[group].freeBlockCount == 0)
+			continue;
 		
-		// make space for our inodes
-		addrs = new ulong[blockSize/sizeof(ulong)];
+		uchar	*bitmap = GetBitmap(group);
 		
-		// read in the indirect blocks
-		ReadBlocks(blockPointers[DOUBLE_INDIRECT_BLOCK_PTR], 1, reinterpret_cast<uchar*>(addrs));
+		if(bitmap == NULL)
+			continue;
 		
-		// update the block number
-		blockNumber = blockNumber - INDIRECT_BLOCK_PTR - addrPerBlock;
-		 
-		// read in the double indirect blocks
-		ReadBlocks(addrs[blockNumber / addrPerBlock], 1, reinterpret_cast<uchar*>(addrs));
+		// the last group can be short
+		ulong	numBits = MIN(theSuperBlock.blocksPerGroup, theSuperBlock.blockCount - GroupFirstBlock(group));
+		long	bit = FindFreeBit(bitmap, start, numBits);
 		
-// 		DEBUG("ASKING FOR: %d\n", addrs[blockNumber % addrPerBlock]);
+		if(bit < 0)
+			continue;
 		
-		addr = addrs[blockNumber % addrPerBlock];
-	}
-	
-	// tripple indirection
-	else
-	{
-// 		DEBUG("\nTRIPPLE INDIRECT\n");
-// 		DEBUG("BLOCK NUM: %d\n", blockNumber);
+		// take as many of the blocks after it as are free, but only write the group once
+		ulong	got = 0;
 		
-		// make space for our inodes
-		addrs = new ulong[blockSize/sizeof(ulong)];
+		for(ulong b = bit; got < count && b < numBits && (bitmap[b / 8] & (1 << (b % 8))) == 0; ++b, ++got)
+			bitmap[b / 8] |= 1 << (b % 8);
 		
-		// read in the indirect blocks
-		ReadBlocks(blockPointers[TRIPPLE_INDIRECT_BLOCK_PTR], 1, reinterpret_cast<uchar*>(addrs));
+		theGroupDescriptors[group].freeBlockCount -= got;
+		theSuperBlock.freeBlockCount -= got;
 		
-		// update the block number
-		blockNumber = blockNumber - INDIRECT_BLOCK_PTR - addrPerBlock - (addrPerBlock * addrPerBlock);
-		 
-		// read in the double indirect blocks
-		ReadBlocks(addrs[blockNumber / (addrPerBlock * addrPerBlock)], 1, reinterpret_cast<uchar*>(addrs));
+		WriteGroup(group);
 		
-		// read in the tripple indirect blocks
-		ReadBlocks(addrs[blockNumber / addrPerBlock], 1, reinterpret_cast<uchar*>(addrs));
+		allocLock.Signal();
 		
-// 		DEBUG("ASKING FOR: %d\n", addrs[blockNumber % addrPerBlock]);
+		count = got;
 		
-		addr = addrs[blockNumber % addrPerBlock];
+		return(GroupFirstBlock(group) + bit);
 	}
 	
-	// cleanup any memory we might have made
-	if(addrs != NULL)
-		delete [] addrs;
-
-	return(addr);
+	allocLock.Signal();
+	
+	return(0);
 }
 
-
-//
-// Read functions
-//
-int ext2::ReadInode(ulong inode, Inode *theInode)
+void ext2::FreeBlocks(ulong block, ulong count)
 {
-	if(inode < 2)
+	if(block < theSuperBlock.firstDataBlock || block + count > theSuperBlock.blockCount)
 	{
-		WARN("Tried to get inode zero\n");
-		return(-1);
+		ERROR("Tried to free blocks %u to %u\n", block, block + count);
+		return;
 	}
 	
-	ulong	groupNumber = inode / theSuperBlock.inodesPerGroup; // DivUp(inode, theSuperBlock.inodesPerGroup);
-	ulong	blocksNeeded = DivUp(theSuperBlock.inodesPerGroup * sizeof(Inode), blockSize); // cal the blocks needed for all inodes
-	uchar	*buff = new uchar[blocksNeeded * blockSize];
-	Inode	*tmpInode = reinterpret_cast<Inode*>(buff);
+	ulong	group = (block - theSuperBlock.firstDataBlock) / theSuperBlock.blocksPerGroup;
+	ulong	bit = (block - theSuperBlock.firstDataBlock) % theSuperBlock.blocksPerGroup;
+	ulong	freed = 0;
 	
-/*	DEBUG("INODE: %d\n", inode);
-	DEBUG("INODES PER GROUP: %d\n", theSuperBlock.inodesPerGroup);
-	DEBUG("GROUP NUMBER: %d\n", groupNumber);
-	DEBUG("INODE TABLE ADDR: %d\n", theGroupDescriptors[groupNumber].inodeTableAddress);
-	DEBUG("BLOCKS REQUESTED: %d\n", blocksNeeded);
-	DEBUG("INODE SIZE: %d\n", sizeof(Inode));
-	*/
+	if(bit + count > theSuperBlock.blocksPerGroup)
+	{
+		ERROR("Tried to free blocks %u to %u across a group\n", block, block + count);
+		return;
+	}
 	
-	// read the inode table for that group
-	int ret = ReadBlocks(theGroupDescriptors[groupNumber].inodeTableAddress, blocksNeeded, buff);
+	allocLock.Wait();
 	
-	if(ret >= 0)	 // decrease inode because array index at zero and inodes at one
-		MemCopy(theInode, &tmpInode[(inode-1) % theSuperBlock.inodesPerGroup], sizeof(Inode));
+	uchar	*bitmap = GetBitmap(group);
 	
-	delete [] buff;
+	for(ulong b = bit; bitmap != NULL && b < bit + count; ++b)
+	{
+		if(bitmap[b / 8] & (1 << (b % 8)))
+		{
+			bitmap[b / 8] &= ~(1 << (b % 8));
+			++freed;
+		}
+	}
 	
-	return(ret);
+	if(freed != 0)
+	{
+		theGroupDescriptors[group].freeBlockCount += freed;
+		theSuperBlock.freeBlockCount += freed;
+		
+		WriteGroup(group);
+	}
+	
+	allocLock.Signal();
 }
 
-// this function reads a data block performing indirection if necessary
-int ext2::ReadDataBlock(ulong blockNumber, ulong blocksPointers[], uchar *dest)
+uchar *ext2::GetBitmap(ulong group)
 {
-// 	DEBUG("BLOCK NUM: %u\n", blockNumber);
-// 	DEBUG("BLOCK: %u\n", blocksPointers[blockNumber]);
+	if(blockBitmaps[group] != NULL)
+		return(blockBitmaps[group]);
 	
-	ulong	addr = FindAddressByBlockNumber(blockNumber, blocksPointers);
+	uchar	*bitmap = new uchar[blockSize];
 	
-	if(addr == 0)
-		PANIC("Couldn't find block");
+	if(ReadBlocks(theGroupDescriptors[group].blockBitmapAddress, 1, bitmap) < 0)
+	{
+		ERROR("Couldn't read the bitmap for group %u\n", group);
+		delete [] bitmap;
+		return(NULL);
+	}
 	
-	return ReadBlocks(addr, 1, dest);
+	blockBitmaps[group] = bitmap;
+	
+	return(bitmap);
 }
 
-
-//
-// Write functions
-//
-int ext2::WriteInode(ulong inode, Inode *theInode)
+long ext2::FindFreeBit(uchar *bitmap, ulong start, ulong numBits)
 {
-	if(inode < 2)
+	ulong	*words = reinterpret_cast<ulong*>(bitmap);
+	
+	for(ulong bit = start; bit < numBits; bit = (bit / 32 + 1) * 32)
 	{
-		ERROR("Tried to write inode zero\n");
-		return(-1);
+		// pretend the bits before start are used
+		ulong	word = words[bit / 32] | ((1UL << (bit % 32)) - 1);
+		
+		if(word == 0xFFFFFFFFUL)
+			continue;
+		
+		ulong	found = (bit / 32) * 32 + __builtin_ctz(~word);
+		
+		return(found < numBits ? long(found) : -1);
 	}
 	
-	ulong	groupNumber = inode / theSuperBlock.inodesPerGroup;
-	ulong	blocksNeeded = DivUp(theSuperBlock.inodesPerGroup * sizeof(Inode), blockSize); // calc the blocks needed for all inodes
-	uchar	*buff = new uchar[blocksNeeded * blockSize];
-	Inode	*tmpInode = reinterpret_cast<Inode*>(buff);
+	return(-1);
+}
+
+void ext2::WriteGroup(ulong group)
+{
+	uchar	*buff = new uchar[blockSize];
+	
+	// the bitmap
+	WriteBlocks(theGroupDescriptors[group].blockBitmapAddress, 1, blockBitmaps[group]);
 	
-/*	DEBUG("INODE: %d\n", inode);
-	DEBUG("INODES PER GROUP: %d\n", theSuperBlock.inodesPerGroup);
-	DEBUG("GROUP NUMBER: %d\n", groupNumber);
-	DEBUG("INODE TABLE ADDR: %d\n", theGroupDescriptors[groupNumber].inodeTableAddress);
-	DEBUG("BLOCKS REQUESTED: %d\n", blocksNeeded);
-	DEBUG("INODE SIZE: %d\n", sizeof(Inode));
-*/
-	// read the inode table for that group
-	int ret = ReadBlocks(theGroupDescriptors[groupNumber].inodeTableAddress, blocksNeeded, buff);
+	// the group's descriptor
+	ulong	descBlock = groupDescriptorBlock + (group * sizeof(GroupDescriptor)) / blockSize;
+	ulong	descOffset = (group * sizeof(GroupDescriptor)) % blockSize;
 	
-	// check for an error on the read
-	if(ret < 0)
+	if(ReadBlocks(descBlock, 1, buff) >= 0)
 	{
-		delete [] buff;
-		return ret;
+		MemCopy(buff + descOffset, &theGroupDescriptors[group], sizeof(GroupDescriptor));
+		WriteBlocks(descBlock, 1, buff);
 	}
 	
-	// decrease inode because array index at zero and inodes at one
-	MemCopy(&tmpInode[(inode-1) % theSuperBlock.inodesPerGroup], theInode, sizeof(Inode));
-	
-	// write this back out to disk
-	ret = WriteBlocks(theGroupDescriptors[groupNumber].inodeTableAddress, blocksNeeded, buff);
+	// the super block's counts go out on the next sync, not on every allocation
+	superBlockDirty = true;
 	
 	delete [] buff;
-	
-	return(ret);
-	
 }
 
-
-int ext2::WriteDataBlock(ulong blockNumber, FileDescriptor *fd, uchar *src)
+int ext2::Sync()
 {
-	// find if we need to allocate a block or not
-	ulong	addr = FindAddressByBlockNumber(blockNumber, fd->fileInode.blockPointers);
+	int	ret = WriteSuperBlock();
 	
-	if(addr == 0)	// we need to allocate a new block
-	{
-		PANIC("NEED TO ALLOCATE NEW BLOCK\n", false);
-		addr = AllocateNewDataBlock(blockNumber, fd);
-	}
+	if(ret < 0)
+		return(ret);
 	
-	// write the block out to disk
-	return WriteBlocks(addr, 1, src);
+	return(FileSystemBase::Sync());
 }
 
-ulong ext2::AllocateNewDataBlock(ulong blockNumber, FileDescriptor *fd)
+int ext2::WriteSuperBlock()
 {
-	// FIX ME
-	(void)blockNumber;
+	int	ret = 0;
 	
-	int	groupNumber = fd->inodeNumber / theSuperBlock.inodesPerGroup;
+	allocLock.Wait();
 	
-	if(theGroupDescriptors[groupNumber].freeBlockCount == 0)
+	if(superBlockDirty)
 	{
-		ERROR("FILE SYSTEM FULL\n");
-		return 0;
+		// only the free counts, the in memory copy has the block size changed
+		uchar	*buff = new uchar[blockSize];
+		ulong	superBlock = SUPER_BLOCK_OFFSET / blockSize;
+		ulong	superOffset = SUPER_BLOCK_OFFSET % blockSize;
+		
+		if((ret = ReadBlocks(superBlock, 1, buff)) >= 0)
+		{
+			SuperBlock	*onDisk = reinterpret_cast<SuperBlock*>(buff + superOffset);
+			
+			onDisk->freeBlockCount = theSuperBlock.freeBlockCount;
+			onDisk->freeInodeCount = theSuperBlock.freeInodeCount;
+			
+			if((ret = WriteBlocks(superBlock, 1, buff)) >= 0)
+				superBlockDirty = false;
+		}
+		
+		delete [] buff;
 	}
 	
-	// read in the block bitmap
-	ulong	numBlocksForBitmap = DivUp(DivUp(theSuperBlock.blocksPerGroup,ulong(8)), ulong(blockSize));
-	uchar	*freeBlockBitmap = new uchar[numBlocksForBitmap * blockSize];
-	
-	DEBUG("BLOCKS PER GROUP: %d\n", theSuperBlock.blocksPerGroup);
-	DEBUG("NUM BLOCKS: %d\n", numBlocksForBitmap);
-	
-	// search through the bitmap for an unused block
-	ReadBlocks(theGroupDescriptors[groupNumber].blockBitmapAddress, numBlocksForBitmap, freeBlockBitmap);
-	
-	for(uint i=0; i < numBlocksForBitmap * blockSize; ++i)
-		DEBUG("%x ", freeBlockBitmap[i]);
-	
-/*	vector<bool>	bitMap(reinterpret_cast<ulong*>(freeBlockBitmap), theSuperBlock.blocksPerGroup);
-	
-	vector<bool>::iterator it = find(bitMap.begin(), bitMap.end(), false);
+	allocLock.Signal();
 	
-	
- 	for(it = bitMap.begin(); it != bitMap.end(); ++it)
- 		printf("%s", *it == true ? "U" : "F");
-*/
-	
-	// mark it as used
-	
-	// update the count in the group descriptor
-	
-	// update the count in the super block
-	
-	// update the count in the inode
-	
-	return(0);
+	return(ret < 0 ? ret : 0);
 }
 
 		
@@ -572,14 +1602,16 @@ int ext2::ReadDirectory(int dirDescriptor, list<DirectoryEntry> &theEntries)
 			
 			if(tmpDir->inode != 0)
 			{
-				Inode	tmpInode;
-				
-				ReadInode(tmpDir->inode, &tmpInode);	// read in the inode to get the file's info
+				// the inode cache (and the buffer cache under it) keeps this off the disk
+				CachedInode	*tmpInode = GetInode(tmpDir->inode);
 				
 				tmpEntry.name = string(tmpDir->name, tmpDir->nameLength);	// copy over the name
-				tmpEntry.size = tmpInode.size;		// get the file's size
+				tmpEntry.size = tmpInode == NULL ? 0 : tmpInode->size;		// get the file's size
 				tmpEntry.fileType = tmpDir->fileType;
 				
+				if(tmpInode != NULL)
+					PutInode(tmpInode);
+				
 				theEntries.push_back(tmpEntry);
 			}
 				
@@ -608,11 +1640,6 @@ void ext2::CloseDirectory(int dirDescriptor)
 
 int ext2::Open(FileDescriptorBase *fileDescriptor, const string &file, const int flags)
 {
-	// FIX ME
-	(void)flags;
-	
-	FileDescriptor	*fd = reinterpret_cast<FileDescriptor*>(fileDescriptor);
-	
 	int inode = FindInodeByPath(string(file));
 	
 	if(inode < 0)
@@ -620,30 +1647,69 @@ int ext2::Open(FileDescriptorBase *fileDescriptor, const string &file, const int
 		WARN("COULDN'T FIND INODE\n");
 		return(-1);
 	}
+	
+	return(OpenInode(fileDescriptor, inode, flags));
+}
+
+int ext2::Lookup(ulong dirInode, const char *name, uint nameLength)
+{
+	CachedInode	*dir = GetInode(dirInode);
+	
+	if(dir == NULL)
+		return(-1 * EIO);
+	
+	bool	isDir = (dir->fileMode & 0xF000) == DIR_FILE_MODE;
+	
+	PutInode(dir);
+	
+	if(!isDir)
+		return(-1 * ENOTDIR);
+	
+	int ret = FindByNameInInode(dirInode, name, nameLength);
+	
+	// only a name that really isn't there is ENOENT, the dentry cache remembers those
+	if(ret == 0)
+		return(-1 * ENOENT);
+	
+	return(ret < 0 ? -1 * EIO : ret);
+}
 
+int ext2::OpenInode(FileDescriptorBase *fileDescriptor, ulong inode, const int flags)
+{
+	// FIX ME
+	(void)flags;
+	
+	FileDescriptor	*fd = reinterpret_cast<FileDescriptor*>(fileDescriptor);
+	
 	fd->inodeNumber = inode;		// set the inode number
-	ReadInode(inode, &fd->fileInode);	// read in the inode
+	fd->blockData = NULL;
+	
+	// hold the inode while the file is open
+	if((fd->fileInode = GetInode(inode)) == NULL)
+		return(-1);
 
-/*	printf("SIZE: %d\n", fd->fileInode.size);
-	printf("OWNER ID: %d\n", fd->fileInode.ownerUID);
-	printf("FILE MODE: %d\n", fd->fileInode.fileMode);
-	printf("BLOCK COUNT: %d\n", fd->fileInode.blockCount);
-	printf("FILE FLAGS: %d\n", fd->fileInode.fileFlags);
+/*	printf("SIZE: %d\n", fd->fileInode->size);
+	printf("OWNER ID: %d\n", fd->fileInode->ownerUID);
+	printf("FILE MODE: %d\n", fd->fileInode->fileMode);
+	printf("BLOCK COUNT: %d\n", fd->fileInode->blockCount);
+	printf("FILE FLAGS: %d\n", fd->fileInode->fileFlags);
 */
 	
-	if(!(fd->fileInode.fileMode & FILE_FILE_MODE))
+	if(!(fd->fileInode->fileMode & FILE_FILE_MODE))
 	{
 		WARN("Not a file\n");
+		PutInode(fd->fileInode);
+		fd->fileInode = NULL;
 		return(-2);
 	}
 	
 	// read in the first data block
-	if(fd->fileInode.size > 0)
+	if(fd->fileInode->size > 0)
 	{
 		fd->blockData = new uchar[blockSize];	// make the memory
 		
 		// Read in the first data block
-		ReadDataBlock(0, fd->fileInode.blockPointers, fd->blockData);
+		ReadDataBlock(0, fd->fileInode, fd->blockData);
 	}
 
 	else
@@ -651,6 +1717,10 @@ int ext2::Open(FileDescriptorBase *fileDescriptor, const string &file, const int
 
 	// zero the block number and positions
 	fd->blockNumber = fd->filePosition = fd->blockPosition = 0;
+	
+	// the first block is already in, so readahead starts after it
+	fd->readAheadStart = 1;
+	fd->readAheadWindow = 0;
 
 	return(0);
 }
@@ -661,13 +1731,44 @@ int ext2::Read(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes)
 		return(0);
 	
 	FileDescriptor	*tmpDescriptor = reinterpret_cast<FileDescriptor*>(fileDescriptor);
-	uint		bytesToRead = MIN(tmpDescriptor->fileInode.size - tmpDescriptor->filePosition, numBytes);
+	uint		bytesToRead = MIN(tmpDescriptor->fileInode->size - tmpDescriptor->filePosition, numBytes);
 	uint		bytesRead = 0;
 	int		amt;
 	
-	// this could be faster by reading directly into buff and saving a mem copy... but easier to code :-)
+	// the file could have been empty when it was opened and grown through WriteAt since
+	if(bytesToRead > 0 && LoadBlockData(tmpDescriptor) < 0)
+		return(-1 * EIO);
+	
 	while(bytesToRead > bytesRead)
 	{
+		// we're done with this block, move on to the next one
+		if(tmpDescriptor->blockPosition == blockSize)
+		{
+			++tmpDescriptor->blockNumber;
+			tmpDescriptor->blockPosition = 0;
+			
+			// whole blocks go straight into buff, the last one goes through blockData so it's there for Write
+			ulong	wholeBlocks = (bytesToRead - bytesRead) / blockSize;
+			
+			if(wholeBlocks > 1)
+			{
+				int ret = ReadDataBlocks(tmpDescriptor->blockNumber, wholeBlocks - 1, tmpDescriptor->fileInode, reinterpret_cast<uchar*>(buff) + bytesRead);
+				
+				if(ret < 0)
+					return(bytesRead == 0 ? ret : int(bytesRead));
+				
+				tmpDescriptor->blockNumber += wholeBlocks - 1;
+				tmpDescriptor->filePosition += (wholeBlocks - 1) * blockSize;
+				bytesRead += (wholeBlocks - 1) * blockSize;
+			}
+			
+			ReadDataBlock(tmpDescriptor->blockNumber, tmpDescriptor->fileInode, tmpDescriptor->blockData);
+			
+			// we're reading straight through, so get the blocks after this one on their way
+			if(CanReadAhead())
+				ReadAhead(tmpDescriptor);
+		}
+		
 		amt = MIN(blockSize - tmpDescriptor->blockPosition, bytesToRead - bytesRead);
 		
 		// copy over the data
@@ -675,14 +1776,6 @@ int ext2::Read(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes)
 		tmpDescriptor->blockPosition += amt;
 		tmpDescriptor->filePosition += amt;
 		
-		// check if we're done with this block and need to read in the next one
-		if(tmpDescriptor->blockPosition == blockSize &&
-		   tmpDescriptor->filePosition < tmpDescriptor->fileInode.size)
-		{
-			ReadDataBlock(++tmpDescriptor->blockNumber, tmpDescriptor->fileInode.blockPointers, tmpDescriptor->blockData);
-			tmpDescriptor->blockPosition = 0;
-		}
-		
 		bytesRead += amt;
 	}
 
@@ -699,6 +1792,17 @@ int ext2::Write(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes)
 	uint		bytesWritten = 0;
 	int		amt;
 	
+	// the file was empty when it was opened, but WriteAt could have put data in this block since
+	if(LoadBlockData(tmpDescriptor) < 0)
+		return(-1 * EIO);
+	
+	// a read can stop at the end of a block, so start in the next one
+	if(tmpDescriptor->blockPosition == blockSize)
+	{
+		ReadDataBlock(++tmpDescriptor->blockNumber, tmpDescriptor->fileInode, tmpDescriptor->blockData);
+		tmpDescriptor->blockPosition = 0;
+	}
+	
 	while(numBytes > bytesWritten)
 	{
 		amt = MIN(blockSize - tmpDescriptor->blockPosition, numBytes - bytesWritten);
@@ -707,26 +1811,32 @@ int ext2::Write(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes)
 		MemCopy(tmpDescriptor->blockData + tmpDescriptor->blockPosition, reinterpret_cast<uchar*>(buff) + bytesWritten, amt);
 		
 		// write this block to the disk
-		WriteDataBlock(tmpDescriptor->blockNumber, tmpDescriptor, tmpDescriptor->blockData);
+		int ret = WriteDataBlock(tmpDescriptor->blockNumber, tmpDescriptor, tmpDescriptor->blockData);
+		
+		if(ret < 0)
+			return(bytesWritten == 0 ? ret : int(bytesWritten));
 		
 		// update the positions
 		tmpDescriptor->blockPosition += amt;
 		tmpDescriptor->filePosition += amt;
 		
-		if(tmpDescriptor->filePosition > tmpDescriptor->fileInode.size)
-			tmpDescriptor->fileInode.size = tmpDescriptor->filePosition;
+		if(tmpDescriptor->filePosition > tmpDescriptor->fileInode->size)
+		{
+			tmpDescriptor->fileInode->size = tmpDescriptor->filePosition;
+			MarkInodeDirty(tmpDescriptor->fileInode);
+		}
 		
 		// we're done with this block and their's another to read in
 		if(tmpDescriptor->blockPosition == blockSize &&
-		   tmpDescriptor->filePosition < tmpDescriptor->fileInode.size)
+		   tmpDescriptor->filePosition < tmpDescriptor->fileInode->size)
 		{
-			ReadDataBlock(++tmpDescriptor->blockNumber, tmpDescriptor->fileInode.blockPointers, tmpDescriptor->blockData);
+			ReadDataBlock(++tmpDescriptor->blockNumber, tmpDescriptor->fileInode, tmpDescriptor->blockData);
 			tmpDescriptor->blockPosition = 0;
 		}
 		
 		// we're at the end of the block and the file
 		else if(tmpDescriptor->blockPosition == blockSize &&
-			tmpDescriptor->filePosition == tmpDescriptor->fileInode.size)
+			tmpDescriptor->filePosition == tmpDescriptor->fileInode->size)
 		{
 			MemSet(tmpDescriptor->blockData, 0, blockSize);	// set the block to all zeros
 			tmpDescriptor->blockPosition = 0;	// reset the block position
@@ -739,6 +1849,112 @@ int ext2::Write(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes)
 	return bytesWritten;
 }
 
+int ext2::ReadAt(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes, uint position)
+{
+	FileDescriptor	*tmpDescriptor = reinterpret_cast<FileDescriptor*>(fileDescriptor);
+	CachedInode	*theInode = tmpDescriptor->fileInode;
+	
+	if(position >= theInode->size)
+		return(0);
+	
+	uchar	*dest = reinterpret_cast<uchar*>(buff);
+	uchar	*bounce = NULL;
+	uint	bytesToRead = MIN(theInode->size - position, numBytes);
+	uint	bytesRead = 0;
+	int	ret = 0;
+	
+	while(bytesToRead > bytesRead)
+	{
+		ulong	blockNumber = (position + bytesRead) / blockSize;
+		ulong	blockPosition = (position + bytesRead) % blockSize;
+		uint	amt = MIN(blockSize - blockPosition, bytesToRead - bytesRead);
+		
+		// all the whole blocks go straight into buff
+		if(blockPosition == 0 && amt == blockSize)
+		{
+			ulong	wholeBlocks = (bytesToRead - bytesRead) / blockSize;
+			
+			ret = ReadDataBlocks(blockNumber, wholeBlocks, theInode, dest + bytesRead);
+			amt = wholeBlocks * blockSize;
+		}
+		
+		// the ends of the range go through a block of our own
+		else
+		{
+			if(bounce == NULL)
+				bounce = new uchar[blockSize];
+			
+			if((ret = ReadDataBlock(blockNumber, theInode, bounce)) >= 0)
+				MemCopy(dest + bytesRead, bounce + blockPosition, amt);
+		}
+		
+		if(ret < 0)
+			break;
+		
+		bytesRead += amt;
+	}
+	
+	delete [] bounce;
+	
+	return(ret < 0 && bytesRead == 0 ? ret : int(bytesRead));
+}
+
+int ext2::WriteAt(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes, uint position)
+{
+	FileDescriptor	*tmpDescriptor = reinterpret_cast<FileDescriptor*>(fileDescriptor);
+	CachedInode	*theInode = tmpDescriptor->fileInode;
+	uchar		*src = reinterpret_cast<uchar*>(buff);
+	uchar		*bounce = NULL;
+	uint		bytesWritten = 0;
+	int		ret = 0;
+	
+	while(numBytes > bytesWritten)
+	{
+		ulong	blockNumber = (position + bytesWritten) / blockSize;
+		ulong	blockPosition = (position + bytesWritten) % blockSize;
+		uint	amt = MIN(blockSize - blockPosition, numBytes - bytesWritten);
+		
+		// a whole block can be written right from buff
+		if(amt == blockSize)
+			ret = WriteDataBlock(blockNumber, tmpDescriptor, src + bytesWritten);
+		
+		// part of a block has to be merged with what's there
+		else
+		{
+			if(bounce == NULL)
+				bounce = new uchar[blockSize];
+			
+			if((ret = ReadDataBlock(blockNumber, theInode, bounce)) >= 0)
+			{
+				MemCopy(bounce + blockPosition, src + bytesWritten, amt);
+				ret = WriteDataBlock(blockNumber, tmpDescriptor, bounce);
+			}
+		}
+		
+		if(ret < 0)
+			break;
+		
+		bytesWritten += amt;
+	}
+	
+	delete [] bounce;
+	
+	if(position + bytesWritten > theInode->size)
+	{
+		theInode->size = position + bytesWritten;
+		MarkInodeDirty(theInode);
+	}
+	
+	// the descriptor's block might have been written over, if it doesn't have one
+	// yet the next Read or Write loads it
+	if(bytesWritten != 0 && tmpDescriptor->blockData != NULL &&
+	   tmpDescriptor->blockNumber >= position / blockSize &&
+	   tmpDescriptor->blockNumber <= (position + bytesWritten - 1) / blockSize)
+		ReadDataBlock(tmpDescriptor->blockNumber, theInode, tmpDescriptor->blockData);
+	
+	return(ret < 0 && bytesWritten == 0 ? ret : int(bytesWritten));
+}
+
 int ext2::Seek(FileDescriptorBase *fileDescriptor, int offset, int whence)
 {
 	if(whence == SEEK_SET && offset < 0)
@@ -748,7 +1964,7 @@ int ext2::Seek(FileDescriptorBase *fileDescriptor, int offset, int whence)
 		return(-3);
 	
 	FileDescriptor	*tmpFd = reinterpret_cast<FileDescriptor*>(fileDescriptor);
-	int		fileSize = tmpFd->fileInode.size;
+	int		fileSize = tmpFd->fileInode->size;
 	
 	// based on the whence, calculate the new file position
 	switch(whence)
@@ -771,26 +1987,57 @@ int ext2::Seek(FileDescriptorBase *fileDescriptor, int offset, int whence)
 			return(-4);
 	}
 			
+	ulong	oldBlockNumber = tmpFd->blockNumber;
+	
 	// based off the file position, calculate everything else
 	tmpFd->blockPosition = tmpFd->filePosition % blockSize;
 	tmpFd->blockNumber = tmpFd->filePosition / blockSize;
+	
+	// start over detecting sequential reads from here
+	tmpFd->readAheadStart = tmpFd->blockNumber + 1;
+	tmpFd->readAheadWindow = 0;
 			
-	// bring in the right data block (this could be a wasted call... oh well)
-	ReadDataBlock(tmpFd->blockNumber, tmpFd->fileInode.blockPointers, tmpFd->blockData);
+	// bring in the right data block, blockData already has it if we stayed in the same one
+	if(tmpFd->blockData == NULL)
+		LoadBlockData(tmpFd);
+	
+	else if(tmpFd->blockNumber != oldBlockNumber)
+		ReadDataBlock(tmpFd->blockNumber, tmpFd->fileInode, tmpFd->blockData);
 			
 	return(tmpFd->filePosition);
 }
 
+int ext2::FileStat(FileDescriptorBase* fileDescriptor, stat *buff)
+{
+	CachedInode	*theInode = reinterpret_cast<FileDescriptor*>(fileDescriptor)->fileInode;
+	
+	MemSet(buff, 0, sizeof(stat));
+	
+	buff->inodeNumber = theInode->number;
+	buff->mode = theInode->fileMode;
+	buff->hardLinkCount = theInode->linkCount;
+	buff->uid = theInode->ownerUID | (ulong(theInode->uidHighWord) << 16);
+	buff->gid = theInode->groupID | (ulong(theInode->gidHighWord) << 16);
+	buff->fileSize = theInode->size;
+	buff->blockSize = blockSize;
+	buff->blockCount = theInode->blockCount;
+	buff->accessTime = theInode->accessTime;
+	buff->modifyTime = theInode->modificationTime;
+	buff->changeTime = theInode->createTime;
+	
+	return(0);
+}
+
 void ext2::Close(FileDescriptorBase* fileDescriptor)
 {
 	FileDescriptor	*tmpFd = reinterpret_cast<FileDescriptor*>(fileDescriptor);
 	
-	// write the file's iNode back to disk
-	// NEED TO CHANGE THIS SO WE ONLY WRITE IT BACK ON A WRITE
-//	WriteInode(tmpFd->inodeNumber, &tmpFd->fileInode);
+	// let go of the iNode, it is written back if it changed
+	PutInode(tmpFd->fileInode);
+	tmpFd->fileInode = NULL;
 	
-	// free up the iNode
 	delete [] tmpFd->blockData;
+	tmpFd->blockData = NULL;
 }
 				
 
@@ -32,12 +32,16 @@
 #include <SystemCallHandler.h>
 #include <ATADriver.h>
 #include <ATAManager.h>
+#include <SyscallRing.h>
+#include <PageCache.h>
+#include <BufferCache.h>
+#include <DentryCache.h>
+#include <UserAccess.h>
+#include <mem_utils.h>
 #include <Debug.h>
 
 #endif
 
-using k_std::find_if;
-
 FileSystemManager::FileSystemManager()
 {
 	//
@@ -51,11 +55,27 @@ FileSystemManager::FileSystemManager()
 	sysCallHandler.InstallSystemCall(SYSCALL_read, (VoidFunPtr)Read, 3);
 	sysCallHandler.InstallSystemCall(SYSCALL_write, (VoidFunPtr)Write, 3);
 	sysCallHandler.InstallSystemCall(SYSCALL_lseek, (VoidFunPtr)Seek, 3);
+	sysCallHandler.InstallSystemCall(SYSCALL_pread, (VoidFunPtr)ReadAt, 4);
+	sysCallHandler.InstallSystemCall(SYSCALL_pwrite, (VoidFunPtr)WriteAt, 4);
+	sysCallHandler.InstallSystemCall(SYSCALL_readv, (VoidFunPtr)ReadVector, 3);
+	sysCallHandler.InstallSystemCall(SYSCALL_writev, (VoidFunPtr)WriteVector, 3);
 	sysCallHandler.InstallSystemCall(SYSCALL_close, (VoidFunPtr)Close, 1);
+	sysCallHandler.InstallSystemCall(SYSCALL_sync, (VoidFunPtr)Sync, 0);
+	sysCallHandler.InstallSystemCall(SYSCALL_fsync, (VoidFunPtr)FileSync, 1);
+	
+	// mapping files into memory
+	sysCallHandler.InstallSystemCall(SYSCALL_mmap, (VoidFunPtr)PageCache::Map, 6);
+	sysCallHandler.InstallSystemCall(SYSCALL_munmap, (VoidFunPtr)PageCache::Unmap, 2);
 	
 	// mount & unmount
 	sysCallHandler.InstallSystemCall(SYSCALL_mount, (VoidFunPtr)MountFileSystem, 5);
 	sysCallHandler.InstallSystemCall(SYSCALL_umount, (VoidFunPtr)UnmountFileSystem, 1);
+	
+	// the batched submission ring for the calls above
+	sysCallHandler.InstallSystemCall(SYSCALL_io_setup, (VoidFunPtr)SyscallRing::Setup, 2);
+	sysCallHandler.InstallSystemCall(SYSCALL_io_destroy, (VoidFunPtr)SyscallRing::Destroy, 0);
+	sysCallHandler.InstallSystemCall(SYSCALL_io_submit, (VoidFunPtr)SyscallRing::Submit, 2);
+	sysCallHandler.InstallSystemCall(SYSCALL_io_getevents, (VoidFunPtr)SyscallRing::GetEvents, 1);
 #endif
 }
 
@@ -87,7 +107,18 @@ int FileSystemManager::MountFileSystem(const char *source, const char *target, c
 	}
 	
 	// create a new file system and insert it into the mount points
-	fileSysMan.mountPoints.insert(pair<string, FileSystemBase*>(string(target), (*it).second->CreateFileSystem(tmpDriver, 0)));
+	MountPoint	mount;
+	
+	mount.path = string(target);
+	mount.fileSystem = (*it).second->CreateFileSystem(tmpDriver, 0);
+	
+	fileSysMan.mountPoints.insert(pair<string, FileSystemBase*>(mount.path, mount.fileSystem));
+	fileSysMan.mountList.push_back(mount);
+	
+#ifndef UNIT_TEST
+	// writes are cached from here on, so something needs to get them to the disk
+	BufferCache::GetInstance().StartFlusher();
+#endif
 	
 	return(0);
 }
@@ -107,6 +138,20 @@ int FileSystemManager::UnmountFileSystem(const char *target)
 		return(ENODEV * -1);	// NEED TO FIGURE OUT HOW TO DO ERRNO
 	}
 	
+	for(uint i=0; i < fileSysMan.mountList.size(); ++i)
+	{
+		if(fileSysMan.mountList[i].fileSystem == (*it).second)
+		{
+			fileSysMan.mountList.erase(fileSysMan.mountList.begin() + i);
+			break;
+		}
+	}
+	
+#ifndef UNIT_TEST
+	// the names point at inodes on this file system
+	DentryCache::GetInstance().Purge((*it).second);
+#endif
+	
 	// delete the file system object
 	delete (*it).second;
 
@@ -143,29 +188,35 @@ void FileSystemManager::RemoveFileSystem(string fileSystemType)
 	fileSystems.erase(it);
 }
 	
-int FileSystemManager::Open(const char *path, const int flags)
+int FileSystemManager::Open(const char *userPath, const int flags)
 {
 	FileSystemManager	&fileSysMan = FileSystemManager::GetInstance();
+	char			path[MAX_PATH_LENGTH];
+	
+	// get the path out of the process before looking at it
+	int len = CopyStringFromUser(path, userPath, MAX_PATH_LENGTH);
+	
+	if(len < 0)
+		return(len);
 	
 	// search through the mount points looking for the one contains this file
-	map<string, FileSystemBase*>::iterator it = find_if(fileSysMan.mountPoints.begin(),
-							    fileSysMan.mountPoints.end(),
-							    ComparePrefix(string(path)));
+	FileSystemBase	*fileSystem = fileSysMan.FindMountPoint(path);
+	
 	// couldn't find this mount point
-	if(it == fileSysMan.mountPoints.end())
+	if(fileSystem == NULL)
 		return(-1 * EFAULT);	// I think this is the right error
 
 	// create a new file descriptor
-	FileDescriptorBase *fd = (*it).second->CreateFileDescriptor((*it).second);
+	FileDescriptorBase *fd = fileSystem->CreateFileDescriptor(fileSystem);
 	
 	// insert the file descriptor into the process
 	int index = ProcessManager::GetInstance().InsertFileDescriptor(fd);
 	
 	// call the file system's open function
-	int ret = (*it).second->Open(fd, string(path), flags);
+	int ret = fileSysMan.OpenPath(fileSystem, fd, path, flags);
 	
 	if(ret < 0)
-		(*it).second->DestroyFileDescriptor(fd);
+		fileSystem->DestroyFileDescriptor(fd);
 	
 	// return the error code or the index into the file descriptor vector
 	return(ret < 0 ? ret : index);
@@ -173,27 +224,120 @@ int FileSystemManager::Open(const char *path, const int flags)
 
 FileDescriptorBase *FileSystemManager::kOpen(const string &path, const int flags)
 {
+	string	tmpPath(path);
+	
 	// search through the mount points looking for the one contains this file
-	map<string, FileSystemBase*>::iterator it = find_if(mountPoints.begin(),
-							    mountPoints.end(),
-							    ComparePrefix(path));
+	FileSystemBase	*fileSystem = FindMountPoint(tmpPath.c_str());
+	
 	// couldn't find this mount point
-	if(it == mountPoints.end())
+	if(fileSystem == NULL)
 		return NULL;
 
 	// create a new file descriptor
-	FileDescriptorBase *fd = (*it).second->CreateFileDescriptor((*it).second);
+	FileDescriptorBase *fd = fileSystem->CreateFileDescriptor(fileSystem);
 	
 	// call the file system's open function
-	int ret = (*it).second->Open(fd, string(path), flags);
+	int ret = OpenPath(fileSystem, fd, tmpPath.c_str(), flags);
 	
 	if(ret < 0)
-		(*it).second->DestroyFileDescriptor(fd);
+		fileSystem->DestroyFileDescriptor(fd);
 	
 	// return the error code or the file descriptor
 	return(ret < 0 ? NULL : fd);
 }
 
+FileSystemBase *FileSystemManager::FindMountPoint(const char *path)
+{
+	FileSystemBase	*ret = NULL;
+	uint		retLength = 0;
+	
+	for(uint i=0; i < mountList.size(); ++i)
+	{
+		string	&mountPath = mountList[i].path;
+		uint	j;
+		
+		for(j=0; j < mountPath.size() && path[j] == mountPath[j]; ++j)
+			;
+		
+		// the longest match wins so a mount inside another one is found
+		if(j == mountPath.size() && (ret == NULL || j > retLength))
+		{
+			ret = mountList[i].fileSystem;
+			retLength = j;
+		}
+	}
+	
+	return(ret);
+}
+
+int FileSystemManager::LookupPath(FileSystemBase *fileSystem, const char *path)
+{
+	ulong	curInode = fileSystem->GetRootInode();
+	
+	if(curInode == 0)
+		return(-1 * ENOSYS);
+	
+#ifdef UNIT_TEST
+	(void)path;
+	return(-1 * ENOSYS);
+#else
+	DentryCache	&dentryCache = DentryCache::GetInstance();
+	
+	while(*path != '\0')
+	{
+		// skip over the slashes to the next name
+		while(*path == '/')
+			++path;
+		
+		if(*path == '\0')
+			break;
+		
+		uint	nameLength = 0;
+		
+		while(path[nameLength] != '\0' && path[nameLength] != '/')
+			++nameLength;
+		
+		ulong	nextInode;
+		
+		// only go to the file system if we haven't seen this name before
+		if(!dentryCache.Find(fileSystem, curInode, path, nameLength, nextInode))
+		{
+			int ret = fileSystem->Lookup(curInode, path, nameLength);
+			
+			// names that aren't there are cached too, errors aren't
+			if(ret < 0 && ret != -1 * ENOENT)
+				return(ret);
+			
+			nextInode = ret < 0 ? 0 : ret;
+			
+			dentryCache.Add(fileSystem, curInode, path, nameLength, nextInode);
+		}
+		
+		if(nextInode == 0)
+			return(-1 * ENOENT);
+		
+		curInode = nextInode;
+		path += nameLength;
+	}
+	
+	return(curInode);
+#endif
+}
+
+int FileSystemManager::OpenPath(FileSystemBase *fileSystem, FileDescriptorBase *fd, const char *path, const int flags)
+{
+	int inode = LookupPath(fileSystem, path);
+	
+	// the file system has to walk the path itself
+	if(inode == -1 * ENOSYS)
+		return(fileSystem->Open(fd, string(path), flags));
+	
+	if(inode < 0)
+		return(inode);
+	
+	return(fileSystem->OpenInode(fd, inode, flags));
+}
+
 int FileSystemManager::Read(int fileDescriptor, void *buff, uint numBytes)
 {
 	// get the file descriptor pointer
@@ -203,8 +347,108 @@ int FileSystemManager::Read(int fileDescriptor, void *buff, uint numBytes)
 	if(fd == NULL)
 		return(-1 * EBADF);
 	
-	// call the file system's read function and return it's value
-	return(fd->GetFileSystem()->Read(fd, buff, numBytes));
+	return(ReadFile(fd, buff, numBytes, CURRENT_POSITION));
+}
+
+int FileSystemManager::ReadAt(int fileDescriptor, void *buff, uint numBytes, int position)
+{
+	if(position < 0)
+		return(-1 * EINVAL);
+	
+	// get the file descriptor pointer
+	FileDescriptorBase *fd = ProcessManager::GetInstance().GetFileDescriptor(fileDescriptor);
+	
+	// return a that this a bad file descriptor
+	if(fd == NULL)
+		return(-1 * EBADF);
+	
+	return(ReadFile(fd, buff, numBytes, position));
+}
+
+int FileSystemManager::ReadVector(int fileDescriptor, const FileSystemBase::iovec *vector, int count)
+{
+	FileSystemBase::iovec	*kernelVector;
+	int			total = GetIOVector(vector, count, kernelVector);
+	
+	if(total < 0)
+		return(total);
+	
+	// one buffer at a time, stopping at the end of the file
+	for(int i=0; i < count; ++i)
+	{
+		int	ret = Read(fileDescriptor, kernelVector[i].iov_base, kernelVector[i].iov_len);
+		
+		if(ret < 0)
+		{
+			if(total == 0)
+				total = ret;
+			break;
+		}
+		
+		total += ret;
+		
+		if(uint(ret) < kernelVector[i].iov_len)
+			break;
+	}
+	
+	delete [] kernelVector;
+	
+	return(total);
+}
+
+int FileSystemManager::ReadFile(FileDescriptorBase *fd, void *buff, uint numBytes, int position)
+{
+	FileSystemBase	*fileSystem = fd->GetFileSystem();
+	
+	// the kernel's buffers can be handed right to the file system
+	if(!IsUserCaller())
+	{
+		if(position == CURRENT_POSITION)
+			return(fileSystem->Read(fd, buff, numBytes));
+		
+		return(fileSystem->ReadAt(fd, buff, numBytes, position));
+	}
+	
+	if(!IsValidUserRange(buff, numBytes))
+		return(-1 * EFAULT);
+	
+	// read into a kernel buffer and copy it out a chunk at a time
+	uchar	*userBuff = reinterpret_cast<uchar*>(buff);
+	uchar	*chunk = new uchar[MIN(numBytes, IO_CHUNK_SIZE)];
+	int	total = 0;
+	
+	while(uint(total) < numBytes)
+	{
+		uint	len = MIN(numBytes - total, IO_CHUNK_SIZE);
+		int	ret;
+		
+		if(position == CURRENT_POSITION)
+			ret = fileSystem->Read(fd, chunk, len);
+		else
+			ret = fileSystem->ReadAt(fd, chunk, len, position + total);
+		
+		if(ret <= 0)
+		{
+			if(total == 0)
+				total = ret;
+			break;
+		}
+		
+		if(CopyToUser(userBuff + total, chunk, ret) < 0)
+		{
+			total = -1 * EFAULT;
+			break;
+		}
+		
+		total += ret;
+		
+		if(uint(ret) < len)	// hit the end of the file
+			break;
+	}
+	
+	delete [] chunk;
+	
+	return(total);
 }
 
 int FileSystemManager::Write(int fileDescriptor, void *buff, uint numBytes)
@@ -215,11 +459,19 @@ int FileSystemManager::Write(int fileDescriptor, void *buff, uint numBytes)
 	if(fileDescriptor == 1)	// stdout
 	{
 		char	*tmp = reinterpret_cast<char*>(buff);
+		char	chunk[STDOUT_CHUNK_SIZE + 1];
 		
-		for(uint i=0; i < numBytes; ++i)
+		// print a chunk at a time instead of a character at a time
+		for(uint i=0; i < numBytes; i += STDOUT_CHUNK_SIZE)
 		{
-// 			DEBUG("%s", reinterpret_cast<char *>(buff));
-			DEBUG("%c", *tmp++);
+			uint	len = MIN(numBytes - i, STDOUT_CHUNK_SIZE);
+			
+			if(CopyFromUser(chunk, tmp + i, len) < 0)
+				return(i == 0 ? -1 * EFAULT : int(i));
+			
+			chunk[len] = '\0';
+			
+			DEBUG("%s", chunk);
 		}
 		
 		return(numBytes);
@@ -232,8 +484,131 @@ int FileSystemManager::Write(int fileDescriptor, void *buff, uint numBytes)
 	if(fd == NULL)
 		return(-1 * EBADF);
 	
-	// call the file system's read function and return it's value
-	return(fd->GetFileSystem()->Write(fd, buff, numBytes));
+	return(WriteFile(fd, buff, numBytes, CURRENT_POSITION));
+}
+
+int FileSystemManager::WriteAt(int fileDescriptor, void *buff, uint numBytes, int position)
+{
+	if(position < 0)
+		return(-1 * EINVAL);
+	
+	// get the file descriptor pointer
+	FileDescriptorBase *fd = ProcessManager::GetInstance().GetFileDescriptor(fileDescriptor);
+	
+	// return a that this a bad file descriptor
+	if(fd == NULL)
+		return(-1 * EBADF);
+	
+	return(WriteFile(fd, buff, numBytes, position));
+}
+
+int FileSystemManager::WriteVector(int fileDescriptor, const FileSystemBase::iovec *vector, int count)
+{
+	FileSystemBase::iovec	*kernelVector;
+	int			total = GetIOVector(vector, count, kernelVector);
+	
+	if(total < 0)
+		return(total);
+	
+	// through Write so stdout works too
+	for(int i=0; i < count; ++i)
+	{
+		int	ret = Write(fileDescriptor, kernelVector[i].iov_base, kernelVector[i].iov_len);
+		
+		if(ret < 0)
+		{
+			if(total == 0)
+				total = ret;
+			break;
+		}
+		
+		total += ret;
+		
+		if(uint(ret) < kernelVector[i].iov_len)
+			break;
+	}
+	
+	delete [] kernelVector;
+	
+	return(total);
+}
+
+int FileSystemManager::WriteFile(FileDescriptorBase *fd, void *buff, uint numBytes, int position)
+{
+	FileSystemBase	*fileSystem = fd->GetFileSystem();
+	
+	// the kernel's buffers can be handed right to the file system
+	if(!IsUserCaller())
+	{
+		if(position == CURRENT_POSITION)
+			return(fileSystem->Write(fd, buff, numBytes));
+		
+		return(fileSystem->WriteAt(fd, buff, numBytes, position));
+	}
+	
+	if(!IsValidUserRange(buff, numBytes))
+		return(-1 * EFAULT);
+	
+	// copy the data in a chunk at a time and write it from the kernel buffer
+	uchar	*userBuff = reinterpret_cast<uchar*>(buff);
+	uchar	*chunk = new uchar[MIN(numBytes, IO_CHUNK_SIZE)];
+	int	total = 0;
+	
+	while(uint(total) < numBytes)
+	{
+		uint	len = MIN(numBytes - total, IO_CHUNK_SIZE);
+		
+		if(CopyFromUser(chunk, userBuff + total, len) < 0)
+		{
+			if(total == 0)
+				total = -1 * EFAULT;
+			break;
+		}
+		
+		int	ret;
+		
+		if(position == CURRENT_POSITION)
+			ret = fileSystem->Write(fd, chunk, len);
+		else
+			ret = fileSystem->WriteAt(fd, chunk, len, position + total);
+		
+		if(ret <= 0)
+		{
+			if(total == 0)
+				total = ret;
+			break;
+		}
+		
+		total += ret;
+		
+		if(uint(ret) < len)
+			break;
+	}
+	
+	delete [] chunk;
+	
+	return(total);
+}
+
+int FileSystemManager::GetIOVector(const FileSystemBase::iovec *vector, int count, FileSystemBase::iovec *&kernelVector)
+{
+	if(count <= 0 || uint(count) > MAX_IO_VECTORS)
+		return(-1 * EINVAL);
+	
+	ulong	size = count * sizeof(FileSystemBase::iovec);
+	
+	kernelVector = new FileSystemBase::iovec[count];
+	
+	if(!IsUserCaller())
+		MemCopy(kernelVector, vector, size);
+	
+	else if(!IsValidUserRange(vector, size) || CopyFromUser(kernelVector, vector, size) < 0)
+	{
+		delete [] kernelVector;
+		return(-1 * EFAULT);
+	}
+	
+	return(0);
 }
 
 int FileSystemManager::Seek(int fileDescriptor, int offset, int whence)
@@ -252,6 +627,35 @@ int FileSystemManager::Seek(int fileDescriptor, int offset, int whence)
 	return(fd->GetFileSystem()->Seek(fd, offset, whence));
 }
 
+int FileSystemManager::Sync()
+{
+	FileSystemManager	&fileSysMan = FileSystemManager::GetInstance();
+	int			ret = 0;
+	
+	// keep going on an error so the other file systems still get written
+	for(map<string, FileSystemBase*>::iterator it = fileSysMan.mountPoints.begin(); it != fileSysMan.mountPoints.end(); ++it)
+	{
+		int tmp = (*it).second->Sync();
+		
+		if(tmp < 0 && ret == 0)
+			ret = tmp;
+	}
+	
+	return(ret);
+}
+
+int FileSystemManager::FileSync(int fileDescriptor)
+{
+	// get the file descriptor pointer
+	FileDescriptorBase *fd = ProcessManager::GetInstance().GetFileDescriptor(fileDescriptor);
+	
+	// return a that this a bad file descriptor
+	if(fd == NULL)
+		return(-1 * EBADF);
+	
+	return(fd->GetFileSystem()->Sync());
+}
+
 void FileSystemManager::Close(int fileDescriptor)
 {
 	ProcessManager	&procMan = ProcessManager::GetInstance();
@@ -19,74 +19,230 @@
 
 #include <constants.h>
 #include <types.h>
+#include <mem_utils.h>
+#include <Devices.h>
 #include <Partition.h>
-#include <screen_utils.h>
 #include <Debug.h>
 
-Partition::Partition()
+int Partition::Scan(BlockDevice *device, ulong deviceSize, vector<PartitionInfo> &partitions)
 {
-	// MemSet(primaryPartitions, 0, sizeof(ParsedPartitionDescriptor)*4);
-}
+	if(device->GetBlockSize() != SECTOR_SIZE)
+	{
+		WARN("Can only partition devices with %d byte blocks\n", SECTOR_SIZE);
+		return(-1);
+	}
 
-Partition::Partition(uchar *firstSector)
-{
-	ParsePartitionInformation(firstSector);	// setup the partitions
-}
+	// the MBR, GPT header and GPT entries in one go
+	ulong	scanSectors = SCAN_SECTORS;
 
-int Partition::ParsePartitionInformation(uchar *firstSector)
-{
-	if(firstSector[510] != 0x55 || firstSector[511] != 0xAA)
+	if(deviceSize != 0 && deviceSize < scanSectors)
+		scanSectors = deviceSize;
+
+	uchar	*buff = new uchar[SCAN_SECTORS * SECTOR_SIZE];
+
+	if(device->ReadBlocks(0, scanSectors, buff) < 0)
+	{
+		WARN("Couldn't read the partition table\n");
+		delete [] buff;
+		return(-1);
+	}
+
+	if(!HasSignature(buff))
 	{
-		WARN("Invalid partition type\n");
+		WARN("No partition table\n");
+		delete [] buff;
 		return(-1);
 	}
-	
+
+	PartitionDescriptor	*primary = reinterpret_cast<PartitionDescriptor*>(&buff[446]);
+	int			found = 0;
+
+	// a protective MBR means the real table is the GPT
 	for(int i=0; i < 4; ++i)
 	{
-		PartitionDescriptor *tmpDes = (PartitionDescriptor*)&firstSector[446+(i*16)];
-		
-		primaryPartitions[i].bootable		= tmpDes->bootIndicator & 0x80;
-		primaryPartitions[i].partitionType	= tmpDes->partitionType;
-		primaryPartitions[i].lbaPartitionStart	= tmpDes->lbaPartitionStart;
-		primaryPartitions[i].partitionSize	= tmpDes->partitionSize*512;
+		if(primary[i].partitionType == GPT_PROTECTIVE_TYPE)
+		{
+			found = ParseGPT(device, buff, scanSectors, deviceSize, partitions);
+
+			delete [] buff;
+			return(found);
+		}
 	}
-	
-/*	for(int i=0; i < 4; ++i)
+
+	int	nextLogical = 5;
+
+	for(int i=0; i < 4; ++i)
 	{
-		printf("Partition %d...\n", i);
-		printf(" TYPE: %s\n", primaryPartitions[i].partitionType == 0x83 ? "LINUX" : "UNKNOWN");
-		printf(" SIZE: %u bytes\n", primaryPartitions[i].partitionSize);
-		printf("START: 0x%x\n", primaryPartitions[i].lbaPartitionStart);
+		if(primary[i].partitionType == 0 || primary[i].partitionSize == 0)
+			continue;
+
+		// the extended partition only holds the logical ones, it doesn't get a device
+		if(IsExtended(primary[i].partitionType))
+		{
+			int ret = ParseEBRChain(device, primary[i].lbaPartitionStart, deviceSize, nextLogical, partitions);
+
+			found += ret;
+			nextLogical += ret;
+			continue;
+		}
+
+		if(AddPartition(i + 1,
+				primary[i].partitionType,
+				primary[i].bootIndicator & 0x80,
+				primary[i].lbaPartitionStart,
+				primary[i].partitionSize,
+				deviceSize,
+				partitions))
+			++found;
 	}
-*/
-	return(0);
+
+	delete [] buff;
+
+	return(found);
 }
 
-Partition::ParsedPartitionDescriptor Partition::GetPartitionInformation(int partitionNumber)
+int Partition::ParseGPT(BlockDevice *device, uchar *buff, ulong buffSectors, ulong deviceSize, vector<PartitionInfo> &partitions)
 {
-	if(partitionNumber < 0 || partitionNumber > 3)
+	GPTHeader	*header = reinterpret_cast<GPTHeader*>(&buff[SECTOR_SIZE]);
+
+	char		signature[] = "EFI PART";
+
+	if(!MemEqual(header->signature, signature, 8))
 	{
-		PANIC("Out of bounds partition request\n");	
+		WARN("Protective MBR but no GPT header\n");
+		return(0);
 	}
-	
-	return(primaryPartitions[partitionNumber]);
+
+	if(header->entrySize < sizeof(GPTEntry) || header->entrySize % 8 != 0 || (header->entriesLBA >> 32) != 0)
+	{
+		WARN("Bad GPT header\n");
+		return(0);
+	}
+
+	ulong	numEntries = MIN(header->numEntries, ulong(MAX_GPT_ENTRIES));
+	ulong	entriesLBA = header->entriesLBA;
+	ulong	entrySectors = (numEntries * header->entrySize + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	uchar	*entries;
+	uchar	*entryBuff = NULL;
+
+	// normally the entries were in the first read
+	if(entriesLBA + entrySectors <= buffSectors)
+		entries = &buff[entriesLBA * SECTOR_SIZE];
+
+	else
+	{
+		entries = entryBuff = new uchar[entrySectors * SECTOR_SIZE];
+
+		if(device->ReadBlocks(entriesLBA, entrySectors, entryBuff) < 0)
+		{
+			WARN("Couldn't read the GPT entries\n");
+			delete [] entryBuff;
+			return(0);
+		}
+	}
+
+	int	found = 0;
+
+	for(ulong i=0; i < numEntries; ++i)
+	{
+		GPTEntry	*entry = reinterpret_cast<GPTEntry*>(&entries[i * header->entrySize]);
+		bool		used = false;
+
+		for(int j=0; j < 16; ++j)
+			used = used || entry->typeGUID[j] != 0;
+
+		if(!used)
+			continue;
+
+		// we can only address 32-bits worth of blocks
+		if((entry->lastLBA >> 32) != 0 || entry->lastLBA < entry->firstLBA)
+		{
+			WARN("GPT partition %d is out of reach\n", i + 1);
+			continue;
+		}
+
+		ulong	first = entry->firstLBA;
+		ulong	last = entry->lastLBA;
+
+		if(AddPartition(i + 1, GPT_TYPE, false, first, last - first + 1, deviceSize, partitions))
+			++found;
+	}
+
+	if(entryBuff != NULL)
+		delete [] entryBuff;
+
+	return(found);
 }
 
-ulong Partition::GetPartitionStartAddress(int partitionNumber)
+int Partition::ParseEBRChain(BlockDevice *device, ulong extendedStart, ulong deviceSize, int nextNumber, vector<PartitionInfo> &partitions)
 {
-	if(partitionNumber < 0 || partitionNumber > 3)
+	uchar	*sector = new uchar[SECTOR_SIZE];
+	ulong	ebrAddr = extendedStart;
+	int	found = 0;
+
+	// each EBR has the logical partition relative to itself, and the next EBR relative to the extended partition
+	for(int i=0; i < MAX_LOGICAL; ++i)
 	{
-		PANIC("Out of bounds partition request\n");	
+		if(device->ReadBlocks(ebrAddr, 1, sector) < 0 || !HasSignature(sector))
+		{
+			WARN("Bad EBR at %u\n", ebrAddr);
+			break;
+		}
+
+		PartitionDescriptor	*entry = reinterpret_cast<PartitionDescriptor*>(&sector[446]);
+
+		if(entry[0].partitionType != 0 && entry[0].partitionSize != 0)
+		{
+			if(AddPartition(nextNumber,
+					entry[0].partitionType,
+					entry[0].bootIndicator & 0x80,
+					ebrAddr + entry[0].lbaPartitionStart,
+					entry[0].partitionSize,
+					deviceSize,
+					partitions))
+			{
+				++found;
+				++nextNumber;
+			}
+		}
+
+		if(!IsExtended(entry[1].partitionType) || entry[1].lbaPartitionStart == 0)
+			break;
+
+		ebrAddr = extendedStart + entry[1].lbaPartitionStart;
 	}
-	
-	return(primaryPartitions[partitionNumber].lbaPartitionStart);
+
+	delete [] sector;
+
+	return(found);
 }
 
-/*
-ulong Partition::GetPartitionStartAddress(int num)
+bool Partition::AddPartition(int number, uchar type, bool bootable, ulong start, ulong size, ulong deviceSize, vector<PartitionInfo> &partitions)
 {
-	return(primaryPartitions[num].lbaPartitionStart);
-}
-*/
+	if(deviceSize != 0)
+	{
+		if(start >= deviceSize)
+		{
+			WARN("Partition %d starts past the end of the device\n", number);
+			return(false);
+		}
+
+		if(size > deviceSize - start)
+		{
+			WARN("Partition %d runs past the end of the device, cutting it off\n", number);
+			size = deviceSize - start;
+		}
+	}
 
+	PartitionInfo	info;
 
+	info.number = number;
+	info.partitionType = type;
+	info.bootable = bootable;
+	info.start = start;
+	info.size = size;
+
+	partitions.push_back(info);
+
+	return(true);
+}
@@ -24,16 +24,58 @@
 #include <types.h>
 #include <list.h>
 #include <Semaphore.h>
+#include <BlockRequestQueue.h>
+#include <i386.h>
 #include <Devices.h>
 
 using k_std::list;
 
+/// A Physical Region Descriptor, one piece of a bus-master DMA transfer
+struct PRDEntry
+{
+	ulong	physAddr;	///< The physical address of the memory
+	ushort	byteCount;	///< The number of bytes, 0 means 64K
+	ushort	flags;		///< PRD_END on the last entry
+} __attribute__((packed));
+
+/** @struct ATAChannel
+ *
+ * @brief The state shared by every driver on one IDE channel.
+ *
+ * Both devices on a channel, and every partition of them, use the same registers and IRQ,
+ * so the command lock, the IRQ wait queue and the request queue live here instead of in
+ * the driver. A worker thread per channel takes commands off the request queue.
+ *
+ **/
+struct ATAChannel
+{
+	ATAChannel(ushort controller)
+		: ide(controller), commandLock(1), useIRQ(false), waiting(false), status(0),
+		  busMaster(0), prdTable(NULL), prdTablePhys(0), workerRunning(false)
+	{ ; }
+
+	ushort		ide;		///< The IDE controller of this channel
+	Semaphore	commandLock;	///< Only 1 command on the wire at a time
+	Semaphore	irqSignal;	///< Signaled by the IRQ handler when the drive is ready
+	bool		useIRQ;		///< Set once the IRQ handler is installed
+	volatile bool	waiting;	///< Set when a command expects an IRQ
+	volatile uchar	status;		///< The status register, as read by the IRQ handler
+	ushort		busMaster;	///< The bus-master IDE registers, 0 if there's no DMA
+	PRDEntry	*prdTable;	///< The PRD table for DMA transfers
+	ulong		prdTablePhys;	///< The physical address of prdTable
+	BlockRequestQueue	queue;		///< Requests waiting for the worker
+	bool			workerRunning;	///< Set once the worker thread is created
+};
+
 /** @class ATADriver
  *
  * @brief This is the device driver for the ATA hard disk controller.
  * 
  * This driver actually does not inherit from driver because it's manager handles everything.
  *
+ * Transfers use bus-master DMA when the controller and drive support it, otherwise PIO.
+ * Either way the thread sleeps on the channel until the drive interrupts.
+ *
  **/
 
 class ATADriver : public BlockDevice
@@ -44,13 +86,14 @@ public:
 	 * The only constructor for an ATADriver.
 	 * @param controller The IDE controller to use: primary, secondary.
 	 * @param device The device on that IDE controller.
+	 * @param theChannel The shared state for the controller.
 	 */
-	ATADriver(ushort controller, uchar device, ulong baseAddress = 0);
+	ATADriver(ushort controller, uchar device, ATAChannel *theChannel, ulong baseAddress = 0);
 	
 	/**
 	 * The copy constructor.
 	 * 
-	 * Everything is copied except the semaphore.
+	 * The copy shares the channel with the original, and its blocks are cached as part of it.
 	 * @param driver The drive to construct this one from.
 	 */
 	ATADriver(const ATADriver &driver);
@@ -60,9 +103,38 @@ public:
 	 * 
 	 * Use with care...
 	 * @param newBase The new base address.
+	 * @param numBlocks The number of blocks from newBase this device can reach, zero for no limit.
+	 */
+	inline void ChangeBaseAddress(ulong newBase, ulong numBlocks = 0)
+	{ lbaBase = newBase; blockLimit = numBlocks; }
+	
+	/**
+	 * Returns the number of blocks on the device.
+	 * @return The number of blocks, or zero if it isn't known.
+	 */
+	ulong GetBlockCount()
+	{ return(blockLimit); }
+	
+	/**
+	 * Returns the whole drive, for partitions made by copying it.
+	 * @return The drive this driver is a piece of, or this one.
+	 */
+	BlockDevice *GetWholeDevice()
+	{ return(wholeDisk != NULL ? wholeDisk : this); }
+	
+	/**
+	 * Returns where this driver starts on the whole drive.
+	 * @return The address on GetWholeDevice of the first block.
+	 */
+	ulong GetWholeDeviceOffset()
+	{ return(wholeDisk != NULL ? lbaBase - wholeDisk->lbaBase : 0); }
+	
+	/**
+	 * Returns true once the channel's worker thread is there to take requests.
+	 * @return True if SubmitRequest queues the request.
 	 */
-	inline void ChangeBaseAddress(ulong newBase)
-	{ lbaBase = newBase; }
+	bool CanQueue()
+	{ return(channel->workerRunning); }
 	
 	/**
 	 * Reads blocks from the device.
@@ -82,6 +154,21 @@ public:
 	 */
 	int WriteBlocks(ulong address, int blockCount, void *src);
 	
+	/**
+	 * Queues a request without waiting for it.
+	 * 
+	 * The address is relative to this device and is made absolute before it's queued.
+	 * Done is called from the channel's worker thread, or right away if there isn't one yet.
+	 * @param request The request, it must stay around until Done is called.
+	 */
+	void SubmitRequest(BlockRequest *request);
+	
+	/**
+	 * Writes the drive's cache out to the disk.
+	 * @return Zero on success or -EIO.
+	 */
+	int Flush();
+	
 	/**
 	 * Returns the size of a block for the device.
 	 * @return The number of blocks read.
@@ -90,10 +177,103 @@ public:
 	{ return 512; }
 
 private:
-	Semaphore	requestSemaphore;	// only 1 command on the wire at a time
+	ATAChannel	*channel;	///< Shared with the other drivers on this controller
 	ushort		ide;
 	uchar		dev;
 	ulong		lbaBase;
+	ulong		blockLimit;	///< The number of blocks past lbaBase that can be used, zero for no limit
+	ATADriver	*wholeDisk;	///< The driver for the whole drive if this is a copy of it, NULL if this is it
+	bool		useDMA;		///< Set by the manager if the drive can do DMA
+	bool		useLBA48;	///< Set by the manager if the drive has the 48-bit feature set
+	
+	uchar		multipleCount;	///< Sectors per interrupt for the MULTIPLE commands, 0 if not set
+	
+	/**
+	 * Submits a request and sleeps until it's done, for ReadBlocks and WriteBlocks.
+	 * @param address The address of the first block, relative to lbaBase.
+	 * @param blockCount The number of blocks.
+	 * @param buff The memory to transfer to or from.
+	 * @param write True to write to the disk.
+	 * @return The number of blocks transfered.
+	 */
+	int SubmitAndWait(ulong address, int blockCount, uchar *buff, bool write);
+	
+	/**
+	 * Carries out a command from the queue, the channel's command lock must be held.
+	 * 
+	 * A single request is split into as many commands as it needs, merged ones always fit in one.
+	 * @param command The first request of the command.
+	 * @return Zero on success or -EIO if the drive reported an error.
+	 */
+	int Execute(BlockRequest *command);
+	
+	/**
+	 * Takes commands off a channel's queue forever, run as a kernel thread.
+	 * @param arg The ATAChannel.
+	 */
+	static void ChannelWorker(void *arg);
+	
+	/**
+	 * Transfers sectors with PIO, one interrupt per sector or per MULTIPLE block.
+	 * @param request The requests to transfer as one command, at most MAX_BLOCK_COUNT or MAX_BLOCK_COUNT_EXT sectors.
+	 * @return Zero on success or -EIO if the drive reported an error.
+	 */
+	int TransferPIO(BlockRequest *request);
+	
+	/**
+	 * Transfers sectors with bus-master DMA, one interrupt for the whole transfer.
+	 * @param request The requests to transfer as one command, at most MAX_DMA_BLOCK_COUNT sectors.
+	 * @return False if the transfer couldn't be done with DMA and PIO should be used.
+	 */
+	bool TransferDMA(BlockRequest *request);
+	
+	/**
+	 * Sets the number of sectors transfered per interrupt by READ/WRITE MULTIPLE.
+	 * @param sectorCount The number of sectors, at most the drive's maximum.
+	 * @return True if the drive accepted it.
+	 */
+	bool SetMultipleMode(uchar sectorCount);
+	
+	/**
+	 * Fills in the channel's PRD table for the buffers of a command.
+	 * @param request The requests of the command, the buffers must be mapped and word aligned.
+	 * @return False if the buffers need more entries than the table has.
+	 */
+	bool BuildPRDTable(BlockRequest *request);
+	
+	/**
+	 * Sets up a channel for DMA.
+	 * @param theChannel The channel.
+	 * @param busMasterBase The I/O address of the channel's bus-master registers.
+	 */
+	static void SetupBusMaster(ATAChannel *theChannel, ushort busMasterBase);
+	
+	/**
+	 * Selects the device and waits for it to be ready.
+	 * @param address The LBA of the transfer, the high bits go in the device register.
+	 */
+	void SelectDevice(ulong address);
+	
+	/**
+	 * Selects the device, waits for it to be ready and loads the address and count registers.
+	 * @param address The LBA of the first sector.
+	 * @param sectorCount The number of sectors.
+	 */
+	void SetupTransfer(ulong address, int sectorCount);
+	
+	/**
+	 * Tells the IRQ handler that the next interrupt from the drive is for us.
+	 * Must be called before the drive can raise the interrupt.
+	 */
+	void ExpectInterrupt();
+	
+	/**
+	 * Blocks the thread until the drive raises its interrupt.
+	 * 
+	 * Until the IRQ handler is installed and the channel's worker is running, this polls instead.
+	 * @return The status register at the time of the interrupt.
+	 */
+	uchar WaitForInterrupt();
 	
 	/**
 	 * Calls the alt status register 4 times to delay for 400ns.
@@ -143,6 +323,18 @@ private:
 	static const uchar WRITE_SECTOR_NO_RETRY= 0x31;
 	static const uchar WRITE_VERIFY		= 0x3C;
 	static const uchar RESET_DEVICE		= 0x08;
+	static const uchar READ_DMA		= 0xC8;
+	static const uchar WRITE_DMA		= 0xCA;
+	static const uchar FLUSH_CACHE		= 0xE7;
+	
+	// 48-bit commands
+	static const uchar READ_SECTOR_EXT	= 0x24;
+	static const uchar READ_DMA_EXT		= 0x25;
+	static const uchar READ_MULTIPLE_EXT	= 0x29;
+	static const uchar WRITE_SECTOR_EXT	= 0x34;
+	static const uchar WRITE_DMA_EXT	= 0x35;
+	static const uchar WRITE_MULTIPLE_EXT	= 0x39;
+	static const uchar FLUSH_CACHE_EXT	= 0xEA;
 	
 	// Common values
 	static const uchar BUSY			= 0x80;
@@ -155,6 +347,23 @@ private:
 	static const uchar ERROR		= 0x01;
 	static const uchar SOFTWARE_RESET	= 0x04;
 	static const int   MAX_BLOCK_COUNT	= 255;	///< This should really be read from the info
+	static const int   MAX_BLOCK_COUNT_EXT	= 65536;	///< The most a 48-bit command can transfer
+	
+	// Bus-master IDE registers, offsets from the channel's base
+	static const ushort BM_COMMAND_REG	= 0x00;
+	static const ushort BM_STATUS_REG	= 0x02;
+	static const ushort BM_PRD_TABLE_REG	= 0x04;
+	
+	// Bus-master values
+	static const uchar BM_START		= 0x01;
+	static const uchar BM_READ		= 0x08;	///< The controller writes to memory
+	static const uchar BM_ACTIVE		= 0x01;
+	static const uchar BM_ERROR		= 0x02;
+	static const uchar BM_INTERRUPT		= 0x04;
+	static const ushort PRD_END		= 0x8000;
+	static const uint  MAX_PRD_ENTRIES	= 512;	///< A page, aligned so it never crosses 64K
+	static const int   MAX_DMA_BLOCK_COUNT	= (MAX_PRD_ENTRIES - 1) * (PAGE_SIZE / 512);	///< Fits even if no pages merge
+	static const ulong PRD_BOUNDARY		= 0x10000;	///< No PRD entry may cross a 64K boundary
 };
 
 
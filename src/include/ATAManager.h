@@ -44,6 +44,11 @@ using k_std::string;
 class ATAManager : public Driver, public Singleton<ATAManager>
 {
 public:
+	/**
+	 * Sets up the state for the two IDE channels.
+	 */
+	ATAManager();
+	
 	/**
 	 * This runs when the manager is installed.
 	 * 
@@ -55,14 +60,9 @@ public:
 	/**
 	 * This handles all the ATA interrupts.
 	 * 
-	 * Currently this function does nothing.
+	 * Acknowledges the drive and wakes the thread waiting on that channel.
 	 */
-	int IRQSignaled(Registers *regs)
-	{
-		(void)regs;
-// 		printf("ATA INT\n");
-		return(0);
-	}
+	int IRQSignaled(Registers *regs);
 	
 	/**
 	 * This runs when the manager is uninstalled.
@@ -96,32 +96,40 @@ private:
 		uchar	curNumSectorsForMultiple;	// current value of number of sectors per MULTIPLE
 		ulong	totalAddressableSectors;	// LBA
 		uchar	ATAVersion;
+		bool	DMASupported;		// word 49, bit 8
+		bool	LBA48Supported;		// word 83, bit 10
+		ulonglong totalAddressableSectors48;	// words 100-103
 	};
 	
-	struct PartitionDescriptor
-	{
-		uchar	bootIndicator;
-		uchar	chsPartitionStart[3];
-		uchar	partitionType;
-		uchar	chsPartitionEnd[3];
-		ulong	lbaPartitionStart;
-		ulong	partitionSize;	
-	} __attribute__((packed));
-
 	/**
 	 * Polls the given controller and device to see if it is there or not.
 	 */
 	bool GetDeviceInformation(ushort controller, uchar device, DeviceInfo &devInfo);
 	
 	/**
-	 * Fills in a list of start addresses for all the partitions on the device.
-	 * 
-	 * Assumes the partition table is <b>1024</b> bytes into the block device.
-	 * @param blockDevice The block device to read the partition table from.
-	 * @param addrList The list of addresses that will be returned.
-	 * @return Error status.
+	 * Looks for a PCI IDE controller that can do bus-master DMA and sets up the channels for it.
+	 * @return True if the channels can do DMA.
+	 */
+	bool SetupBusMaster();
+	
+	/**
+	 * Starts the request queue worker for a channel.
+	 * @param channel The channel.
+	 */
+	void StartWorker(ATAChannel &channel);
+	
+	/**
+	 * Makes a device for each partition on a drive, named after the drive and the partition number.
+	 * @param name The name of the drive, /dev/hda, etc.
+	 * @param drive The drive to scan.
+	 */
+	void AddPartitions(string name, ATADriver *drive);
+	
+	/**
+	 * Returns the number of sectors on a drive, as much of it as we can address.
+	 * @param info The drive's information.
 	 */
-	int GetPartitionAddresses(ATADriver *blockDevice, list<ulong> &addrList);
+	ulong GetSectorCount(const DeviceInfo &info);
 
 	/**
 	 * Prints the information of an ATA device. (DEBUG ONLY)
@@ -132,6 +140,8 @@ private:
 	
 	map<string, ATADriver*>	ATADrivers;	///< A map of all the ATA drivers and their names
 	map<string, DeviceInfo>	ATAInformation;	///< A map of all the ATA names and their information
+	ATAChannel		primaryChannel;		///< Shared by hda and hdb
+	ATAChannel		secondaryChannel;	///< Shared by hdc and hdd
 
 	// Devices
 	static const uchar DEVICE_0	= 0xE0; //0xA0;
@@ -40,7 +40,10 @@ public:
 	void Enable();		// turn interrputs on
 
 private:
-	bool	turnOn;
+	bool		turnOn;
+	ulonglong	startTime;	///< When interrupts were turned off, for LatencyStats
+	ulong		switchCount;	///< The task switch count when interrupts were turned off
+	ulong		location;	///< The code that turned interrupts off
 };
 
 
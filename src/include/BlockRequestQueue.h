@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file BlockRequestQueue.h
+ *
+ */
+
+#ifndef BLOCKREQUESTQUEUE_H
+#define BLOCKREQUESTQUEUE_H
+
+
+#include <constants.h>
+#include <types.h>
+#include <list.h>
+#include <Semaphore.h>
+
+using k_std::list;
+
+class BlockDevice;
+
+/** @struct BlockRequest
+ *
+ * @brief One read or write waiting in a BlockRequestQueue.
+ *
+ * The submitter owns the memory and must keep it around until Done is called.
+ *
+ **/
+struct BlockRequest
+{
+	BlockDevice	*device;	///< The device that submitted the request
+	ulong		unit;		///< Requests are only merged if this matches, the physical drive
+	ulong		address;	///< The first block, absolute on the drive
+	int		blockCount;	///< The number of blocks
+	uchar		*buff;		///< The memory to transfer to or from
+	bool		write;		///< True to write to the device
+	int		result;		///< Filled in with the blocks transfered or a negative errno
+
+	void		(*Done)(BlockRequest *request);	///< Called by the worker when finished
+	void		*arg;		///< For the submitter's use in Done
+
+	BlockRequest	*nextMerged;	///< The next request in the same command, set by the queue
+	uint		passedOver;	///< How many dispatches went ahead of this one
+};
+
+/** @class BlockRequestQueue
+ *
+ * @brief Orders and merges requests for a device that can only do one thing at a time.
+ *
+ * Submit never blocks. A worker thread calls Next to get the next command, which is
+ * chosen with a one-way elevator (C-LOOK): the lowest address at or past the last one
+ * served on the same unit, wrapping to the lowest address overall. Every unit has its
+ * own heads, so the position of one drive on a channel doesn't skew the order of the
+ * other. Pending requests that continue the chosen one in the same direction are
+ * chained onto it so they go out as one command.
+ *
+ * A request that has been passed over MAX_PASSED_OVER times is served next regardless
+ * of where the heads are, so a stream of nearby requests can't starve it.
+ *
+ **/
+class BlockRequestQueue
+{
+public:
+	BlockRequestQueue();
+
+	/**
+	 * Adds a request to the queue and wakes the worker.
+	 * @param request The request, it isn't copied.
+	 */
+	void Submit(BlockRequest *request);
+
+	/**
+	 * Waits for requests and removes the next command from the queue.
+	 * @param maxBlocks The most blocks that can be merged into one command.
+	 * @return The first request of the command, the rest are linked by nextMerged.
+	 */
+	BlockRequest *Next(int maxBlocks);
+
+	/**
+	 * Calls Done on every request in a command.
+	 * @param command The first request, as returned from Next.
+	 * @param result A negative errno for every request, otherwise each gets its block count.
+	 */
+	static void Complete(BlockRequest *command, int result);
+
+	static const uint	MAX_PASSED_OVER = 16;	///< Dispatches a request can wait before it jumps the queue
+	static const uint	MAX_UNITS = 2;		///< Units with their own head position, a channel has a master and a slave
+
+private:
+	/**
+	 * Finds the head position of a unit.
+	 * @param unit The unit of a request.
+	 * @return A reference to the address just past the unit's last command.
+	 */
+	ulong &HeadPosition(ulong unit);
+
+	list<BlockRequest*>	pending;	///< Waiting requests in the order they were submitted
+	Semaphore		pendingCount;	///< One count per request in pending
+	ulong			headUnit[MAX_UNITS];	///< The unit of each head position
+	ulong			headPosition[MAX_UNITS];	///< The address just past each unit's last command
+	uint			numUnits;	///< The number of units seen so far
+};
+
+
+#endif // BlockRequestQueue.h
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file BufferCache.h
+ *
+ */
+
+#ifndef BUFFERCACHE_H
+#define BUFFERCACHE_H
+
+
+#include <constants.h>
+#include <types.h>
+#include <Singleton.h>
+#include <Semaphore.h>
+#include <BlockRequestQueue.h>
+
+class BlockDevice;
+
+/** @struct Buffer
+ *
+ * @brief One cached file system block.
+ *
+ * A buffer covers blockCount device blocks starting at address. The data is only
+ * valid while the buffer is held, between a Get and a Release.
+ *
+ **/
+struct Buffer
+{
+	BlockDevice	*device;	///< The whole device the block belongs to
+	ulong		address;	///< The first block on the whole device, the key along with device and blockCount
+	int		blockCount;	///< The number of device blocks in the buffer
+	ulong		size;		///< The size of data in bytes
+	uchar		*data;		///< The cached contents
+
+	uint		refCount;	///< The number of holders, it can't be evicted while this isn't zero
+	bool		valid;		///< True once data matches (or is newer than) the device
+	bool		dirty;		///< True if data needs to be written to the device
+	seconds_t	dirtyTime;	///< When the buffer went from clean to dirty
+	Semaphore	ioLock;		///< Held while data is read from the device, even by readahead
+
+	Buffer		*hashNext;	///< The next buffer in the same hash bucket
+	Buffer		*lruPrev;	///< The next more recently used buffer
+	Buffer		*lruNext;	///< The next less recently used buffer
+
+	Buffer() : ioLock(1) { ; }
+};
+
+/** @class BufferCache
+ *
+ * @brief Caches file system blocks for all block devices.
+ *
+ * Buffers are found by (device, address, blockCount) through a hash table and kept on an
+ * LRU list. When the memory used goes over the limit the least recently used buffers nobody
+ * is holding are dropped, dirty ones are written out first.
+ *
+ * A block is only ever in one buffer. Partitions are cached as part of their whole device,
+ * and before a buffer is made any buffer of another size that shares blocks with it is
+ * written back and dropped.
+ *
+ * Writes only mark the buffer dirty. Once StartFlusher is called a kernel thread writes
+ * buffers that have been dirty for DIRTY_AGE seconds, or all of them when dirty buffers
+ * take up more than 1/DIRTY_RATIO of the cache. Dirty buffers next to each other on the
+ * device are written with one request. Sync writes them out right away.
+ *
+ **/
+class BufferCache : public Singleton<BufferCache>
+{
+public:
+	BufferCache();
+
+	/**
+	 * Finds or creates the buffer for a block and holds it.
+	 * @param device The device the block is on.
+	 * @param address The first device block of the buffer.
+	 * @param blockCount The number of device blocks in the buffer.
+	 * @param read True to read the block from the device if it isn't cached. If false the
+	 * caller must fill in the whole buffer and call MarkDirty.
+	 * @return The held buffer or NULL if the read failed.
+	 */
+	Buffer *Get(BlockDevice *device, ulong address, int blockCount, bool read = true);
+
+	/**
+	 * Lets go of a buffer returned by Get.
+	 * @param buffer The buffer to release.
+	 */
+	void Release(Buffer *buffer);
+
+	/**
+	 * Marks a held buffer as changed so it will be written back to the device.
+	 * @param buffer The buffer that was changed.
+	 */
+	void MarkDirty(Buffer *buffer);
+
+	/**
+	 * Reads consecutive blocks through the cache, blocks that aren't cached are read in one request.
+	 * @param device The device to read from.
+	 * @param address The first device block.
+	 * @param blocksPerBuffer The number of device blocks in each buffer.
+	 * @param numBuffers The number of buffers to read.
+	 * @param dest Where to copy the data.
+	 * @return The number of device blocks read or a negative errno.
+	 */
+	int Read(BlockDevice *device, ulong address, int blocksPerBuffer, ulong numBuffers, uchar *dest);
+
+	/**
+	 * Starts reading consecutive blocks into the cache without waiting for them.
+	 * Blocks that are already cached are skipped, the rest go out in as few requests as possible.
+	 * @param device The device to read from.
+	 * @param address The first device block.
+	 * @param blocksPerBuffer The number of device blocks in each buffer.
+	 * @param numBuffers The number of buffers to read.
+	 */
+	void ReadAhead(BlockDevice *device, ulong address, int blocksPerBuffer, ulong numBuffers);
+
+	/**
+	 * Writes consecutive blocks into the cache and marks them dirty.
+	 * @param device The device to write to.
+	 * @param address The first device block.
+	 * @param blocksPerBuffer The number of device blocks in each buffer.
+	 * @param numBuffers The number of buffers to write.
+	 * @param src Where to copy the data from.
+	 * @return The number of device blocks written or a negative errno.
+	 */
+	int Write(BlockDevice *device, ulong address, int blocksPerBuffer, ulong numBuffers, uchar *src);
+
+	/**
+	 * Writes every dirty buffer for a device, or all devices.
+	 * @param device The device to write out, NULL for all of them.
+	 * @return Zero on success or the first negative errno.
+	 */
+	int Sync(BlockDevice *device = NULL);
+
+	/**
+	 * Starts the thread that writes back dirty buffers, it is safe to call more than once.
+	 */
+	void StartFlusher();
+
+	/**
+	 * Drops every buffer for a device, call Sync first to keep the changes.
+	 * @param device The device that is going away.
+	 */
+	void Invalidate(BlockDevice *device);
+
+	/**
+	 * Sets the most memory the buffers can use, shrinking the cache if needed.
+	 * @param bytes The limit in bytes.
+	 */
+	void SetMaxMemory(ulong bytes);
+
+	inline ulong GetMaxMemory() { return(maxMemory); }
+	inline ulong GetUsedMemory() { return(usedMemory); }
+
+	static const ulong	DEFAULT_MAX_MEMORY = 4 * 1024 * 1024;	///< 4MB of the heap
+	static const uint	NUM_BUCKETS = 1024;	///< The size of the hash table
+	static const seconds_t	DIRTY_AGE = 5;		///< Seconds a buffer can stay dirty
+	static const ulong	DIRTY_RATIO = 4;	///< Flush everything once 1/DIRTY_RATIO of the cache is dirty
+	static const int	MAX_FLUSH_BLOCKS = 128;	///< The most device blocks written in one request
+	static const int	MAX_READAHEAD_BLOCKS = 128;	///< The most device blocks read ahead in one request
+
+private:
+	/**
+	 * Moves a range of blocks onto the device the cache keys them by.
+	 * @param device The device, changed to its whole device.
+	 * @param address The first block, changed to be relative to the whole device.
+	 * @param numBlocks The number of device blocks in the range.
+	 * @return False if the range reaches past the end of the device.
+	 */
+	bool ToWholeDevice(BlockDevice *&device, ulong &address, ulong numBlocks);
+
+	/**
+	 * Checks if a buffer holds blocks of a device, which can be a partition of the buffer's device.
+	 * @param device The device, NULL matches every buffer.
+	 */
+	bool OnDevice(BlockDevice *device, Buffer *buffer);
+
+	/**
+	 * Finds a buffer in the hash table, the caller must have interrupts disabled.
+	 */
+	Buffer *Lookup(BlockDevice *device, ulong address, int blockCount);
+
+	/**
+	 * Finds a buffer that shares blocks with [address, address + numBlocks) but isn't one of the
+	 * blocksPerBuffer sized buffers starting at address, the caller must have interrupts disabled.
+	 */
+	Buffer *FindOverlap(BlockDevice *device, ulong address, ulong numBlocks, int blocksPerBuffer);
+
+	/**
+	 * Writes back and drops the buffers FindOverlap finds, waiting for anyone holding them.
+	 * @return Zero on success or the negative errno from a write.
+	 */
+	int EvictOverlaps(BlockDevice *device, ulong address, ulong numBlocks, int blocksPerBuffer);
+
+	/**
+	 * Finds a buffer or adds an empty one, either way it is held and moved to the front of the LRU list.
+	 * A new buffer isn't valid until someone fills it in.
+	 */
+	Buffer *Acquire(BlockDevice *device, ulong address, int blockCount);
+
+	/**
+	 * Makes a buffer that isn't linked into the cache yet, it is held once.
+	 */
+	Buffer *NewBuffer(BlockDevice *device, ulong address, int blockCount);
+
+	/**
+	 * Links a new buffer into the hash table and LRU list, the caller must have interrupts disabled.
+	 */
+	void Insert(Buffer *buffer);
+
+	/**
+	 * A readahead request and the buffers it fills.
+	 */
+	struct ReadAheadRequest
+	{
+		BlockRequest	request;			///< The request given to the device
+		Buffer		*buffers[MAX_READAHEAD_BLOCKS];	///< The buffers in address order, all held
+		int		count;				///< The number of buffers
+		uchar		*bounce;			///< Where the device reads to when there is more than one buffer
+	};
+
+	/**
+	 * Sends a readahead request to the device.
+	 */
+	void SubmitReadAhead(ReadAheadRequest *readAhead);
+
+	/**
+	 * Called by the device when a readahead request finishes, fills in and releases the buffers.
+	 */
+	static void ReadAheadDone(BlockRequest *request);
+
+	/**
+	 * Takes a buffer out of the hash table and LRU list, the caller must have interrupts disabled.
+	 */
+	void Unlink(Buffer *buffer);
+
+	/**
+	 * Moves a buffer to the front of the LRU list, the caller must have interrupts disabled.
+	 */
+	void Touch(Buffer *buffer);
+
+	/**
+	 * Writes a held buffer to the device if it is dirty.
+	 * @return The return from the device write, zero if it was clean.
+	 */
+	int WriteBack(Buffer *buffer);
+
+	/**
+	 * Writes dirty buffers, each along with the dirty buffers next to it on the device.
+	 * @param device Only write buffers for this device, NULL for all of them.
+	 * @param all True to write every dirty buffer, otherwise only ones older than DIRTY_AGE
+	 * unless too much of the cache is dirty.
+	 * @return Zero on success or the first negative errno.
+	 */
+	int WriteDirty(BlockDevice *device, bool all);
+
+	/**
+	 * Holds a run of dirty buffers that are next to each other on the device, the caller
+	 * must have interrupts disabled.
+	 * @param buffer A dirty buffer in the run.
+	 * @param run Filled in with the buffers in address order.
+	 * @return The number of buffers in the run.
+	 */
+	int HoldDirtyRun(Buffer *buffer, Buffer *run[]);
+
+	/**
+	 * Clears the dirty flag, the caller must have interrupts disabled.
+	 */
+	void ClearDirty(Buffer *buffer);
+
+	/**
+	 * The flusher thread, it waits for the clock or memory pressure to wake it.
+	 */
+	static void Flusher(void *arg);
+
+	/**
+	 * Called from the clock interrupt every second to wake the flusher.
+	 */
+	static void Tick();
+
+	/**
+	 * Wakes the flusher if it is running and asleep.
+	 */
+	void WakeFlusher();
+
+	/**
+	 * Evicts unheld buffers from the end of the LRU list until the memory used is under the limit.
+	 */
+	void Shrink();
+
+	/**
+	 * Frees a buffer that is no longer linked.
+	 */
+	void Free(Buffer *buffer);
+
+	inline uint Hash(BlockDevice *device, ulong address)
+	{ return((address ^ (reinterpret_cast<ulong>(device) >> 4)) % NUM_BUCKETS); }
+
+	Buffer	*buckets[NUM_BUCKETS];	///< The hash table, chained through Buffer::hashNext
+	Buffer	*lruHead;		///< The most recently used buffer
+	Buffer	*lruTail;		///< The least recently used buffer
+	ulong	usedMemory;		///< The bytes of data in all the buffers
+	ulong	dirtyMemory;		///< The bytes of data in dirty buffers
+	ulong	maxMemory;		///< The limit for usedMemory
+	int	largestBuffer;		///< The most device blocks in a buffer so far, how far back an overlap can start
+
+	Semaphore	flushSignal;	///< Signaled to wake the flusher
+	bool		flusherRunning;	///< True once StartFlusher has made the thread
+};
+
+
+#endif // BufferCache.h
@@ -34,6 +34,8 @@
 class ClockDriver : public Driver, public Singleton<ClockDriver>
 {
 public:
+	ClockDriver();
+	
 	int Startup();
 	int IRQSignaled(Registers *regs);	// this should be overloaded like Handle is for interrupts
 	int Shutdown();
@@ -41,10 +43,23 @@ public:
 	inline seconds_t GetTimeInSeconds() { return(seconds); }
 	void GetTime(uchar &sec, uchar &min, uchar &hour, uchar &dom, uchar &month, uint &year);
 	
+	/**
+	 * Adds a function to be called from the clock interrupt once a second.
+	 * The function runs with interrupts disabled, so it should only signal someone.
+	 * @param callback The function to call.
+	 * @return Zero on success, or -1 if there is no room left.
+	 */
+	int AddSecondCallback(void (*callback)());
+	
 private:
 	ulong		ticks;	// CLOCK_RATE ticks = 1 second
 	seconds_t	seconds;	
 	
+	static const int	MAX_SECOND_CALLBACKS = 4;
+	
+	void		(*secondCallbacks[MAX_SECOND_CALLBACKS])();	///< Called every second
+	int		numSecondCallbacks;	///< The number of entries used in secondCallbacks
+	
 	//
 	// These are all for the PIT clock
 	//
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+
+/** @file DentryCache.h
+ *
+ */
+
+#ifndef DENTRYCACHE_H
+#define DENTRYCACHE_H
+
+
+#include <constants.h>
+#include <types.h>
+#include <Singleton.h>
+
+class FileSystemBase;
+
+/** @struct Dentry
+ *
+ * @brief One cached name in a directory.
+ *
+ **/
+struct Dentry
+{
+	FileSystemBase	*fileSystem;	///< The file system the directory is on
+	ulong		parent;		///< The inode of the directory
+	ulong		inode;		///< The inode the name points to, zero if the name doesn't exist
+	uint		nameLength;	///< The length of name
+	char		name[32];	///< The name, not NULL terminated, DentryCache::MAX_NAME_LENGTH long
+
+	Dentry		*hashNext;	///< The next entry in the same hash bucket, or the next free entry
+	Dentry		*lruPrev;	///< The next more recently used entry
+	Dentry		*lruNext;	///< The next less recently used entry
+};
+
+/** @class DentryCache
+ *
+ * @brief Caches the results of looking up names in directories for all file systems.
+ *
+ * Entries are found by (file system, parent inode, name) through a hash table. Names
+ * that weren't found are cached too, with an inode of zero, so looking for something
+ * that isn't there doesn't go to the disk again.
+ *
+ * The entries come from a fixed pool, when it runs out the least recently used entry
+ * is reused. Names longer than MAX_NAME_LENGTH aren't cached.
+ *
+ **/
+class DentryCache : public Singleton<DentryCache>
+{
+public:
+	DentryCache();
+
+	/**
+	 * Finds a name in the cache.
+	 * @param fileSystem The file system the directory is on.
+	 * @param parent The inode of the directory.
+	 * @param name The name, it isn't NULL terminated.
+	 * @param nameLength The length of name.
+	 * @param inode Set to the inode the name points to, zero if it is known not to exist.
+	 * @return True if the name was in the cache.
+	 */
+	bool Find(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength, ulong &inode);
+
+	/**
+	 * Adds a name to the cache, or updates it if it is already there.
+	 * @param fileSystem The file system the directory is on.
+	 * @param parent The inode of the directory.
+	 * @param name The name, it isn't NULL terminated.
+	 * @param nameLength The length of name.
+	 * @param inode The inode the name points to, zero if it doesn't exist.
+	 */
+	void Add(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength, ulong inode);
+
+	/**
+	 * Drops a name from the cache, call it when a name is created, removed or renamed.
+	 * @param fileSystem The file system the directory is on.
+	 * @param parent The inode of the directory.
+	 * @param name The name, it isn't NULL terminated.
+	 * @param nameLength The length of name.
+	 */
+	void Remove(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength);
+
+	/**
+	 * Drops every entry for a file system.
+	 * @param fileSystem The file system that is going away.
+	 */
+	void Purge(FileSystemBase *fileSystem);
+
+	static const uint	NUM_DENTRIES = 1024;	///< The number of entries in the pool
+	static const uint	NUM_BUCKETS = 256;	///< The size of the hash table
+	static const uint	MAX_NAME_LENGTH = 32;	///< The longest name that is cached
+
+private:
+	/**
+	 * Finds an entry in the hash table, the caller must have interrupts disabled.
+	 */
+	Dentry *Lookup(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength, uint bucket);
+
+	/**
+	 * Takes an entry out of the hash table and LRU list, the caller must have interrupts disabled.
+	 */
+	void Unlink(Dentry *dentry);
+
+	/**
+	 * Moves an entry to the front of the LRU list, the caller must have interrupts disabled.
+	 */
+	void Touch(Dentry *dentry);
+
+	/**
+	 * Hashes the key with FNV-1a.
+	 */
+	uint Hash(FileSystemBase *fileSystem, ulong parent, const char *name, uint nameLength);
+
+	Dentry	entries[NUM_DENTRIES];	///< The pool of entries
+	Dentry	*buckets[NUM_BUCKETS];	///< The hash table, chained through Dentry::hashNext
+	Dentry	*freeList;		///< Entries that aren't in use, chained through Dentry::hashNext
+	Dentry	*lruHead;		///< The most recently used entry
+	Dentry	*lruTail;		///< The least recently used entry
+};
+
+
+#endif // DentryCache.h
@@ -20,6 +20,8 @@
 #ifndef DEVICES_H
 #define DEVICES_H
 
+#include <BlockRequestQueue.h>
+
 /**
  * @class Device This is the base class all devices are derived from.
  */
@@ -37,6 +39,37 @@ public:
 	virtual int ReadBlocks(ulong address, int blockCount, void *dest) = 0;
 	virtual int WriteBlocks(ulong address, int blockCount, void *src) = 0;
 	virtual ulong GetBlockSize() = 0;
+	virtual ulong GetBlockCount() { return(0); }	///< The number of blocks on the device, zero if unknown
+	virtual int Flush() { return(0); }	///< Writes any cached data out to the media
+	
+	/**
+	 * Returns the device that holds this one's blocks, a partition returns its whole disk.
+	 * The buffer cache keys blocks by this device, so every name for a block shares one buffer.
+	 */
+	virtual BlockDevice *GetWholeDevice() { return(this); }
+	
+	/// Returns the address on GetWholeDevice of this device's first block
+	virtual ulong GetWholeDeviceOffset() { return(0); }
+	
+	/// Returns true if SubmitRequest queues the request instead of doing it before it returns
+	virtual bool CanQueue() { return(false); }
+	
+	/**
+	 * Starts a read or write without waiting for it, Done is called when it finishes.
+	 * Devices that can't queue requests do it right away.
+	 * @param request The request, it must stay around until Done is called.
+	 */
+	virtual void SubmitRequest(BlockRequest *request)
+	{
+		if(request->write)
+			request->result = WriteBlocks(request->address, request->blockCount, request->buff);
+		else
+			request->result = ReadBlocks(request->address, request->blockCount, request->buff);
+		
+		if(request->Done != NULL)
+			request->Done(request);
+	}
+	
 	virtual ~BlockDevice() { ; }
 };
 
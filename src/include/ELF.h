@@ -57,6 +57,7 @@ public:
 			tmpInfo.addr = theProgHeaders[i].vaddr;
 			tmpInfo.size = theProgHeaders[i].memsz;
 			tmpInfo.offset = theProgHeaders[i].offset;
+			tmpInfo.fileSize = theProgHeaders[i].filesz;
 			
 			theList.push_back(tmpInfo);
 		}
@@ -64,6 +65,7 @@ public:
 
 	inline static int GetFileHeaderSize() { return sizeof(FileHeader); }
 	inline int GetProgramHeadersSize() { return sizeof(ProgramHeader) * theFileHeader.phCount; }
+	inline ulong GetProgramHeadersOffset() { return theFileHeader.phOffset; }
 	inline ulong GetProcessEntryPoint() { return theFileHeader.addr; }
 
 	
@@ -72,6 +74,7 @@ public:
 		ulong addr;
 		ulong size;
 		ulong offset;	
+		ulong fileSize;
 	};
 	
 	//
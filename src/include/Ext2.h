@@ -37,6 +37,7 @@
 
 #include <ATADriver.h>
 #include <FileSystemBase.h>
+#include <Semaphore.h>
 
 #endif
 
@@ -49,9 +50,9 @@ using k_std::string;
  *
  * @brief A port of the ext2 file system for MOOOSE.
  * 
- * This file system works with Linux, but is extremely inefficient. The allocation scheme is a first-free scheme instead
- * of the 8-block scheme used in Linux. There are no buffer pools so it is extremely memory intensive. For example reading
- * a 1MB file from the disk requires about 1,000 malloc and free calls. Much can be done to improve the speed.
+ * This file system works with Linux. New blocks are allocated as close as possible to the file's previous block. The
+ * block bitmaps are cached in memory once they are first read, and the super block's free counts are only written out
+ * by Sync and when the file system is unmounted.
  *
  **/
 
@@ -65,6 +66,17 @@ public:
 	 */
 	ext2(BlockDevice *theDrive, ulong baseAddress = 0);
 	
+	/**
+	 * Writes the super block's free counts and frees the inode cache.
+	 */
+	~ext2();
+	
+	/**
+	 * Writes the super block's free counts, then the dirty blocks.
+	 * @return Zero on success or a negative errno.
+	 */
+	int Sync();
+	
 	/**
 	 * Creates a file descriptor for the ext2 file system.
 	 * @return A file descriptor for the ext2 file system.
@@ -87,6 +99,30 @@ public:
 	 */
 	int Open(FileDescriptorBase *fileDescriptor, const string &fileName, const int flags);
 	
+	/**
+	 * Returns the root directory's inode.
+	 */
+	ulong GetRootInode()
+	{ return(ROOT_INODE); }
+	
+	/**
+	 * Finds a name in a directory.
+	 * @param dirInode The inode of the directory.
+	 * @param name The name to find, it isn't NULL terminated.
+	 * @param nameLength The length of name.
+	 * @return The inode number or a negative errno.
+	 */
+	int Lookup(ulong dirInode, const char *name, uint nameLength);
+	
+	/**
+	 * Opens a file by its inode number.
+	 * @param fileDescriptor The descriptor to fill in.
+	 * @param inode The inode number of the file.
+	 * @param flags The flags used to open the file.
+	 * @return Zero on success or an error code.
+	 */
+	int OpenInode(FileDescriptorBase *fileDescriptor, ulong inode, const int flags);
+	
 	/**
 	 * Used to read data from a file on the file system.
 	 * @param fileDescriptor An index into the descriptor table for this file.
@@ -105,6 +141,26 @@ public:
 	 */
 	int Write(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes);
 	
+	/**
+	 * Reads from a position in a file, whole blocks are read straight into buff.
+	 * @param fileDescriptor An index into the descriptor table for this file.
+	 * @param buff A pointer to memory where the data should be sent.
+	 * @param numBytes The number of bytes to read.
+	 * @param position The offset in the file to read from, the descriptor's position doesn't move.
+	 * @return The number of bytes read or an error code.
+	 */
+	int ReadAt(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes, uint position);
+	
+	/**
+	 * Writes to a position in a file, growing the file if it goes past the end.
+	 * @param fileDescriptor An index into the descriptor table for this file.
+	 * @param buff A pointer to memory where the data should be read from.
+	 * @param numBytes The number of bytes to write.
+	 * @param position The offset in the file to write to, the descriptor's position doesn't move.
+	 * @return The number of bytes written or an error code.
+	 */
+	int WriteAt(FileDescriptorBase *fileDescriptor, void *buff, uint numBytes, uint position);
+	
 	/**
 	 * Used to seek inside a file.
 	 * @param fileDescriptor An index into the descriptor table for this file.
@@ -139,12 +195,7 @@ public:
 	 * @param buffer A pointer to a stat structure.
 	 * @return Zero on success and negative on error.
 	 */
-	int FileStat(FileDescriptorBase* fileDescriptor, stat *buff)
-	{
-		(void)fileDescriptor;
-		(void)buff;
-		return(0);
-	}
+	int FileStat(FileDescriptorBase* fileDescriptor, stat *buff);
 	
 	/**
 	 * Stats a symbolic link.
@@ -192,9 +243,31 @@ private:
 	static const int	DOUBLE_INDIRECT_BLOCK_PTR  = INDIRECT_BLOCK_PTR + 1;	///< The pointer to the double indirect block (13)
 	static const int	TRIPPLE_INDIRECT_BLOCK_PTR = DOUBLE_INDIRECT_BLOCK_PTR + 1; ///< The pointer to the tripple indirect block (14)
 	
+	static const uint	MIN_READAHEAD_WINDOW = 4;	///< Blocks read ahead once a file is read sequentially
+	static const uint	MAX_READAHEAD_WINDOW = 64;	///< The window doubles each time up to this
+	
+	static const uint	NUM_INODE_BUCKETS = 256;	///< The size of the inode cache's hash table
+	static const uint	MAX_CACHED_INODES = 512;	///< Unused inodes are dropped past this
+	static const uint	MAX_MAP_EXTENTS = 1024;	///< An inode's block map is started over past this
+	static const uint	PREALLOC_BLOCKS = 8;	///< The blocks reserved for a file each time it runs out
+	static const ulong	SUPER_BLOCK_OFFSET = 1024;	///< Where the super block starts, in bytes
+	static const ulong	SUPER_BLOCK_SIZE = 1024;	///< The size of the super block on the disk
+	
 	static const ulong	DIR_FILE_MODE = 0x4000;
 	static const ulong	FILE_FILE_MODE = 0x8000;
 	
+	static const ulong	FEATURE_COMPAT_DIR_INDEX = 0x0020;	///< Directories can have an htree index
+	static const ulong	INDEX_FILE_FLAG = 0x1000;	///< This directory has an htree index
+	static const ulong	UNSIGNED_HASH_FLAG = 0x0002;	///< The htree hashes were made with unsigned chars
+	static const ulong	DX_BLOCK_MASK = 0x0FFFFFFF;	///< The bits of an index entry's block that are the block
+	static const int	MAX_HTREE_LEVELS = 2;		///< The root and one level of index nodes
+	
+	/**
+	 * The hashes an htree index can use, the unsigned ones are picked by the super block flags.
+	 */
+	enum { DX_HASH_LEGACY, DX_HASH_HALF_MD4, DX_HASH_TEA,
+	       DX_HASH_LEGACY_UNSIGNED, DX_HASH_HALF_MD4_UNSIGNED, DX_HASH_TEA_UNSIGNED };
+	
 	//
 	// On disk structures
 	//
@@ -238,6 +311,57 @@ private:
 		char    volume_name[16];	///< volume name 
 		char    last_mounted[64];	///< directory where last mounted 
 		ulong	algorithm_usage_bitmap;	///< For compression 
+		uchar	preallocBlocks;		///< Blocks to try to preallocate
+		uchar	preallocDirBlocks;	///< Blocks to preallocate for directories
+		ushort	padding1;
+		uchar	journalUUID[16];	///< uuid of the journal super block
+		ulong	journalInode;		///< inode number of the journal file
+		ulong	journalDevice;		///< device number of the journal file
+		ulong	lastOrphan;		///< start of the list of inodes to delete
+		ulong	hashSeed[4];		///< htree hash seed
+		uchar	defaultHashVersion;	///< Default htree hash version
+		uchar	journalBackupType;
+		ushort	descriptorSize;
+		ulong	defaultMountOptions;
+		ulong	firstMetaBlockGroup;
+		ulong	mkfsTime;		///< When the file system was created
+		ulong	journalBlocks[17];	///< Backup of the journal inode
+		ulong	blockCountHigh;
+		ulong	reservedBlockCountHigh;
+		ulong	freeBlockCountHigh;
+		ushort	minExtraInodeSize;
+		ushort	wantExtraInodeSize;
+		ulong	flags;			///< Miscellaneous flags, like how htree names are hashed
+	} __attribute__((packed));
+	
+	/**
+	 * The header of an htree index in the first block of a directory, after the "." and ".." entries.
+	 */
+	struct DXRootInfo
+	{
+		ulong	reservedZero;
+		uchar	hashVersion;		///< The hash used for the directory
+		uchar	infoLength;		///< The size of this structure, 8
+		uchar	indirectLevels;		///< The levels of index nodes under the root
+		uchar	unusedFlags;
+	} __attribute__((packed));
+	
+	/**
+	 * An entry in an htree index node.
+	 */
+	struct DXEntry
+	{
+		ulong	hash;			///< The lowest hash in the block, the first entry has DXCountLimit here instead
+		ulong	block;			///< The block of the directory with the names or the next index node
+	} __attribute__((packed));
+	
+	/**
+	 * Overlays the hash of the first entry in an index node.
+	 */
+	struct DXCountLimit
+	{
+		ushort	limit;			///< The most entries that fit in the node
+		ushort	count;			///< The number of entries used
 	} __attribute__((packed));
 	
 	/**
@@ -280,6 +404,43 @@ private:
 		ulong	reserved2;
 	} __attribute__((packed));
 
+	/**
+	 * A run of a file's blocks that are next to each other on the disk.
+	 */
+	struct BlockExtent
+	{
+		ulong	logical;	///< The first block of the file in the run
+		ulong	physical;	///< Where that block is on the disk, zero for a hole
+		ulong	count;		///< The number of blocks in the run
+	};
+	
+	/**
+	 * An inode in the inode cache.
+	 * 
+	 * Every open file holds its inode, so all the descriptors for a file share one copy.
+	 * Blocks found through the indirect blocks are remembered in blockMap, so each
+	 * indirect block is only read once while the inode is cached.
+	 */
+	struct CachedInode : public Inode
+	{
+		ulong		number;		///< The inode number
+		uint		refCount;	///< The number of holders, it can't be dropped while this isn't zero
+		bool		dirty;		///< True if it needs to be written to the disk
+		
+		vector<BlockExtent>	blockMap;	///< Extents past the direct blocks sorted by logical, filled in as they are used
+		uint		blockMapHint;	///< The extent last looked up, where a sequential reader looks next
+		Semaphore	mapLock;	///< Held while blockMap is searched or filled in
+		
+		ulong		preallocStart;	///< The next reserved block the file's next block will use
+		ulong		preallocCount;	///< The number of reserved blocks left, they're marked used on the disk
+		
+		CachedInode	*hashNext;	///< The next inode in the same hash bucket
+		CachedInode	*lruPrev;	///< The next more recently used inode
+		CachedInode	*lruNext;	///< The next less recently used inode
+		
+		CachedInode() : blockMapHint(0), mapLock(1), preallocStart(0), preallocCount(0) { ; }
+	};
+	
 	/**
 	 * The structure of a group descriptor on the disk.
 	 */
@@ -302,16 +463,18 @@ private:
 	{
 		friend class ext2;
 	public:
-		FileDescriptor(FileSystemBase *ptr) : FileDescriptorBase(ptr)
+		FileDescriptor(FileSystemBase *ptr) : FileDescriptorBase(ptr), fileInode(NULL), blockData(NULL)
 		{ ; }
 			
 	private:
-		Inode	fileInode;	///< The inode for the file
+		CachedInode	*fileInode;	///< The inode for the file, held while it is open
 		uint	inodeNumber;	///< The number of the inode
 		uint	filePosition;	///< Where we are in the file
 		uint	blockPosition;	///< Where we are in the block
 		uint	blockNumber;	///< Which block of the file is loaded into blockData
 		uchar	*blockData;	///< Where the current block is stored in memory
+		uint	readAheadStart;	///< The first block of the file that hasn't been read ahead
+		uint	readAheadWindow;	///< The number of blocks last read ahead, zero after a seek
 	};
 	
 	struct DirDescriptor
@@ -322,10 +485,22 @@ private:
 	vector<DirDescriptor>	theDirDescriptors;	///< A vector of directory descriptors
 	vector<GroupDescriptor>	theGroupDescriptors;	///< A vector of group descriptors
 	
+	CachedInode	*inodeBuckets[NUM_INODE_BUCKETS];	///< The inode cache, chained through CachedInode::hashNext
+	CachedInode	*inodeLRUHead;		///< The most recently used cached inode
+	CachedInode	*inodeLRUTail;		///< The least recently used cached inode
+	uint		numCachedInodes;	///< The number of inodes in the cache
+	
 	SuperBlock	theSuperBlock;	///< The in memory super block
 	ulong		lbaBaseAddress;	///< This is the base LBA of the files system on the disk
 	ulong		blockSize;	///< The size of a file system block
 	ulong		addrPerBlock;	///< The number of data block addresses per data block
+	ulong		inodeSize;	///< The size of an inode in the inode table, bigger than Inode on rev 1
+	
+	ulong		numGroups;		///< The number of block groups
+	ulong		groupDescriptorBlock;	///< The first block of the group descriptor table
+	vector<uchar*>	blockBitmaps;		///< Each group's block bitmap, NULL until it is first used
+	Semaphore	allocLock;		///< Held while the bitmaps and free counts change
+	bool		superBlockDirty;	///< The free counts changed since the super block was written
 	
 
 	//
@@ -341,19 +516,136 @@ private:
 	/**
 	 * Finds an inode number of a file in an inode
 	 * @param inode The inode to search for the given name (file or directory)
-	 * @param name The name of the item to search for.
-	 * @returns The number for the inode for the name.
+	 * @param name The name of the item to search for, it isn't NULL terminated.
+	 * @param nameLength The length of name.
+	 * @returns The number for the inode for the name, 0 if it isn't there, or -1 if it couldn't be read.
+	 */
+	int FindByNameInInode(ulong inode, const char *name, uint nameLength);
+	
+	/**
+	 * Finds a name by reading every block of a directory.
+	 * @return The inode for the name, 0 if it isn't there, or -1 on an error.
+	 */
+	int FindByNameLinear(CachedInode *dirInode, const char *name, uint nameLength);
+	
+	/**
+	 * Finds a name through a directory's htree index, only reading the blocks on the way to the name's hash.
+	 * @return The inode for the name, 0 if it isn't there, or -1 if the index can't be used.
+	 */
+	int FindByNameInHTree(CachedInode *dirInode, const char *name, uint nameLength);
+	
+	/**
+	 * Reads an htree index node below the root.
+	 * @param entry The index entry pointing to the node.
+	 * @param node Where to read the block.
+	 * @param entries Set to the entries in the node.
+	 * @param count Set to the number of entries.
+	 * @return False if the node couldn't be read or doesn't look right.
+	 */
+	bool ReadDXNode(CachedInode *dirInode, DXEntry *entry, uchar *node, DXEntry *&entries, uint &count);
+	
+	/**
+	 * Finds the last index entry with a hash at or below hash.
+	 * @return The index of the entry.
+	 */
+	uint FindDXEntry(DXEntry *entries, uint count, ulong hash);
+	
+	/**
+	 * Hashes a name the way the htree index does.
+	 * @param hashVersion One of the DX_HASH values.
+	 * @return The hash with the low bit clear.
 	 */
-	int FindByNameInInode(ulong inode, string name);
+	ulong DirHash(const char *name, uint nameLength, int hashVersion);
+	
+	/**
+	 * Looks for a name in one block of directory entries.
+	 * @return The inode for the name, 0 if it isn't there, or -1 if the block is bad.
+	 */
+	int SearchDirBlock(uchar *block, const char *name, uint nameLength);
+	
+	/**
+	 * Reads a block of a directory.
+	 * @param dirInode The directory.
+	 * @param blockNumber The block of the directory to read.
+	 * @param dest Where to put the block.
+	 * @return The return from the read, or -1 if the block isn't there.
+	 */
+	int ReadDirBlock(CachedInode *dirInode, ulong blockNumber, uchar *dest);
 
 	/**
-	 * Finds the address of a data block given a data block number and block pointers.
+	 * Finds the address of a data block given a data block number, through the inode's block map.
 	 * @param blockNumber The data block number who's address we want.
-	 * @param blockPointers The block pointers in the inode.
-	 * @return The address of the data block.
+	 * @param theInode The inode of the file.
+	 * @return The address of the data block, zero for a hole.
 	 */
-	ulong FindAddressByBlockNumber(ulong blockNumber, ulong blockPointers[]);
+	ulong FindAddressByBlockNumber(ulong blockNumber, CachedInode *theInode);
+	
+	/**
+	 * Finds a block in the inode's block map, the caller must hold mapLock.
+	 * @param addr Set to the address of the block, zero for a hole.
+	 * @return False if the block isn't in the map.
+	 */
+	bool LookupBlockMap(CachedInode *theInode, ulong blockNumber, ulong &addr);
+	
+	/**
+	 * Reads the indirect block that has a block's address and adds all of its addresses to
+	 * the inode's block map, the caller must hold mapLock.
+	 */
+	void FillBlockMap(CachedInode *theInode, ulong blockNumber);
+	
+	/**
+	 * Forgets the inode's block map, call it when the block pointers change.
+	 */
+	void ForgetBlockMap(CachedInode *theInode);
 
+	/**
+	 * Finds where an inode is in its group's inode table.
+	 * @param inode The inode number.
+	 * @param block Set to the file system block holding the inode.
+	 * @param offset Set to the byte offset of the inode in that block.
+	 */
+	void FindInodeLocation(ulong inode, ulong &block, ulong &offset);
+	
+	/**
+	 * Gets an inode from the inode cache, reading it from the disk if it isn't there, and holds it.
+	 * @param inode The inode number.
+	 * @return The held inode, or NULL if it couldn't be read.
+	 */
+	CachedInode *GetInode(ulong inode);
+	
+	/**
+	 * Lets go of an inode from GetInode. The last holder writes it to the disk if it is dirty.
+	 * @param cachedInode The inode to release.
+	 */
+	void PutInode(CachedInode *cachedInode);
+	
+	/**
+	 * Marks a held inode as changed so it is written out when it is released.
+	 * @param cachedInode The inode that was changed.
+	 */
+	inline void MarkInodeDirty(CachedInode *cachedInode)
+	{ cachedInode->dirty = true; }
+	
+	/**
+	 * Finds an inode in the cache, the caller must have interrupts disabled.
+	 */
+	CachedInode *LookupInode(ulong inode);
+	
+	/**
+	 * Moves a cached inode to the front of the LRU list, the caller must have interrupts disabled.
+	 */
+	void TouchInode(CachedInode *cachedInode);
+	
+	/**
+	 * Takes a cached inode out of the hash table and LRU list, the caller must have interrupts disabled.
+	 */
+	void UnlinkInode(CachedInode *cachedInode);
+	
+	/**
+	 * Drops unused inodes from the end of the LRU list until there are at most MAX_CACHED_INODES.
+	 */
+	void ShrinkInodeCache();
+	
 	/**
 	 * Reads an inode off the disk.
 	 * @param inode The inode number to read from disk.
@@ -365,11 +657,40 @@ private:
 	/**
 	 * Reads data blocks for a file from the disk.
 	 * @param blockNumber The data block number of the block to read.
-	 * @param blocksPointers The block pointers for the file.
+	 * @param theInode The inode for the file.
 	 * @param dest A pointer to memory to read the block into.
 	 * @returns The return value from the device read.
 	 */
-	int ReadDataBlock(ulong blockNumber, ulong blocksPointers[], uchar *dest);
+	int ReadDataBlock(ulong blockNumber, CachedInode *theInode, uchar *dest);
+	
+	/**
+	 * Reads a file's data blocks straight into dest, blocks that are next to each other
+	 * on the disk are read together.
+	 * @param blockNumber The data block number of the first block to read.
+	 * @param numBlocks The number of blocks to read.
+	 * @param theInode The inode for the file.
+	 * @param dest A pointer to memory to read the blocks into.
+	 * @returns The number of blocks read or an error code.
+	 */
+	int ReadDataBlocks(ulong blockNumber, ulong numBlocks, CachedInode *theInode, uchar *dest);
+	
+	/**
+	 * Makes sure the descriptor's blockData holds its current block. A file that was empty when
+	 * it was opened doesn't have blockData until it is first needed.
+	 * @param fd The file descriptor.
+	 * @returns The return value from the device read.
+	 */
+	int LoadBlockData(FileDescriptor *fd);
+
+	/**
+	 * Starts reading the blocks after the file's current block into the cache, if it is time.
+	 * 
+	 * Once the reader gets within half a window of the end of what was read ahead, the
+	 * next window is started and the window doubles. Blocks that are next to each other
+	 * on the disk are read with one request.
+	 * @param fd The file descriptor being read sequentially.
+	 */
+	void ReadAhead(FileDescriptor *fd);
 
 	/**
 	 * Writes an inode to the disk.
@@ -391,11 +712,85 @@ private:
 	/**
 	 * Allocates a new block for blockNumber near the other allocated blocks.
 	 * <b>This is where the allocated algorithm is implemented.</b>
+	 * The block goes right after the file's previous block if it is free, any indirect
+	 * blocks needed are allocated first so they sit just before the data.
 	 * @param blockNumber The data block number that needs a new block allocated for it.
-	 * @param fileInode The file's inode that needs to be updated.
-	 * @return The address of the newly allocated block.
+	 * @param fd The file descriptor whose inode needs to be updated.
+	 * @return The address of the newly allocated block, or zero if the file system is full.
 	 */
 	ulong AllocateNewDataBlock(ulong blockNumber, FileDescriptor *fd);
+	
+	/**
+	 * Picks where a file's block should go: after the file's previous block, or at the
+	 * start of the inode's group.
+	 */
+	ulong FindGoalBlock(CachedInode *theInode, ulong blockNumber);
+	
+	/**
+	 * Allocates an indirect block, fills it with zeros and counts it against the inode.
+	 * @return The address of the block, or zero if the file system is full.
+	 */
+	ulong AllocateIndirectBlock(CachedInode *theInode, ulong goal);
+	
+	/**
+	 * Allocates a block for a file out of its preallocation window. When goal isn't the window's
+	 * next block a new window of PREALLOC_BLOCKS is reserved at goal, so the bitmap is only
+	 * written once per window. The caller must hold mapLock.
+	 *
+	 * Blocks are reserved up front rather than allocated when they are flushed because the
+	 * buffer cache holds data by disk address, so Write has to map a block before its data
+	 * can go in the cache.
+	 * @return The block, or zero if the file system is full.
+	 */
+	ulong AllocateFileBlock(CachedInode *theInode, ulong goal);
+	
+	/**
+	 * Gives the blocks left in an inode's preallocation window back to the free pool.
+	 */
+	void DiscardPreallocation(CachedInode *theInode);
+	
+	/**
+	 * Allocates a run of free blocks starting as close after goal as possible.
+	 * @param goal The block we'd like.
+	 * @param count The number of blocks wanted, set to the number in the run.
+	 * @return The first block in the run, or zero if the file system is full.
+	 */
+	ulong AllocateBlocks(ulong goal, ulong &count);
+	
+	/**
+	 * Marks a run of blocks as free, the run can't cross a group.
+	 */
+	void FreeBlocks(ulong block, ulong count);
+	
+	/**
+	 * Returns a group's block bitmap, reading it in the first time, the caller must hold allocLock.
+	 * @return The bitmap or NULL if it couldn't be read.
+	 */
+	uchar *GetBitmap(ulong group);
+	
+	/**
+	 * Finds a clear bit in a bitmap a word at a time.
+	 * @param bitmap The bitmap to search.
+	 * @param start The first bit to look at.
+	 * @param numBits The number of bits in the bitmap.
+	 * @return The clear bit or -1 if there isn't one.
+	 */
+	long FindFreeBit(uchar *bitmap, ulong start, ulong numBits);
+	
+	/**
+	 * Writes a group's block bitmap and descriptor, the caller must hold allocLock.
+	 * The super block's free counts are left for WriteSuperBlock.
+	 */
+	void WriteGroup(ulong group);
+	
+	/**
+	 * Writes the super block's free counts if they changed.
+	 * @return Zero on success or a negative errno.
+	 */
+	int WriteSuperBlock();
+	
+	inline ulong GroupFirstBlock(ulong group)
+	{ return(theSuperBlock.firstDataBlock + group * theSuperBlock.blocksPerGroup); }
 
 	//
 	// Helper function (SHOULD BE SOME OTHER PLACE, utils/math.cpp maybe?)
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file FPUManager.h
+ *
+ */
+
+#ifndef FPUMANAGER_H
+#define FPUMANAGER_H
+
+
+#include <constants.h>
+#include <types.h>
+#include <Handler.h>
+#include <Singleton.h>
+
+/** @class FPUManager
+ *
+ * @brief Switches the x87/SSE state lazily, installed as the no coprocessor (#NM) handler.
+ *
+ * Whenever the scheduler switches away from the thread that owns the FPU registers CR0.TS
+ * is set. The first FPU or SSE instruction the new thread runs raises #NM, and only then is
+ * the owner's state saved and the new thread's state loaded. A thread that never touches
+ * the FPU never traps and never gets a save area.
+ *
+ * The handler can't allocate memory, so save areas come from a pool. Creating a thread
+ * only reserves an area, the pool grows STATES_PER_CHUNK areas at a time so there is
+ * always one free for every thread that hasn't used the FPU yet. The handler hands one
+ * out on the thread's first FPU instruction.
+ *
+ **/
+
+class FPUManager : public Handler, public Singleton<FPUManager>
+{
+public:
+	FPUManager();
+
+	/**
+	 * Turns on the FPU, and SSE if the CPU has it, and records the initial FPU state.
+	 * @return Zero on success.
+	 */
+	int Startup();
+
+	/**
+	 * Handles #NM by giving the FPU to the current thread.
+	 * @param regs The registers pushed by the interrupt.
+	 * @return Zero on success.
+	 */
+	int Handle(Registers *regs);
+
+	int Shutdown();
+
+	/**
+	 * Called by the scheduler when it switches to a new thread.
+	 * Traps the thread's first FPU instruction if it doesn't own the FPU registers.
+	 * @param newThread The thread that is about to run.
+	 */
+	inline void TaskSwitched(Thread *newThread)
+	{
+		if(newThread == owner)
+			asm __volatile__ ("clts");
+		else
+			SetTaskSwitched();
+	}
+
+	/**
+	 * Reserves a save area for a new thread, it is handed out on the thread's first FPU instruction.
+	 * @param theThread The thread being created.
+	 */
+	void CreateState(Thread *theThread);
+
+	/**
+	 * Copies the FPU state of one thread to another, used by fork.
+	 * @param from The thread to copy from.
+	 * @param to The thread to copy to, it must not have a save area yet.
+	 */
+	void CopyState(const Thread &from, Thread &to);
+
+	/**
+	 * Gives back a thread's save area and reservation, and forgets it if it owns the FPU.
+	 * @param theThread The thread being destroyed.
+	 */
+	void ReleaseState(Thread *theThread);
+
+	static const uint	FXSAVE_SIZE = 512;	///< Size of the FXSAVE area
+	static const uint	FSAVE_SIZE = 108;	///< Size of the FNSAVE area, used without FXSR
+	static const uint	STATE_ALIGN = 16;	///< FXSAVE needs a 16 byte aligned area
+	static const uint	STATES_PER_CHUNK = 8;	///< Save areas added to the pool at a time
+
+private:
+	/// Sets CR0.TS so the next FPU instruction raises #NM
+	void SetTaskSwitched();
+
+	/**
+	 * Reserves a save area in the pool, growing it if every area is spoken for.
+	 */
+	void Reserve();
+
+	/**
+	 * Takes a reserved save area out of the pool, safe to call from the handler.
+	 * @return The aligned save area.
+	 */
+	uchar *TakeState();
+
+	/// Saves the FPU registers to a save area
+	void Save(uchar *state);
+
+	/// Loads the FPU registers from a save area
+	void Restore(uchar *state);
+
+	Thread	*owner;		///< The thread whose state is in the FPU registers, or NULL
+	bool	useFXSave;	///< The CPU supports FXSAVE/FXRSTOR
+	uint	stateSize;	///< The size of a save area
+	uchar	*initialState;	///< A clean state, loaded on a thread's first FPU instruction
+	uchar	*freeStates;	///< The pool's free save areas, each holds a pointer to the next
+	uint	pooled;		///< The number of save areas in the pool, free or not
+	uint	reserved;	///< The number of threads that have reserved a save area
+
+	static const ulong	CR0_MP = 0x00000002;	///< Monitor coprocessor, WAIT honors TS
+	static const ulong	CR0_EM = 0x00000004;	///< Emulation, must be clear to use the FPU
+	static const ulong	CR0_TS = 0x00000008;	///< Task switched
+	static const ulong	CR0_NE = 0x00000020;	///< Report FPU errors as exceptions
+	static const ulong	CR4_OSFXSR = 0x00000200;	///< OS supports FXSAVE/FXRSTOR and SSE
+	static const ulong	CR4_OSXMMEXCPT = 0x00000400;	///< OS handles SSE exceptions
+	static const ulong	CPUID_FXSR = 0x01000000;	///< CPUID.1:EDX FXSAVE/FXRSTOR
+	static const ulong	CPUID_SSE = 0x02000000;		///< CPUID.1:EDX SSE
+	static const ulong	DEFAULT_MXCSR = 0x1F80;		///< All SSE exceptions masked
+};
+
+
+#endif // FPUManager.h
@@ -25,6 +25,7 @@
 #include <types.h>
 #include <string.h>
 #include <list.h>
+#include <errno.h>
 
 #ifdef UNIT_TEST
 
@@ -33,6 +34,7 @@
 #else
 
 #include <Devices.h>
+#include <BufferCache.h>
 #include <Debug.h>
 
 #endif
@@ -84,6 +86,15 @@ public:
 		uint	modifyTime;	///< time of last modification
 		uint	changeTime;	///< time of last status change
 	};
+	
+	/**
+	 * This is the POSIX conforming structure for readv and writev.
+	 */
+	struct iovec
+	{
+		void	*iov_base;	///< start of the buffer
+		uint	iov_len;	///< length of the buffer
+	};
 
 
 
@@ -128,7 +139,7 @@ public:
 	}
 	
 	/**
-	 * Reads blocks off the disk.
+	 * Reads blocks off the disk, through the buffer cache.
 	 * @param blockNumber The number of the first file system block to read.
 	 * @param numBlocks The number of file system blocks to read.
 	 * @param dest A pointer to memory to read the data into.
@@ -136,13 +147,53 @@ public:
 	 */
 	int ReadBlocks(ulong blockNumber, ulong numBlocks, uchar *dest)
 	{
+#ifdef UNIT_TEST
 		return device->ReadBlocks(offset + (blockNumber * blockMultiplier),
 					numBlocks * blockMultiplier,
 					dest);
+#else
+		return BufferCache::GetInstance().Read(device,
+						       offset + (blockNumber * blockMultiplier),
+						       blockMultiplier,
+						       numBlocks,
+						       dest);
+#endif
+	}
+
+	/**
+	 * Returns true if ReadAheadBlocks can start reads without waiting for them.
+	 * A device that can't queue would do the read ahead right away, slowing down the read that asked.
+	 */
+	bool CanReadAhead()
+	{
+#ifdef UNIT_TEST
+		return(false);
+#else
+		return(device->CanQueue());
+#endif
+	}
+
+	/**
+	 * Starts reading blocks into the buffer cache without waiting for them.
+	 * @param blockNumber The number of the first file system block to read.
+	 * @param numBlocks The number of file system blocks to read.
+	 */
+	void ReadAheadBlocks(ulong blockNumber, ulong numBlocks)
+	{
+#ifdef UNIT_TEST
+		(void)blockNumber;
+		(void)numBlocks;
+#else
+		BufferCache::GetInstance().ReadAhead(device,
+						     offset + (blockNumber * blockMultiplier),
+						     blockMultiplier,
+						     numBlocks);
+#endif
 	}
 
 	/**
-	 * Writes blocks to the disk.
+	 * Writes blocks to the disk, through the buffer cache.
+	 * The blocks are only marked dirty, call Sync to get them on the disk.
 	 * @param blockNumber The number of the first file system block to write.
 	 * @param numBlocks The number of file system blocks to write.
 	 * @param src A pointer to memory to write the data from.
@@ -150,9 +201,36 @@ public:
 	 */
 	int WriteBlocks(ulong blockNumber, ulong numBlocks, uchar *src)
 	{
+#ifdef UNIT_TEST
 		return device->WriteBlocks(offset + (blockNumber * blockMultiplier),
 					 numBlocks * blockMultiplier,
 					 src);
+#else
+		return BufferCache::GetInstance().Write(device,
+							offset + (blockNumber * blockMultiplier),
+							blockMultiplier,
+							numBlocks,
+							src);
+#endif
+	}
+
+	/**
+	 * Writes any of the file system's dirty blocks to the disk and flushes the disk's cache.
+	 * File systems that keep metadata in memory write it out first, then call this.
+	 * @returns Zero on success or a negative errno.
+	 */
+	virtual int Sync()
+	{
+#ifdef UNIT_TEST
+		return(0);
+#else
+		int ret = BufferCache::GetInstance().Sync(device);
+		
+		if(ret < 0)
+			return(ret);
+		
+		return device->Flush();
+#endif
 	}
 
 	//
@@ -167,8 +245,92 @@ public:
 	virtual int FileStat(FileDescriptorBase* fileDescriptor, stat *buff) = 0;
 	virtual int LinkStat(string path, stat *buffer) = 0;
 	
+	/**
+	 * Reads from a position in a file without moving the descriptor's file position.
+	 * File systems should replace this, it seeks there and back.
+	 * @param fileDescriptor The descriptor of the open file.
+	 * @param buff Where to read the data into.
+	 * @param numBytes The number of bytes to read.
+	 * @param position The offset in the file to read from.
+	 * @return The number of bytes read or an error code.
+	 */
+	virtual int ReadAt(FileDescriptorBase* fileDescriptor, void *buff, uint numBytes, uint position)
+	{
+		int	oldPosition = Seek(fileDescriptor, 0, SEEK_CUR);
+		int	ret = oldPosition;
+		
+		if(ret >= 0 && (ret = Seek(fileDescriptor, position, SEEK_SET)) >= 0)
+			ret = Read(fileDescriptor, buff, numBytes);
+		
+		if(oldPosition >= 0)
+			Seek(fileDescriptor, oldPosition, SEEK_SET);
+		
+		return(ret);
+	}
+	
+	/**
+	 * Writes to a position in a file without moving the descriptor's file position.
+	 * File systems should replace this, it seeks there and back.
+	 * @param fileDescriptor The descriptor of the open file.
+	 * @param buff Where to write the data from.
+	 * @param numBytes The number of bytes to write.
+	 * @param position The offset in the file to write to.
+	 * @return The number of bytes written or an error code.
+	 */
+	virtual int WriteAt(FileDescriptorBase* fileDescriptor, void *buff, uint numBytes, uint position)
+	{
+		int	oldPosition = Seek(fileDescriptor, 0, SEEK_CUR);
+		int	ret = oldPosition;
+		
+		// Seek stops at the end of the file, so this can't write past it
+		if(ret >= 0 && (ret = Seek(fileDescriptor, position, SEEK_SET)) >= 0)
+			ret = ret == int(position) ? Write(fileDescriptor, buff, numBytes) : -1 * EINVAL;
+		
+		if(oldPosition >= 0)
+			Seek(fileDescriptor, oldPosition, SEEK_SET);
+		
+		return(ret);
+	}
+	
+	//
+	// path lookup, used with the dentry cache so a path can be walked without the file system
+	//
+	
+	/**
+	 * Returns the inode number of the file system's root directory.
+	 * @return The root inode, zero if the file system doesn't do Lookup.
+	 */
+	virtual ulong GetRootInode()
+	{ return(0); }
+	
+	/**
+	 * Finds a name in a directory.
+	 * @param dirInode The inode of the directory to search.
+	 * @param name The name to find, it isn't NULL terminated.
+	 * @param nameLength The length of name.
+	 * @return The inode number, -ENOENT if the name isn't there, -ENOSYS if the file system
+	 * can't look up names, or another negative errno.
+	 */
+	virtual int Lookup(ulong dirInode, const char *name, uint nameLength)
+	{ (void)dirInode; (void)name; (void)nameLength; return(-1 * ENOSYS); }
+	
+	/**
+	 * Opens a file that was found with Lookup.
+	 * @param fileDescriptor The descriptor to fill in.
+	 * @param inode The inode number of the file.
+	 * @param flags The flags used to open the file.
+	 * @return Zero on success or an error code.
+	 */
+	virtual int OpenInode(FileDescriptorBase *fileDescriptor, ulong inode, const int flags)
+	{ (void)fileDescriptor; (void)inode; (void)flags; return(-1 * ENOSYS); }
+	
 	virtual ~FileSystemBase()
 	{
+#ifndef UNIT_TEST
+		// get our blocks on the disk and out of the cache before the device goes away
+		Sync();
+		BufferCache::GetInstance().Invalidate(device);
+#endif
 		delete device;
 	}
 	
@@ -24,6 +24,7 @@
 #include <types.h>
 #include <string.h>
 #include <map.h>
+#include <vector.h>
 #include <syscalls.h>
 
 #ifdef UNIT_TEST
@@ -43,6 +44,7 @@
 using k_std::string;
 using k_std::map;
 using k_std::pair;
+using k_std::vector;
 
 /** @class FileSystemManager
  *
@@ -140,12 +142,65 @@ public:
 	 */
 	static int Seek(int fileDescriptor, int offset, int whence);
 	
+	/**
+	 * Reads from a position in a file without moving the file position. (SYSCALL_pread)
+	 * @param fileDescriptor The file descriptor for the open file.
+	 * @param buff The buffer to read the data into.
+	 * @param numBytes The number of bytes to read.
+	 * @param position The offset in the file to read from.
+	 * @return The number of bytes read or an error.
+	 */
+	static int ReadAt(int fileDescriptor, void *buff, uint numBytes, int position);
+	
+	/**
+	 * Writes to a position in a file without moving the file position. (SYSCALL_pwrite)
+	 * @param fileDescriptor The file descriptor for the open file.
+	 * @param buff The buffer to write the data from.
+	 * @param numBytes The number of bytes to write.
+	 * @param position The offset in the file to write to.
+	 * @return The number of bytes written or an error.
+	 */
+	static int WriteAt(int fileDescriptor, void *buff, uint numBytes, int position);
+	
+	/**
+	 * Reads from a file into several buffers, filling each before the next. (SYSCALL_readv)
+	 * @param fileDescriptor The file descriptor for the open file.
+	 * @param vector The buffers to read into.
+	 * @param count The number of buffers in vector.
+	 * @return The total number of bytes read or an error.
+	 */
+	static int ReadVector(int fileDescriptor, const FileSystemBase::iovec *vector, int count);
+	
+	/**
+	 * Writes several buffers to a file one after the other. (SYSCALL_writev)
+	 * @param fileDescriptor The file descriptor for the open file.
+	 * @param vector The buffers to write.
+	 * @param count The number of buffers in vector.
+	 * @return The total number of bytes written or an error.
+	 */
+	static int WriteVector(int fileDescriptor, const FileSystemBase::iovec *vector, int count);
+	
 	/**
 	 * Closes an open file. (SYSCALL_close)
 	 * @param fileDescriptor The file descriptor for the open file.
 	 */
 	static void Close(int fileDescriptor);
 	
+	/**
+	 * Writes every mounted file system's dirty blocks to disk. (SYSCALL_sync)
+	 * @return Zero on success or the first error.
+	 */
+	static int Sync();
+	
+	/**
+	 * Writes an open file's dirty blocks to disk. (SYSCALL_fsync)
+	 * The buffer cache doesn't know which blocks belong to which file, so this
+	 * writes everything for the file's file system.
+	 * @param fileDescriptor The file descriptor for the open file.
+	 * @return Zero on success or an error.
+	 */
+	static int FileSync(int fileDescriptor);
+	
 	/**
 	 * Closes an open file.
 	 * This function is for internal use only.
@@ -154,21 +209,79 @@ public:
 	void kClose(FileDescriptorBase *fd);
 	
 private:
-	map<string, FileSystemBase*>		mountPoints;	///< A map of the mounted file systems, (mountPoint, FileSystemBase)
-	map<string, FileSystemFactory*>		fileSystems;	///< A map of the known files systems, (fsName, FileSystemFactory)
-
 	/**
-	 * A comparitor used in Open to compare the path to the mount points.
+	 * Reads from an open file, copying out through a kernel buffer for a process.
+	 * @param fd The descriptor of the open file.
+	 * @param buff The buffer to read the data into.
+	 * @param numBytes The number of bytes to read.
+	 * @param position The offset to read from, or CURRENT_POSITION for the file position.
+	 * @return The number of bytes read or an error.
+	 */
+	static int ReadFile(FileDescriptorBase *fd, void *buff, uint numBytes, int position);
+	
+	/**
+	 * Writes to an open file, copying in through a kernel buffer for a process.
+	 * @param fd The descriptor of the open file.
+	 * @param buff The buffer to write the data from.
+	 * @param numBytes The number of bytes to write.
+	 * @param position The offset to write to, or CURRENT_POSITION for the file position.
+	 * @return The number of bytes written or an error.
+	 */
+	static int WriteFile(FileDescriptorBase *fd, void *buff, uint numBytes, int position);
+	
+	/**
+	 * Copies a readv or writev vector into the kernel.
+	 * @param vector The caller's vector.
+	 * @param count The number of buffers in vector.
+	 * @param kernelVector Set to the copy, the caller deletes it.
+	 * @return Zero on success or an error.
+	 */
+	static int GetIOVector(const FileSystemBase::iovec *vector, int count, FileSystemBase::iovec *&kernelVector);
+	
+	/**
+	 * A mounted file system, kept in a vector so Open can find it without copying strings.
 	 */
-	struct ComparePrefix
+	struct MountPoint
 	{
-		ComparePrefix(const string &p) : path(p) { ; }
-		
-		bool operator()(const pair<string, FileSystemBase*> &arg)
-		{ return path.BeginsWith(arg.first); }
-	private:
-		string path;
+		string		path;		///< Where the file system is mounted
+		FileSystemBase	*fileSystem;	///< The mounted file system
 	};
+	
+	/**
+	 * Finds the file system with the longest mount point that path starts with.
+	 * @param path The path to look for.
+	 * @return The file system or NULL if none of them match.
+	 */
+	FileSystemBase *FindMountPoint(const char *path);
+	
+	/**
+	 * Finds a file's inode one name at a time through the dentry cache, only asking the
+	 * file system about names that aren't cached.
+	 * @param fileSystem The file system the path is on.
+	 * @param path The path to the file.
+	 * @return The inode number, -ENOSYS if the file system can't look up names, or another negative errno.
+	 */
+	int LookupPath(FileSystemBase *fileSystem, const char *path);
+	
+	/**
+	 * Opens a file, through the dentry cache if the file system supports it.
+	 * @param fileSystem The file system the path is on.
+	 * @param fd The descriptor to open.
+	 * @param path The path to the file.
+	 * @param flags The flags to pass to the file system.
+	 * @return Zero on success or an error.
+	 */
+	int OpenPath(FileSystemBase *fileSystem, FileDescriptorBase *fd, const char *path, const int flags);
+	
+	map<string, FileSystemBase*>		mountPoints;	///< A map of the mounted file systems, (mountPoint, FileSystemBase)
+	vector<MountPoint>			mountList;	///< The same file systems, searched by Open
+	map<string, FileSystemFactory*>		fileSystems;	///< A map of the known files systems, (fsName, FileSystemFactory)
+
+	static const uint	STDOUT_CHUNK_SIZE = 128;	///< Bytes printed per DEBUG call for writes to stdout
+	static const uint	IO_CHUNK_SIZE = 4 * PAGE_SIZE;	///< Bytes bounced through the kernel per user copy
+	static const uint	MAX_PATH_LENGTH = 256;		///< Longest path accepted from a process, with the NULL
+	static const uint	MAX_IO_VECTORS = 1024;		///< Most buffers accepted by readv and writev
+	static const int	CURRENT_POSITION = -1;		///< Position for ReadFile and WriteFile meaning the file position
 };
 
 
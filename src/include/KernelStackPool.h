@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file KernelStackPool.h
+ *
+ */
+
+#ifndef KERNELSTACKPOOL_H
+#define KERNELSTACKPOOL_H
+
+
+#include <constants.h>
+#include <types.h>
+#include <i386.h>
+#include <vector.h>
+#include <Singleton.h>
+
+using k_std::vector;
+
+/** @class KernelStackPool
+ *
+ * @brief Hands out thread stacks from a reserved region of kernel memory.
+ *
+ * The 4 MB at KERNEL_STACK_REGION is split into slots of SLOT_PAGES pages. The bottom
+ * page of every slot is never mapped, so running off the end of a stack faults instead
+ * of walking into whatever is below it. The stack itself is at the top of the slot.
+ *
+ * The whole region uses a single page table that is created while the kernel's page
+ * directory is loaded, before any process exists. Every page directory is copied from
+ * the kernel's, so they all share that page table and a stack mapped later is visible
+ * in every address space.
+ *
+ * Freed slots keep their pages mapped and go on a free list, so creating a thread is
+ * just a pop off that list.
+ *
+ **/
+
+class KernelStackPool : public Singleton<KernelStackPool>
+{
+public:
+	/**
+	 * Sets up the region and maps the preallocated stacks.
+	 * Must be called with the kernel's page directory loaded.
+	 */
+	KernelStackPool();
+
+	/**
+	 * Allocates a stack.
+	 * @param stackSize The size of the stack in bytes.
+	 * @return A pointer to the lowest byte of the stack, the stack ends at stack + stackSize.
+	 */
+	uchar *Allocate(ulong stackSize);
+
+	/**
+	 * Returns a stack to the pool.
+	 * @param stack The pointer returned from Allocate.
+	 */
+	void Free(uchar *stack);
+
+	static const uint	MAX_STACK_PAGES = 4;			///< The largest stack a slot can hold
+	static const uint	SLOT_PAGES = MAX_STACK_PAGES + 1;	///< The stack plus its guard page
+	static const uint	NUM_SLOTS = NUM_PAGE_TABLE_ENTRIES / SLOT_PAGES;	///< Slots in the region
+	static const uint	PREALLOCATED_STACKS = 8;		///< Stacks mapped when the pool is created
+
+private:
+	/// Returns the address just above a slot's stack
+	inline ulong SlotTop(uint slot)
+	{ return KERNEL_STACK_REGION + (slot + 1) * SLOT_PAGES * PAGE_SIZE; }
+
+	/**
+	 * Makes sure a slot has enough pages mapped.
+	 * @param slot The slot.
+	 * @param numPages The number of pages needed at the top of the slot.
+	 */
+	void MapSlot(uint slot, uint numPages);
+
+	vector<uint>	freeSlots;	///< Slots that are free to hand out
+	vector<uchar>	mappedPages;	///< The number of pages mapped in each slot
+	uint		nextSlot;	///< The first slot that has never been used
+};
+
+
+#endif // KernelStackPool.h
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the 
+ * above copyright notice must appear and this permission notice must 
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+/** @file LRUList.h
+ * Functions for the least recently used lists the caches keep through their own entries.
+ * An entry only needs lruPrev and lruNext pointers, the cache keeps the head and tail.
+ */
+
+#ifndef LRULIST_H
+#define LRULIST_H
+
+#include <constants.h>
+
+/**
+ * Takes an entry out of an LRU list.
+ * @param entry The entry, it must be in the list.
+ * @param head The list's most recently used entry.
+ * @param tail The list's least recently used entry.
+ */
+template<typename T>
+inline void LRUUnlink(T *entry, T *&head, T *&tail)
+{
+	if(entry->lruPrev != NULL)
+		entry->lruPrev->lruNext = entry->lruNext;
+	else
+		head = entry->lruNext;
+	
+	if(entry->lruNext != NULL)
+		entry->lruNext->lruPrev = entry->lruPrev;
+	else
+		tail = entry->lruPrev;
+	
+	entry->lruPrev = entry->lruNext = NULL;
+}
+
+/**
+ * Moves an entry to the front of an LRU list, adding it if it isn't in the list.
+ * An entry that isn't in the list must have lruPrev set to NULL.
+ * @param entry The entry that was just used.
+ * @param head The list's most recently used entry.
+ * @param tail The list's least recently used entry.
+ */
+template<typename T>
+inline void LRUTouch(T *entry, T *&head, T *&tail)
+{
+	if(entry == head)
+		return;
+	
+	// take it out of the list, if it is in it
+	if(entry->lruPrev != NULL)
+		LRUUnlink(entry, head, tail);
+	
+	// put it on the front
+	entry->lruPrev = NULL;
+	entry->lruNext = head;
+	
+	if(head != NULL)
+		head->lruPrev = entry;
+	
+	head = entry;
+	
+	if(tail == NULL)
+		tail = entry;
+}
+
+#endif // LRULIST_H
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file LatencyStats.h
+ *
+ */
+
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+
+#include <constants.h>
+#include <types.h>
+
+class VirtualConsole;
+
+/** @class LatencyStats
+ *
+ * @brief Keeps log2 histograms of interrupt and system call latencies, measured with the TSC.
+ *
+ * Everything is static and lives in the BSS so it can be used by AutoDisable before
+ * any of the global constructors have run. Interrupts and system calls come in through
+ * interrupt gates, so the whole of the dispatcher is an irq-off sample as well as the
+ * AutoDisables that turn interrupts off. An interrupt or irq-off measurement that
+ * spans a task switch is thrown away (and counted) because it includes the time other
+ * threads ran. System calls are timed from entry to return, including any blocking.
+ *
+ **/
+
+class LatencyStats
+{
+public:
+	/**
+	 * Reads the time stamp counter.
+	 * @return The number of cycles since the CPU was reset.
+	 */
+	static inline ulonglong ReadTimeStamp()
+	{
+		ulonglong	ret;
+
+		asm __volatile__ ("rdtsc" : "=A" (ret));
+
+		return(ret);
+	}
+
+	/// Returns the number of task switches, used to detect a measurement that spans one
+	static inline ulong GetSwitchCount() { return switchCount; }
+
+	/// Called by the scheduler every time it switches to a different thread
+	static inline void TaskSwitched() { ++switchCount; }
+
+	/**
+	 * Records the time spent handling an interrupt.
+	 * @param vector The interrupt number.
+	 * @param startTime The time stamp when the interrupt was entered.
+	 * @param switches The switch count when the interrupt was entered.
+	 */
+	static void RecordInterrupt(uint vector, ulonglong startTime, ulong switches);
+
+	/**
+	 * Records the time spent in a system call.
+	 * @param num The system call number.
+	 * @param startTime The time stamp when the system call was entered.
+	 */
+	static void RecordSystemCall(uint num, ulonglong startTime);
+
+	/**
+	 * Records how long interrupts were disabled.
+	 * @param startTime The time stamp when interrupts were disabled.
+	 * @param switches The switch count when interrupts were disabled.
+	 * @param location The code address that disabled interrupts, or the interrupted EIP.
+	 * @param vector The interrupt that came in with them off, or -1 if AutoDisable turned them off.
+	 */
+	static void RecordInterruptsOff(ulonglong startTime, ulong switches, ulong location, int vector = -1);
+
+	/**
+	 * Prints all of the non-empty histograms.
+	 * @param console The console to print to.
+	 */
+	static void Dump(VirtualConsole *console);
+
+	/**
+	 * Clears all of the histograms and maximums.
+	 */
+	static void Reset();
+
+	static const uint	NUM_BUCKETS = 32;	///< Bucket i counts latencies in [2^i, 2^(i+1)) cycles
+	static const uint	NUM_VECTORS = 256;	///< Number of interrupt vectors tracked
+
+private:
+	struct Histogram
+	{
+		ulong	buckets[NUM_BUCKETS];
+		ulong	count;	///< Total number of samples
+		ulong	max;	///< Largest sample, in cycles
+	};
+
+	/**
+	 * Adds a sample to a histogram.
+	 * @param hist The histogram.
+	 * @param startTime The time stamp at the start of the sample.
+	 * @return The length of the sample in cycles, saturated to 32 bits.
+	 */
+	static ulong AddSample(Histogram &hist, ulonglong startTime);
+
+	/**
+	 * Finds the upper bound of a percentile from a histogram.
+	 * @param hist The histogram.
+	 * @param percent The percentile, 1 to 100.
+	 * @return The upper bound of the bucket holding the percentile.
+	 */
+	static ulong Percentile(const Histogram &hist, uint percent);
+
+	/**
+	 * Prints a single histogram.
+	 * @param console The console to print to.
+	 * @param name The name of the histogram type.
+	 * @param num The vector or system call number.
+	 * @param hist The histogram.
+	 */
+	static void Print(VirtualConsole *console, const char *name, uint num, const Histogram &hist);
+
+	static Histogram	interrupts[NUM_VECTORS];	///< Per-vector histograms
+	static Histogram	systemCalls[];			///< Per-system call histograms
+	static Histogram	interruptsOff;			///< How long interrupts were kept off
+	static ulong		interruptsOffLocation;		///< Who disabled interrupts for interruptsOff.max
+	static int		interruptsOffVector;		///< The interrupt for interruptsOff.max, -1 for an AutoDisable
+	static ulong		switchCount;			///< Task switches since boot
+	static ulong		discarded;			///< Samples thrown away because of a task switch
+};
+
+
+#endif // LatencyStats.h
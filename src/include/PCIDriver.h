@@ -23,7 +23,9 @@
 
 #include <constants.h>
 #include <types.h>
+#include <vector.h>
 
+using k_std::vector;
 
 /** @class PCIDriver
  *
@@ -39,7 +41,6 @@ public:
 	 */
 	PCIDriver(uchar bus);
 
-private:
 	// Taken from http://www.osdev.org/wiki/PCI
 	struct DeviceConfig
 	{
@@ -69,8 +70,31 @@ private:
 		uchar	intPin;
 		uchar	minGrant;
 		uchar	maxLatency;
+		uchar	deviceNum;	///< Where the device is on the bus, not part of the header
+		uchar	functionNum;	///< The function of the device, not part of the header
 	};
 	
+	/**
+	 * Finds the first device of a given class on the bus.
+	 * @param classCode The class of the device.
+	 * @param subClass The sub class of the device.
+	 * @param config Filled in with the device's configuration.
+	 * @return True if the device was found.
+	 */
+	bool FindDevice(uchar classCode, uchar subClass, DeviceConfig &config);
+	
+	/**
+	 * Lets a device master the bus, needed for it to do DMA.
+	 * @param config The configuration of the device.
+	 */
+	void EnableBusMaster(const DeviceConfig &config);
+	
+	// class codes
+	static const uchar CLASS_MASS_STORAGE	= 0x01;
+	static const uchar SUBCLASS_IDE		= 0x01;
+	
+private:
+
 	class ConfigRegister
 	{
 		friend class PCIDriver;
@@ -105,13 +129,16 @@ private:
 	
 	void GetDeviceConfiguration(DeviceConfig &config, uchar device);
 	ulong ReadConfig(const ConfigRegister &device);
+	void WriteConfig(const ConfigRegister &device, ulong value);
 	
 	// variables
-	uchar	bus;
+	uchar			bus;
+	vector<DeviceConfig>	devices;	///< Every function found on the bus
 	
 	// constants
 	static const ushort CONFIG_ADDRESS = 0xCF8;
 	static const ushort CONFIG_DATA	   = 0xCFC;
+	static const ushort COMMAND_BUS_MASTER = 0x0004;	///< Bit in the command register
 };
 
 
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file PageCache.h
+ *
+ */
+
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+
+#include <constants.h>
+#include <types.h>
+#include <list.h>
+#include <vector.h>
+#include <Singleton.h>
+#include <FileSystemBase.h>
+
+using k_std::list;
+using k_std::vector;
+
+
+/** @class PageCache
+ *
+ * @brief Keeps the pages of files that are mapped into processes.
+ *
+ * A page is read in the first time any process touches it, and after that every mapping
+ * of the file uses the same physical page, mapped read-only. A write to a private mapping
+ * gets the process its own copy of the page. A file's pages are freed when its last
+ * mapping goes away.
+ *
+ * Shared mappings can't be written, there is nothing to write the pages back to the file.
+ *
+ **/
+class PageCache : public Singleton<PageCache>
+{
+public:
+	/**
+	 * A file that has mappings, and the pages of it that have been read in.
+	 */
+	struct CachedFile
+	{
+		FileSystemBase		*fileSystem;	///< The file system the file is on
+		ulong			inode;		///< The file's inode number
+		FileDescriptorBase	*fd;		///< Our own descriptor, so the file stays open after the process closes it
+		uint			mapCount;	///< The number of mappings of the file
+		vector<ulong>		pages;		///< The physical page for each page of the file, 0 if it isn't read in
+	};
+
+	/**
+	 * A range of a process's memory that is mapped to a file.
+	 */
+	struct Mapping
+	{
+		ulong		start;		///< The first address, page aligned
+		ulong		length;		///< The length in bytes, a multiple of PAGE_SIZE
+		ulong		offset;		///< The offset in the file of start, page aligned
+		int		prot;		///< The PROT_ flags
+		int		flags;		///< MAP_SHARED or MAP_PRIVATE
+		CachedFile	*file;		///< The file's pages
+	};
+
+	enum { PROT_NONE = 0x0, PROT_READ = 0x1, PROT_WRITE = 0x2, PROT_EXEC = 0x4 };	///< mmap protections
+	enum { MAP_SHARED = 0x01, MAP_PRIVATE = 0x02, MAP_FIXED = 0x10 };		///< mmap flags
+
+	static const ulong	MAP_BASE = 0x40000000;	///< Where mappings without an address are put
+
+	PageCache();
+
+	/**
+	 * Maps part of a file into the current process. (SYSCALL_mmap)
+	 * @param addr Where to put the mapping, page aligned, or 0 to let the kernel pick.
+	 * @param length The number of bytes to map.
+	 * @param prot The PROT_ flags.
+	 * @param flags MAP_SHARED or MAP_PRIVATE, and MAP_FIXED to use addr even if it is mapped.
+	 * @param fileDescriptor The file to map.
+	 * @param offset The offset in the file to start at, page aligned.
+	 * @return The address of the mapping or a negative errno.
+	 */
+	static int Map(ulong addr, ulong length, int prot, int flags, int fileDescriptor, int offset);
+
+	/**
+	 * Removes mappings from the current process. (SYSCALL_munmap)
+	 * @param addr The start of the range, page aligned.
+	 * @param length The length of the range.
+	 * @return Zero on success or a negative errno.
+	 */
+	static int Unmap(ulong addr, ulong length);
+
+	/**
+	 * Maps part of a file into a process, used by the kernel to load programs.
+	 * @param procID The process to map the file into.
+	 * @param addr Where to put the mapping, page aligned, or 0 to let the kernel pick.
+	 * @param length The number of bytes to map.
+	 * @param prot The PROT_ flags.
+	 * @param flags MAP_SHARED or MAP_PRIVATE, and MAP_FIXED to use addr even if it is mapped.
+	 * @param fd The file to map.
+	 * @param offset The offset in the file to start at, page aligned.
+	 * @return The address of the mapping or a negative errno.
+	 */
+	int MapFile(uint procID, ulong addr, ulong length, int prot, int flags, FileDescriptorBase *fd, ulong offset);
+
+	/**
+	 * Handles a page fault in a mapping of the current process.
+	 * @param addr The address of the fault, rounded down to a page.
+	 * @param errorCode The error code of the fault.
+	 * @return True if the fault was in a mapping and was handled.
+	 */
+	bool HandleFault(ulong addr, ulong errorCode);
+
+	/**
+	 * Takes another reference on the files of a copied list of mappings, used by fork.
+	 */
+	void HoldMappings(list<Mapping> &mappings);
+
+	/**
+	 * Lets go of all of a process's mappings, the process's page directory is about to be freed.
+	 */
+	void ReleaseMappings(list<Mapping> &mappings);
+
+private:
+	/**
+	 * Finds or makes the cached file for an open file, and takes a reference on it.
+	 * @param fd The open file.
+	 * @param file Set to the cached file.
+	 * @return Zero on success or a negative errno.
+	 */
+	int GetFile(FileDescriptorBase *fd, CachedFile *&file);
+
+	/**
+	 * Finds a cached file and takes a reference on it.
+	 * @return The cached file or NULL if the file doesn't have any mappings.
+	 */
+	CachedFile *FindFile(FileSystemBase *fileSystem, ulong inode);
+
+	/**
+	 * Lets go of a reference on a cached file, the last one frees its pages.
+	 */
+	void PutFile(CachedFile *file);
+
+	/**
+	 * Returns a page of a file, reading it in if it isn't cached. The page isn't mapped anywhere.
+	 * @return The physical page, or 0 if it couldn't be read.
+	 */
+	ulong GetPage(CachedFile *file, ulong index);
+
+	/**
+	 * Removes the pages of [start, end) of a mapping from the current address space, freeing private copies.
+	 */
+	void UnmapPages(Mapping &mapping, ulong start, ulong end);
+
+	/**
+	 * Removes every mapping in [start, end), splitting the ones that only partly overlap.
+	 */
+	void UnmapRange(list<Mapping> &mappings, ulong start, ulong end);
+
+	/**
+	 * Checks if any mapping is in [start, end).
+	 */
+	bool Overlaps(list<Mapping> &mappings, ulong start, ulong end);
+
+	/**
+	 * Finds a free range of addresses at or after MAP_BASE.
+	 * @return The start of the range, or 0 if there isn't one.
+	 */
+	ulong FindFreeRange(list<Mapping> &mappings, ulong length);
+
+	list<CachedFile*>	files;	///< The files that have mappings
+};
+
+
+#endif // PageCache.h
+
@@ -23,36 +23,63 @@
 
 #include <constants.h>
 #include <types.h>
+#include <vector.h>
 
+using k_std::vector;
+
+class BlockDevice;
 
 /** @class Partition
  *
- * @brief 
+ * @brief Finds the partitions on a block device.
+ *
+ * Understands MBR primary partitions, logical partitions in an extended partition's
+ * EBR chain, and GPT. The MBR, GPT header and the usual GPT entry array are read with
+ * one request, only EBRs (and an entry array somewhere odd) need more.
+ *
+ * Addresses and sizes are in the device's 512 byte blocks.
  *
  **/
-
 class Partition
 {
 public:
-	Partition();
-	Partition(uchar *firstSector);
-	
-	struct ParsedPartitionDescriptor
+	/**
+	 * A partition that was found.
+	 */
+	struct PartitionInfo
 	{
-		bool	bootable;
-		uchar	partitionType;
-		ulong	lbaPartitionStart;
-		ulong	partitionSize;	
+		int	number;		///< 1-4 for primary, 5 and up for logical, 1 and up for GPT
+		uchar	partitionType;	///< The MBR type, GPT_TYPE for GPT partitions
+		bool	bootable;	///< The MBR boot flag
+		ulong	start;		///< The first block of the partition
+		ulong	size;		///< The number of blocks in the partition
 	};
-	
-	int ParsePartitionInformation(uchar *firstSector);
-	ParsedPartitionDescriptor GetPartitionInformation(int partitionNumber);
-	ulong GetPartitionStartAddress(int partitionNumber);
+
+	/**
+	 * Finds all the partitions on a device.
+	 * @param device The device to scan, it must have 512 byte blocks.
+	 * @param deviceSize The number of blocks on the device, partitions are cut off here. Zero if unknown.
+	 * @param partitions The partitions found are added to the end.
+	 * @return The number of partitions found, or -1 if the device isn't partitioned.
+	 */
+	static int Scan(BlockDevice *device, ulong deviceSize, vector<PartitionInfo> &partitions);
 
 	static const uchar	LINUX_TYPE = 0x83;
-	
+	static const uchar	EXTENDED_TYPE = 0x05;
+	static const uchar	WIN_EXTENDED_TYPE = 0x0F;
+	static const uchar	LINUX_EXTENDED_TYPE = 0x85;
+	static const uchar	GPT_PROTECTIVE_TYPE = 0xEE;
+	static const uchar	GPT_TYPE = 0xEE;	///< Reported for every GPT partition
+
 private:
-	
+	static const ulong	SECTOR_SIZE = 512;
+	static const ulong	SCAN_SECTORS = 34;	///< MBR, GPT header and 128 entries of 128 bytes
+	static const int	MAX_LOGICAL = 64;	///< EBRs followed before giving up on a loop
+	static const ulong	MAX_GPT_ENTRIES = 256;	///< Entries looked at in a GPT
+
+	/**
+	 * A partition entry in the MBR or an EBR.
+	 */
 	struct PartitionDescriptor
 	{
 		uchar	bootIndicator;
@@ -60,13 +87,70 @@ private:
 		uchar	partitionType;
 		uchar	chsPartitionEnd[3];
 		ulong	lbaPartitionStart;
-		ulong	partitionSize;	
+		ulong	partitionSize;
+	} __attribute__((packed));
+
+	/**
+	 * The GPT header in block 1.
+	 */
+	struct GPTHeader
+	{
+		char		signature[8];		///< "EFI PART"
+		ulong		revision;
+		ulong		headerSize;
+		ulong		headerCRC;
+		ulong		reserved;
+		ulonglong	currentLBA;
+		ulonglong	backupLBA;
+		ulonglong	firstUsableLBA;
+		ulonglong	lastUsableLBA;
+		uchar		diskGUID[16];
+		ulonglong	entriesLBA;		///< The first block of the entry array
+		ulong		numEntries;
+		ulong		entrySize;
+		ulong		entriesCRC;
+	} __attribute__((packed));
+
+	/**
+	 * An entry in the GPT entry array.
+	 */
+	struct GPTEntry
+	{
+		uchar		typeGUID[16];		///< All zeros if the entry isn't used
+		uchar		uniqueGUID[16];
+		ulonglong	firstLBA;
+		ulonglong	lastLBA;		///< Inclusive
+		ulonglong	attributes;
+		ushort		name[36];		///< UTF-16
 	} __attribute__((packed));
-	
-	ParsedPartitionDescriptor	primaryPartitions[4];
-};
 
+	/**
+	 * Reads the entries out of a GPT.
+	 * @param device The device, used if the entry array isn't in buff.
+	 * @param buff The first blocks of the device.
+	 * @param buffSectors The number of blocks in buff.
+	 */
+	static int ParseGPT(BlockDevice *device, uchar *buff, ulong buffSectors, ulong deviceSize, vector<PartitionInfo> &partitions);
 
-#endif // Partition.h
+	/**
+	 * Follows the chain of EBRs in an extended partition.
+	 * @param extendedStart The first block of the extended partition.
+	 * @param nextNumber The number to give the first logical partition.
+	 */
+	static int ParseEBRChain(BlockDevice *device, ulong extendedStart, ulong deviceSize, int nextNumber, vector<PartitionInfo> &partitions);
 
+	/**
+	 * Adds a partition to the list if it fits on the device.
+	 * @return True if it was added.
+	 */
+	static bool AddPartition(int number, uchar type, bool bootable, ulong start, ulong size, ulong deviceSize, vector<PartitionInfo> &partitions);
 
+	static inline bool IsExtended(uchar type)
+	{ return(type == EXTENDED_TYPE || type == WIN_EXTENDED_TYPE || type == LINUX_EXTENDED_TYPE); }
+
+	static inline bool HasSignature(uchar *sector)
+	{ return(sector[510] == 0x55 && sector[511] == 0xAA); }
+};
+
+
+#endif // Partition.h
@@ -37,6 +37,8 @@ using k_std::find_if_backwards;
 
 #define PHYS2STRUCTADDR(x) ( (x) >> 12)
 
+#define PAGE_COPY_ON_WRITE	0x1	///< sysProgUse bit of a page shared read-only with a forked process
+
 /** @class PhysicalMemManager
  *
  * @brief This is the physical memory manager to handle paging.
@@ -49,6 +51,10 @@ using k_std::find_if_backwards;
  * <tr><td><hr>			</td><td>4 GB - 4 MB		</td></tr>
  * <tr><td>Mapped Page Directory</td><td>			</td></tr>
  * <tr><td><hr>			</td><td>4 GB - 4 MB - 4096	</td></tr>
+ * <tr><td>Unused		</td><td>			</td></tr>
+ * <tr><td><hr>			</td><td>3.5 GB + 4 MB		</td></tr>
+ * <tr><td>Thread stacks, see KernelStackPool</td><td>	</td></tr>
+ * <tr><td><hr>			</td><td>3.5 GB			</td></tr>
  * <tr><td>Kernel's stack, heap and data</td><td>		</td></tr>
  * <tr><td><hr>			</td><td>3 GB			</td></tr>
  * <tr><td>User Land Memory	</td><td>			</td></tr>
@@ -97,7 +103,8 @@ public:
 	ulong CreatePageDirectory(ulong procID);
 	
 	/**
-	 * Creates a copy of a page directroy, setting all user-land entries to NOT writable.
+	 * Creates a copy of a page directroy, with copies of its user-land page tables.
+	 * The writable user-land pages are made read-only in both and copied on the first write.
 	 * @param procID The process ID to assign the page to.
 	 * @param srcPageDir The physical address of the page directory to be copied.
 	 * @return The address of the physical page.
@@ -120,8 +127,16 @@ public:
 	 * This is for use with copy-on-write.
 	 * @param virtualAddress The virtual address (rounded down) of the page to copy.
 	 * @param pageDirPhysAddress The physical address of the page directory.
+	 * @param procID The ID of the proc the copy belongs to, it is freed with the proc.
+	 */
+	void CopyPage(ulong virtualAddress, ulong pageDirPhysAddress, ulong procID = KERNEL_PID);
+	
+	/**
+	 * Fills a physical page that isn't mapped anywhere, through a mapping only the kernel sees.
+	 * @param physicalPage The physical address of the page.
+	 * @param src The PAGE_SIZE bytes to copy into it, in kernel memory.
 	 */
-	void CopyPage(ulong virtualAddress, ulong pageDirPhysAddress);
+	void CopyToPage(ulong physicalPage, const void *src);
 	
 	/**
 	 * Free all of the physical pages that a process has allocated.
@@ -135,6 +150,13 @@ public:
 	 */
 	ulong FindFreePage();
 	
+	/**
+	 * Frees a physical page, taking it off the used list if a proc had it.
+	 * If a forked process still has it, the current process only gives up its share.
+	 * @param physicalPage The physical address of the page.
+	 */
+	void FreePage(ulong physicalPage);
+	
 	/**
 	 * Maps part of a file to a memory address or a process.
 	 * @param fd The file descriptor of the file to read from, should be opened.
@@ -162,8 +184,16 @@ public:
 	 * @param physicalPage The physical page to map into virtual address space.
 	 * @param pageDirPhysAddress The page directory address to use. Default is the current proc.
 	 * @param procID The ID of the proc to be associated with this page.
+	 * @param writable False to map the page read-only.
+	 */
+	void MapPage(ulong virtualAddress, ulong physicalPage, ulong pageDirPhysAddress = 0, ulong procID = 0, bool writable = true);
+	
+	/**
+	 * Removes a page from the current address space without freeing it.
+	 * @param virtualAddress The virtual address of the page.
+	 * @return The physical page that was mapped there, or 0 if there wasn't one.
 	 */
-	void MapPage(ulong virtualAddress, ulong physicalPage, ulong pageDirPhysAddress = 0, ulong procID = 0);
+	ulong UnmapPage(ulong virtualAddress);
 	
 	/**
 	 * Acquires a new physical page and maps it into memory.
@@ -180,6 +210,14 @@ public:
 	 */
 	void GetStats(ulong &usedPageCount, ulong &freePageCount);
 	
+	/**
+	 * Translates an address in the current address space to a physical address.
+	 * Used to hand buffers to bus-master devices.
+	 * @param virtualAddress The address to translate.
+	 * @return The physical address, or 0 if the page isn't mapped.
+	 */
+	ulong VirtualToPhysical(ulong virtualAddress);
+	
 	/**
 	 * Returns the physical address of the current page directory.
 	 * @return The physical address of the current page directory.
@@ -196,6 +234,15 @@ public:
 	{ return myself; }
 
 private:
+	/**
+	 * Handles a write to a page shared with a forked process in the current page directory.
+	 * The process gets its own copy, or the page itself if nobody else has it anymore.
+	 * @param virtualAddress The address of the page, rounded down.
+	 * @param errorCode The page fault's error code.
+	 * @return True if it was a copy-on-write fault and it's been fixed.
+	 */
+	bool HandleCopyOnWrite(ulong virtualAddress, ulong errorCode);
+
 	/**
 	 * Rounds an address up to a page boundry.
 	 * @param arg The address to round.
@@ -282,6 +329,7 @@ private:
 
 	list<PageInfo>	usedPages;	///< A list of the pages that are used
 	vector<bool>	freePages;	///< A bitmap of the pages that are free
+	vector<ushort>	pageShares;	///< The number of other processes each page is shared with after a fork
 		
 	PageDirectoryEntry	*thePageDir;		///< A pointer to the page table that maps the page tables
 	PageTableEntry		*theVirtualPageTable;	///< A pointer to where the page tables are mapped
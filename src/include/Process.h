@@ -30,11 +30,14 @@
 #include <VirtualConsole.h>
 #include <i386.h>
 #include <FileSystemBase.h>
+#include <PageCache.h>
 
 using k_std::list;
 using k_std::vector;
 using k_std::string;
 
+class SyscallRing;
+
 
 /** @class Process
  *
@@ -110,6 +113,8 @@ private:
 	
 	list<Thread*>			theThreads;	///< A list of the threads for the process
 	vector<FileDescriptorBase*>	fileDescriptors; ///< A list of the file descriptors
+	SyscallRing			*theRing;	///< The batched system call ring, NULL if not setup
+	list<PageCache::Mapping>	mappings;	///< The files mapped into the process, sorted by address
 };
 
 
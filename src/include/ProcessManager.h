@@ -136,6 +136,9 @@ public:
 	/// Returns the address of a process's page directory
 	ulong GetProcPageDir(uint procID);
 	
+	/// Returns the list of files mapped into a process
+	list<PageCache::Mapping> *GetProcMappings(uint procID);
+	
 	/**
 	 * Inserts a file descriptor into the process.
 	 * @param ptr A pointer to the file descriptor.
@@ -156,6 +159,19 @@ public:
 	 */
 	void RemoveFileDescriptor(int fd);
 	
+	/**
+	 * Returns the system call ring of the current process.
+	 * @return The ring or NULL if the process hasn't setup one.
+	 */
+	SyscallRing *GetSyscallRing();
+	
+	/**
+	 * Sets the system call ring of the current process.
+	 * The process will delete the ring when it exits.
+	 * @param ring A pointer to the ring.
+	 */
+	void SetSyscallRing(SyscallRing *ring);
+	
 	/**
 	 * Returns the size of the run queue.
 	 * @return The size of the run queue.
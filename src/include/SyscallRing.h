@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file SyscallRing.h
+ *
+ */
+
+#ifndef SYSCALLRING_H
+#define SYSCALLRING_H
+
+
+#include <constants.h>
+#include <types.h>
+#include <Semaphore.h>
+
+class Thread;
+
+/** @class SyscallRing
+ *
+ * @brief A shared memory submission/completion ring for batching file system calls.
+ *
+ * A user process sets aside a chunk of its own memory for the ring and registers it
+ * with SYSCALL_io_setup. The memory starts with a RingHeader, followed by numEntries
+ * SubmitEntry structures, followed by numEntries CompleteEntry structures.
+ *
+ * The process fills in submit entries and advances submitTail, then makes a single
+ * SYSCALL_io_submit to have the kernel run all of them. Results are posted to the
+ * completion entries and completeTail is advanced; the process consumes them by
+ * advancing completeHead. If io_submit is called with ENTER_ASYNC the entries are
+ * handed to a kernel worker thread and the call returns right away,
+ * SYSCALL_io_getevents can then be used to wait for the completions.
+ *
+ * The kernel only reaches the ring through CopyFromUser and CopyToUser, if the process
+ * unmaps it the calls return EFAULT.
+ *
+ **/
+
+class SyscallRing
+{
+public:
+	/**
+	 * The header at the start of the shared ring memory.
+	 * All of the indexes are free running, they are masked with (numEntries-1) to find the entry.
+	 */
+	struct RingHeader
+	{
+		volatile ulong	submitHead;	///< Next submit entry the kernel will consume
+		volatile ulong	submitTail;	///< Next submit entry the process will fill in
+		volatile ulong	completeHead;	///< Next completion the process will consume
+		volatile ulong	completeTail;	///< Next completion the kernel will fill in
+		ulong		numEntries;	///< Number of entries in each ring, must be a power of 2
+		ulong		reserved[3];
+	};
+
+	/**
+	 * A single operation queued by the process.
+	 */
+	struct SubmitEntry
+	{
+		ulong	opcode;		///< One of the OP_ values
+		int	fd;		///< The file descriptor to operate on
+		ulong	addr;		///< Buffer for read/write, path for open
+		ulong	length;		///< Bytes for read/write, flags for open, whence for lseek
+		int	offset;		///< Offset for lseek, pread and pwrite
+		ulong	userData;	///< Copied unchanged into the completion entry
+	};
+
+	/**
+	 * The result of a single operation.
+	 */
+	struct CompleteEntry
+	{
+		ulong	userData;	///< The userData of the submit entry
+		int	result;		///< The return value of the operation
+	};
+
+	enum { OP_NOP, OP_READ, OP_WRITE, OP_LSEEK, OP_OPEN, OP_CLOSE, OP_PREAD, OP_PWRITE };	///< Operation codes
+
+	static const ulong	ENTER_ASYNC = 0x01;	///< io_submit flag to hand the work to the worker thread
+	static const ulong	MAX_ENTRIES = 256;	///< The largest ring allowed
+
+	/**
+	 * Computes the number of bytes needed for a ring.
+	 * @param numEntries The number of entries in the ring.
+	 * @return The size of the ring in bytes.
+	 */
+	static inline ulong GetRingSize(ulong numEntries)
+	{ return sizeof(RingHeader) + numEntries * (sizeof(SubmitEntry) + sizeof(CompleteEntry)); }
+
+	/**
+	 * Registers a ring for the current process. (SYSCALL_io_setup)
+	 * @param ring A pointer to the ring memory in the process.
+	 * @param numEntries The number of entries, must be a power of 2.
+	 * @return Zero on success or an error.
+	 */
+	static int Setup(RingHeader *ring, ulong numEntries);
+
+	/**
+	 * Unregisters the ring of the current process. (SYSCALL_io_destroy)
+	 * @return Zero on success or an error.
+	 */
+	static int Destroy();
+
+	/**
+	 * Runs the queued submit entries. (SYSCALL_io_submit)
+	 * @param toSubmit The maximum number of entries to consume.
+	 * @param flags ENTER_ASYNC to have the worker thread run the entries.
+	 * @return The number of entries handed to the worker, or the number consumed, which includes
+	 * any earlier ENTER_ASYNC entries the worker hadn't run yet, or an error.
+	 */
+	static int Submit(ulong toSubmit, ulong flags);
+
+	/**
+	 * Waits for completions to be posted. (SYSCALL_io_getevents)
+	 * @param minComplete The number of unconsumed completions to wait for.
+	 * @return The number of unconsumed completions or an error.
+	 */
+	static int GetEvents(ulong minComplete);
+
+	/**
+	 * Creates a ring for a process.
+	 * @param ring A pointer to the ring memory in the process.
+	 * @param numEntries The number of entries in the ring.
+	 * @param procID The process that owns the ring.
+	 */
+	SyscallRing(RingHeader *ring, ulong numEntries, uint procID);
+
+private:
+	/**
+	 * Attaches the object to the ring memory.
+	 * @param ring A pointer to the ring memory in the process.
+	 * @param numEntries The number of entries in the ring.
+	 */
+	void Attach(RingHeader *ring, ulong numEntries);
+
+	/**
+	 * Copies the ring header in from the process.
+	 * @param copy Filled in with the header.
+	 * @return Zero on success or -EFAULT.
+	 */
+	int ReadHeader(RingHeader &copy);
+
+	/**
+	 * Stores one of the indexes in the ring header.
+	 * @param index A pointer to the index in the process's header.
+	 * @param value The new value of the index.
+	 * @return Zero on success or -EFAULT.
+	 */
+	int WriteIndex(volatile ulong *index, ulong value);
+
+	/**
+	 * Consumes the submitted entries, toRun of them, and posts their completions.
+	 * @return The number of entries consumed.
+	 */
+	int Drain();
+
+	/**
+	 * Runs a single submit entry.
+	 * @param entry The entry to run.
+	 * @return The return value of the call.
+	 */
+	int Execute(const SubmitEntry &entry);
+
+	/**
+	 * The main loop of the worker thread.
+	 * @param arg A pointer to the SyscallRing.
+	 */
+	static void Worker(void *arg);
+
+	RingHeader	*header;		///< The ring memory, NULL when detached, only touched through the user copy functions
+	SubmitEntry	*submitEntries;		///< The submit entries in the ring memory
+	CompleteEntry	*completeEntries;	///< The completion entries in the ring memory
+	ulong		mask;			///< numEntries - 1, kept here so the process can't change it
+	uint		procID;			///< The process that owns the ring
+	ulong		toRun;			///< Entries io_submit has handed over that haven't been consumed
+
+	Semaphore	consumeLock;		///< Only one consumer of the submit entries at a time
+	Semaphore	workPending;		///< Signaled to wake the worker thread
+	Semaphore	completions;		///< Signaled once for every completion posted
+	Thread		*worker;		///< The worker thread, created on the first async submit
+};
+
+
+#endif // SyscallRing.h
@@ -64,6 +64,8 @@ class Thread
 	friend class UserThread;
 	friend class KernelThread;
 	friend class V86Thread;
+	friend class Semaphore;
+	friend class FPUManager;
 
 public:
 	/**
@@ -123,10 +125,12 @@ private:
 	uint		procID;		///< The ID of the process the thread belongs to
 	uint		stackEnd;	///< The end of the stack, used for updating TSS esp0 field
 	
+	uchar		*fpuState;	///< The FPU save area, NULL until the thread uses the FPU
+	
 	Semaphore	joiningThreads;	///< A semaphore of threads waiting for this one to finish
 	
 public:
-	static const uint	DEFAULT_STACK_SIZE = 0x1000;	// 1 page of memory
+	static const uint	DEFAULT_STACK_SIZE = 0x1000;	// 1 page of memory, with a guard page below it
 	
 	enum { KERNEL, USER, V86 };	///< Thread types
 };
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file UserAccess.h
+ * Safe copies between the kernel and pointers handed in by system calls.
+ *
+ * A pointer is checked against the caller's address limit: KERNEL_BASE_ADDR for anything
+ * running on behalf of a user process, everything for kernel threads. The copies themselves
+ * are done by routines listed in the exception table, so a fault on a bad (but in range)
+ * address returns EFAULT instead of crashing the kernel.
+ */
+
+#ifndef USERACCESS_H
+#define USERACCESS_H
+
+#include <constants.h>
+#include <types.h>
+
+struct Registers;
+
+extern "C"
+{
+	// in user_copy.S
+	ulong CopyUserMemory(void *dest, const void *src, ulong size);
+	long CopyUserString(char *dest, const char *src, ulong size);
+}
+
+/**
+ * Returns the highest address the current thread may pass to a system call.
+ * @return KERNEL_BASE_ADDR for user processes, 0xFFFFFFFF for the kernel.
+ */
+ulong GetAddressLimit();
+
+/**
+ * Checks if the current thread is working on behalf of a user process.
+ * @return True if pointers from it must go through the copy functions.
+ */
+inline bool IsUserCaller()
+{ return(GetAddressLimit() != 0xFFFFFFFF); }
+
+/**
+ * Checks that a range of memory is below the current address limit.
+ * @param addr The start of the range.
+ * @param size The length of the range in bytes.
+ * @return True if the whole range is accessible.
+ */
+inline bool IsValidUserRange(const void *addr, ulong size)
+{
+	ulong	start = reinterpret_cast<ulong>(addr);
+	ulong	limit = GetAddressLimit();
+
+	return(start + size >= start && (size == 0 || start + size - 1 <= limit));
+}
+
+/**
+ * Copies memory from a system call's buffer into the kernel.
+ * @param dest The kernel buffer.
+ * @param userSrc The caller's buffer.
+ * @param size The number of bytes to copy.
+ * @return Zero on success or -EFAULT.
+ */
+int CopyFromUser(void *dest, const void *userSrc, ulong size);
+
+/**
+ * Copies memory from the kernel into a system call's buffer.
+ * @param userDest The caller's buffer.
+ * @param src The kernel buffer.
+ * @param size The number of bytes to copy.
+ * @return Zero on success or -EFAULT.
+ */
+int CopyToUser(void *userDest, const void *src, ulong size);
+
+/**
+ * Copies a NULL terminated string from a system call into the kernel.
+ * @param dest The kernel buffer.
+ * @param userSrc The caller's string.
+ * @param size The size of dest, including the NULL.
+ * @return The length of the string, -EFAULT or -ENAMETOOLONG.
+ */
+int CopyStringFromUser(char *dest, const char *userSrc, ulong size);
+
+/**
+ * Called by the page fault handler to recover from a fault in a user copy.
+ * @param regs The registers of the fault, eip is moved to the fixup code.
+ * @return True if the fault was in a user copy and has been fixed up.
+ */
+bool FixupUserAccessFault(Registers *regs);
+
+#endif // UserAccess.h
@@ -92,6 +92,7 @@
 #define	PAGE_SIZE		0x1000
 #define KERNEL_BASE_ADDR	0xC0000000
 #define PAGE_TABLES_MAPPING	0xFFC00000	// 4 GB - 4 MB
+#define KERNEL_STACK_REGION	0xE0000000	// 3.5 GB, 4 MB of kernel stacks with guard pages
 #define PAGE_DIRECTORY_MAPPING	0xFFFFF000	// 4 GB - 4096
 
 
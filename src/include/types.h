@@ -25,6 +25,7 @@ typedef unsigned char	uchar;
 typedef unsigned short	ushort;
 typedef unsigned int	uint;
 typedef unsigned long	ulong;
+typedef unsigned long long	ulonglong;
 typedef	uint		size_t;	// used for overloading new & delete
 
 /// for the clock
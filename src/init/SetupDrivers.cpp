@@ -30,6 +30,7 @@
 #include <ATAManager.h>
 #include <ProcessManager.h>
 #include <PhysicalMemManager.h>
+#include <PageCache.h>
 // drivers
 #include <ATADriver.h>
 #include <ClockDriver.h>
@@ -229,14 +230,11 @@ void CreateProcFromFile(string path, string procName)
 	
 	printf("FILE SIZE: %d\n", fileSize);
 	
-	// move back to the start
-	fd->GetFileSystem()->Seek(fd, 0, ext2::SEEK_SET);
-	
 	// make memory for the file's header
 	uchar	*buff = new uchar[ELF::GetFileHeaderSize()];
 	
 	// read the header into memory
-	fd->GetFileSystem()->Read(fd, buff, ELF::GetFileHeaderSize());
+	fd->GetFileSystem()->ReadAt(fd, buff, ELF::GetFileHeaderSize(), 0);
 	
 	// make an ELF object
 	ELF	progELF(buff);
@@ -258,7 +256,7 @@ void CreateProcFromFile(string path, string procName)
 	
 	printf("About to read: 0x%x\n", buff);
 	
-	fd->GetFileSystem()->Read(fd, buff, progELF.GetProgramHeadersSize());
+	fd->GetFileSystem()->ReadAt(fd, buff, progELF.GetProgramHeadersSize(), progELF.GetProgramHeadersOffset());
 	
 	progELF.ReadProgramHeaders(buff);
 	
@@ -288,11 +286,31 @@ void CreateProcFromFile(string path, string procName)
 		   it != progSectors.end();
 		   ++it)
 	{
-		PhysicalMemManager::GetInstancePtr()->MapMemoryFromFile(fd,
-								(*it).offset,
-								(*it).size,
-								(*it).addr,
-								pageDirAddr);
+		ulong	addr = (*it).addr;
+		ulong	offset = (*it).offset;
+		ulong	size = (*it).size;
+		
+		// the pages that are all file are mapped from the page cache, so every copy of the program shares them
+		if(addr % PAGE_SIZE == offset % PAGE_SIZE && (*it).fileSize <= size)
+		{
+			ulong	start = addr & ~(PAGE_SIZE - 1);
+			ulong	end = (addr + (*it).fileSize) & ~(PAGE_SIZE - 1);
+			
+			if(end > start &&
+			   PageCache::GetInstance().MapFile(procID, start, end - start,
+							    PageCache::PROT_READ | PageCache::PROT_WRITE | PageCache::PROT_EXEC,
+							    PageCache::MAP_PRIVATE | PageCache::MAP_FIXED,
+							    fd, offset & ~(PAGE_SIZE - 1)) >= 0)
+			{
+				offset += end - addr;
+				size -= end - addr;
+				addr = end;
+			}
+		}
+		
+		// whatever is left is read in
+		if(size > 0)
+			PhysicalMemManager::GetInstancePtr()->MapMemoryFromFile(fd, offset, size, addr, pageDirAddr);
 	}
 	
 	// close the file
@@ -33,6 +33,8 @@
 #include <InterruptManager.h>
 #include <SerialDriver.h>
 #include <KeyboardDriver.h>
+#include <FPUManager.h>
+#include <KernelStackPool.h>
 
 // Check if the bit in flags is set
 #define CHECK_FLAG(flags,bit)   	((flags) & (1 << (bit)))
@@ -248,6 +250,20 @@ extern "C" void InitTasks(void)
 	theInterruptManager.InstallHandler(&KeyboardDriver::GetInstance(), IRQ_1);
 	DEBUG_NL("DONE\n");
 
+	//
+	// Setup the pool of thread stacks, this must be done before any page directories are made
+	//
+	DEBUG("Creating the kernel stack pool...");
+	KernelStackPool::GetInstance();
+	DEBUG_NL("DONE\n");
+	
+	//
+	// Setup lazy FPU switching, this must be done before any threads are made
+	//
+	DEBUG("Installing FPU handler...");
+	theInterruptManager.InstallHandler(&FPUManager::GetInstance(), INT_NO_COPROCESSOR);
+	DEBUG_NL("DONE\n");
+	
 	//
 	// Setup the one and only process manager.
 	//
@@ -21,6 +21,7 @@
 #include <types.h>
 #include <AutoDisable.h>
 #include <InterruptManager.h>
+#include <LatencyStats.h>
 #include <PhysicalMemManager.h>
 #include <i386.h>
 #include <mem_utils.h>
@@ -43,7 +44,7 @@ InterruptManager::InterruptManager()
 	// the first 32 are all CPU reserved
 	for(uchar i=0; i < NUM_RESERVED_INTERRUPTS; ++i)
 	{
-		if(i != INT_PAGE_FAULT)
+		if(i != INT_PAGE_FAULT && i != INT_NO_COPROCESSOR)
 			InstallHandler(nullHandler, i);
 	}
  	
@@ -63,6 +64,8 @@ InterruptManager::InterruptManager()
 
 int InterruptManager::Dispatcher(Registers *regs)
 {
+	ulonglong	startTime = LatencyStats::ReadTimeStamp();
+	ulong		switches = LatencyStats::GetSwitchCount();
 	AutoDisable	lock;
 	int		ret = 0;
 	
@@ -91,6 +94,11 @@ int InterruptManager::Dispatcher(Registers *regs)
 		outb(0x20, 0x20);
 	}
 	
+	LatencyStats::RecordInterrupt(regs->int_no, startTime, switches);
+	
+	// the interrupt gate turned interrupts off, so lock above never recorded this
+	LatencyStats::RecordInterruptsOff(startTime, switches, regs->eip, regs->int_no);
+	
 	return(ret);
 }
 
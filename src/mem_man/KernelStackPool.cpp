@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file KernelStackPool.cpp
+ *
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <AutoDisable.h>
+#include <KernelStackPool.h>
+#include <PhysicalMemManager.h>
+#include <ProcessManager.h>
+#include <Debug.h>
+
+KernelStackPool::KernelStackPool()
+	: mappedPages(NUM_SLOTS, 0), nextSlot(0)
+{
+	AutoDisable	lock;
+
+	// the first mapping creates the region's page table in the kernel's page directory
+	for(uint i=0; i < PREALLOCATED_STACKS; ++i)
+	{
+		MapSlot(nextSlot, Thread::DEFAULT_STACK_SIZE / PAGE_SIZE);
+		freeSlots.push_back(nextSlot++);
+	}
+}
+
+uchar *KernelStackPool::Allocate(ulong stackSize)
+{
+	AutoDisable	lock;
+	uint		numPages = (stackSize + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	if(numPages > MAX_STACK_PAGES)
+	{
+		WARN("Stack of %d bytes is too big for the pool, using the heap\n", stackSize);
+		return(new uchar[stackSize]);
+	}
+
+	uint	slot;
+
+	if(freeSlots.size() != 0)	// reuse a slot, usually it's already mapped
+	{
+		slot = freeSlots[freeSlots.size() - 1];
+		freeSlots.pop_back();
+	}
+
+	else if(nextSlot < NUM_SLOTS)
+		slot = nextSlot++;
+
+	else
+	{
+		PANIC("Out of kernel stacks\n");
+		return(NULL);
+	}
+
+	MapSlot(slot, numPages);
+
+	return(reinterpret_cast<uchar*>(SlotTop(slot) - stackSize));
+}
+
+void KernelStackPool::Free(uchar *stack)
+{
+	AutoDisable	lock;
+	ulong		addr = reinterpret_cast<ulong>(stack);
+
+	if(addr < KERNEL_STACK_REGION || addr >= KERNEL_STACK_REGION + NUM_SLOTS * SLOT_PAGES * PAGE_SIZE)
+	{
+		delete [] stack;	// came from the heap
+		return;
+	}
+
+	// the pages stay mapped for the next thread
+	freeSlots.push_back((addr - KERNEL_STACK_REGION) / (SLOT_PAGES * PAGE_SIZE));
+}
+
+void KernelStackPool::MapSlot(uint slot, uint numPages)
+{
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+
+	// map from the top down, the bottom page of the slot is always left alone
+	for(uint i = mappedPages[slot]; i < numPages; ++i)
+	{
+		physMemMan->MapPage(SlotTop(slot) - (i + 1) * PAGE_SIZE,
+				    physMemMan->FindFreePage(),
+				    physMemMan->GetCurrentPageDirectory(),
+				    KERNEL_PID);
+	}
+
+	if(numPages > mappedPages[slot])
+		mappedPages[slot] = numPages;
+}
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file PageCache.cpp
+ *
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <errno.h>
+#include <algorithms.h>
+#include <mem_utils.h>
+#include <AutoDisable.h>
+#include <PageCache.h>
+#include <PhysicalMemManager.h>
+#include <ProcessManager.h>
+#include <Debug.h>
+
+using k_std::find;
+
+PageCache::PageCache()
+{
+}
+
+int PageCache::Map(ulong addr, ulong length, int prot, int flags, int fileDescriptor, int offset)
+{
+	ProcessManager	&procMan = ProcessManager::GetInstance();
+
+	// get the file descriptor pointer
+	FileDescriptorBase *fd = procMan.GetFileDescriptor(fileDescriptor);
+
+	// return a that this a bad file descriptor
+	if(fd == NULL)
+		return(-1 * EBADF);
+
+	if(offset < 0)
+		return(-1 * EINVAL);
+
+	return(GetInstance().MapFile(procMan.GetCurrentProcID(), addr, length, prot, flags, fd, offset));
+}
+
+int PageCache::Unmap(ulong addr, ulong length)
+{
+	if(addr % PAGE_SIZE != 0 || length == 0 || addr >= KERNEL_BASE_ADDR || length > KERNEL_BASE_ADDR - addr)
+		return(-1 * EINVAL);
+
+	ProcessManager	&procMan = ProcessManager::GetInstance();
+	ulong		end = addr + ((length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+	GetInstance().UnmapRange(*procMan.GetProcMappings(procMan.GetCurrentProcID()), addr, end);
+
+	return(0);
+}
+
+int PageCache::MapFile(uint procID, ulong addr, ulong length, int prot, int flags, FileDescriptorBase *fd, ulong offset)
+{
+	// it has to be one or the other
+	if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+		return(-1 * EINVAL);
+
+	if(length == 0 || length > KERNEL_BASE_ADDR || addr % PAGE_SIZE != 0 || offset % PAGE_SIZE != 0)
+		return(-1 * EINVAL);
+
+	// nothing writes the pages back to the file
+	if((flags & MAP_SHARED) && (prot & PROT_WRITE))
+		return(-1 * EACCES);
+
+	length = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	if(addr != 0 && length > KERNEL_BASE_ADDR - addr)
+		return(-1 * EINVAL);
+
+	ProcessManager		&procMan = ProcessManager::GetInstance();
+	list<Mapping>		*mappings = procMan.GetProcMappings(procID);
+	bool			current = procID == procMan.GetCurrentProcID();
+
+	// addr is only a hint unless it's fixed
+	if(addr != 0 && !(flags & MAP_FIXED) && Overlaps(*mappings, addr, addr + length))
+		addr = 0;
+
+	if(addr == 0 && (addr = FindFreeRange(*mappings, length)) == 0)
+		return(-1 * ENOMEM);
+
+	// only the current address space's pages can be unmapped
+	if(Overlaps(*mappings, addr, addr + length))
+	{
+		if(!current)
+			return(-1 * EINVAL);
+
+		UnmapRange(*mappings, addr, addr + length);
+	}
+
+	Mapping	newMapping;
+	int	ret = GetFile(fd, newMapping.file);
+
+	if(ret < 0)
+		return(ret);
+
+	newMapping.start = addr;
+	newMapping.length = length;
+	newMapping.offset = offset;
+	newMapping.prot = prot;
+	newMapping.flags = flags;
+
+	// keep them sorted so FindFreeRange can walk the gaps
+	list<Mapping>::iterator	it = mappings->begin();
+
+	while(it != mappings->end() && (*it).start < addr)
+		++it;
+
+	mappings->insert(it, newMapping);
+
+	return(int(addr));
+}
+
+bool PageCache::HandleFault(ulong addr, ulong errorCode)
+{
+	ProcessManager	&procMan = ProcessManager::GetInstance();
+	list<Mapping>	*mappings = procMan.GetProcMappings(procMan.GetCurrentProcID());
+	Mapping		*mapping = NULL;
+
+	for(list<Mapping>::iterator it = mappings->begin(); it != mappings->end(); ++it)
+	{
+		if(addr >= (*it).start && addr - (*it).start < (*it).length)
+		{
+			mapping = &(*it);
+			break;
+		}
+	}
+
+	if(mapping == NULL || mapping->prot == PROT_NONE)
+		return(false);
+
+	// for error codes see Intel Vol 3 5-45
+	bool	present = errorCode & 0x1;
+	bool	write = errorCode & 0x2;
+
+	if(write && !(mapping->prot & PROT_WRITE))
+		return(false);
+
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+	ulong			procID = procMan.GetCurrentProcID();
+	ulong			pageDir = procMan.GetProcPageDir(procID);
+
+	// the first touch maps the cached page, it is never written through
+	if(!present)
+	{
+		ulong	index = (mapping->offset + (addr - mapping->start)) / PAGE_SIZE;
+		ulong	page = GetPage(mapping->file, index);
+
+		if(page == 0)
+			return(false);
+
+		physMemMan->MapPage(addr, page, pageDir, procID, false);
+
+		if(!write)
+			return(true);
+	}
+
+	// the page is there and readable, so this wasn't a copy-on-write fault
+	else if(!write)
+		return(false);
+
+	// a write to a private mapping gets its own copy
+	physMemMan->CopyPage(addr, pageDir, procID);
+
+	return(true);
+}
+
+void PageCache::HoldMappings(list<Mapping> &mappings)
+{
+	AutoDisable	lock;
+
+	for(list<Mapping>::iterator it = mappings.begin(); it != mappings.end(); ++it)
+		++(*it).file->mapCount;
+}
+
+void PageCache::ReleaseMappings(list<Mapping> &mappings)
+{
+	// the private copies are on the proc's used page list, they're freed with it
+	for(list<Mapping>::iterator it = mappings.begin(); it != mappings.end(); ++it)
+		PutFile((*it).file);
+
+	mappings.clear();
+}
+
+int PageCache::GetFile(FileDescriptorBase *fd, CachedFile *&file)
+{
+	FileSystemBase		*fileSystem = fd->GetFileSystem();
+	FileSystemBase::stat	fileStat;
+
+	MemSet(&fileStat, 0, sizeof(fileStat));
+
+	int ret = fileSystem->FileStat(fd, &fileStat);
+
+	if(ret < 0)
+		return(ret);
+
+	// we can only open the file again by its inode
+	if(fileStat.inodeNumber == 0)
+		return(-1 * ENODEV);
+
+	if((file = FindFile(fileSystem, fileStat.inodeNumber)) != NULL)
+		return(0);
+
+	// our own descriptor, the process can close theirs while the file is still mapped
+	FileDescriptorBase	*ourFd = fileSystem->CreateFileDescriptor(fileSystem);
+
+	if((ret = fileSystem->OpenInode(ourFd, fileStat.inodeNumber, 0)) < 0)
+	{
+		fileSystem->DestroyFileDescriptor(ourFd);
+		return(ret == -1 * ENOSYS ? -1 * ENODEV : ret);
+	}
+
+	CachedFile	*newFile = new CachedFile;
+
+	newFile->fileSystem = fileSystem;
+	newFile->inode = fileStat.inodeNumber;
+	newFile->fd = ourFd;
+	newFile->mapCount = 1;
+
+	{
+		AutoDisable	lock;
+
+		// someone else might have opened it while we were
+		if((file = FindFile(fileSystem, fileStat.inodeNumber)) == NULL)
+		{
+			files.push_back(newFile);
+			file = newFile;
+			return(0);
+		}
+	}
+
+	// use theirs
+	fileSystem->Close(ourFd);
+	fileSystem->DestroyFileDescriptor(ourFd);
+
+	delete newFile;
+
+	return(0);
+}
+
+PageCache::CachedFile *PageCache::FindFile(FileSystemBase *fileSystem, ulong inode)
+{
+	AutoDisable	lock;
+
+	for(list<CachedFile*>::iterator it = files.begin(); it != files.end(); ++it)
+	{
+		if((*it)->fileSystem == fileSystem && (*it)->inode == inode)
+		{
+			++(*it)->mapCount;
+			return(*it);
+		}
+	}
+
+	return(NULL);
+}
+
+void PageCache::PutFile(CachedFile *file)
+{
+	{
+		AutoDisable	lock;
+
+		if(--file->mapCount != 0)
+			return;
+
+		files.erase(find(files.begin(), files.end(), file));
+	}
+
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+
+	for(uint i=0; i < file->pages.size(); ++i)
+	{
+		if(file->pages[i] != 0)
+			physMemMan->FreePage(file->pages[i]);
+	}
+
+	file->fileSystem->Close(file->fd);
+	file->fileSystem->DestroyFileDescriptor(file->fd);
+
+	delete file;
+}
+
+ulong PageCache::GetPage(CachedFile *file, ulong index)
+{
+	{
+		AutoDisable	lock;
+
+		if(index < file->pages.size() && file->pages[index] != 0)
+			return(file->pages[index]);
+	}
+
+	// read into the kernel's memory, the process never sees the page until it's all there
+	uchar	*buff = new uchar[PAGE_SIZE];
+	int	ret = file->fileSystem->ReadAt(file->fd, buff, PAGE_SIZE, index * PAGE_SIZE);
+
+	if(ret < 0)
+	{
+		DEBUG("READ ERROR: %d\n", ret);
+		delete [] buff;
+		return(0);
+	}
+
+	// past the end of the file is zeros
+	MemSet(buff + ret, 0, PAGE_SIZE - ret);
+
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+	ulong			page;
+
+	{
+		AutoDisable	lock;
+
+		page = physMemMan->FindFreePage();
+	}
+
+	physMemMan->CopyToPage(page, buff);
+
+	delete [] buff;
+
+	AutoDisable	lock;
+
+	while(file->pages.size() <= index)
+		file->pages.push_back(0);
+
+	// another process read it in at the same time, use theirs
+	if(file->pages[index] != 0)
+	{
+		physMemMan->FreePage(page);
+		return(file->pages[index]);
+	}
+
+	file->pages[index] = page;
+
+	return(page);
+}
+
+void PageCache::UnmapPages(Mapping &mapping, ulong start, ulong end)
+{
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+
+	for(ulong addr = start; addr < end; addr += PAGE_SIZE)
+	{
+		ulong	page = physMemMan->UnmapPage(addr);
+		ulong	index = (mapping.offset + (addr - mapping.start)) / PAGE_SIZE;
+
+		if(page == 0)
+			continue;
+
+		// it isn't the cached page, so it is this process's private copy
+		if(index >= mapping.file->pages.size() || mapping.file->pages[index] != page)
+			physMemMan->FreePage(page);
+	}
+}
+
+void PageCache::UnmapRange(list<Mapping> &mappings, ulong start, ulong end)
+{
+	list<Mapping>::iterator	it = mappings.begin();
+
+	while(it != mappings.end())
+	{
+		Mapping	&mapping = *it;
+		ulong	mappingEnd = mapping.start + mapping.length;
+
+		if(mappingEnd <= start || mapping.start >= end)
+		{
+			++it;
+			continue;
+		}
+
+		ulong	holeStart = MAX(mapping.start, start);
+		ulong	holeEnd = MIN(mappingEnd, end);
+
+		UnmapPages(mapping, holeStart, holeEnd);
+
+		// a hole in the middle leaves two mappings of the same file
+		if(holeStart > mapping.start && holeEnd < mappingEnd)
+		{
+			Mapping	tail = mapping;
+
+			tail.start = holeEnd;
+			tail.length = mappingEnd - holeEnd;
+			tail.offset = mapping.offset + (holeEnd - mapping.start);
+
+			mapping.length = holeStart - mapping.start;
+
+			{
+				AutoDisable	lock;
+
+				++mapping.file->mapCount;
+			}
+
+			mappings.insert(++it, tail);
+		}
+
+		// the end was taken off
+		else if(holeStart > mapping.start)
+		{
+			mapping.length = holeStart - mapping.start;
+			++it;
+		}
+
+		// the start was taken off
+		else if(holeEnd < mappingEnd)
+		{
+			mapping.offset += holeEnd - mapping.start;
+			mapping.length = mappingEnd - holeEnd;
+			mapping.start = holeEnd;
+			++it;
+		}
+
+		// all of it
+		else
+		{
+			PutFile(mapping.file);
+			it = mappings.erase(it);
+		}
+	}
+}
+
+bool PageCache::Overlaps(list<Mapping> &mappings, ulong start, ulong end)
+{
+	for(list<Mapping>::iterator it = mappings.begin(); it != mappings.end(); ++it)
+	{
+		if((*it).start < end && start < (*it).start + (*it).length)
+			return(true);
+	}
+
+	return(false);
+}
+
+ulong PageCache::FindFreeRange(list<Mapping> &mappings, ulong length)
+{
+	ulong	start = MAP_BASE;
+
+	// the mappings are sorted, so take the first gap that is big enough
+	for(list<Mapping>::iterator it = mappings.begin(); it != mappings.end(); ++it)
+	{
+		if((*it).start + (*it).length <= start)
+			continue;
+
+		if((*it).start >= start + length)
+			break;
+
+		start = (*it).start + (*it).length;
+	}
+
+	if(length > KERNEL_BASE_ADDR - start)
+		return(0);
+
+	return(start);
+}
+
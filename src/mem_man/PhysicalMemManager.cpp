@@ -21,6 +21,8 @@
 #include <Debug.h>
 #include <mem_utils.h>
 #include <AutoDisable.h>
+#include <UserAccess.h>
+#include <PageCache.h>
 
 PhysicalMemManager *PhysicalMemManager::myself;
 bool PhysicalMemManager::created = false;
@@ -32,6 +34,7 @@ PhysicalMemManager::PhysicalMemManager(ulong startRAM, ulong endRAM, PageTableEn
 	: startAddr(RoundUpAPage(startRAM)),
 	  endAddr(RoundDownAPage(endRAM)), 
 	  freePages((endAddr - startAddr) / PAGE_SIZE, true),
+	  pageShares((endAddr - startAddr) / PAGE_SIZE, 0),
 	  currentPageDirectory(ulong(pageDir) - VIRTUAL_OFFSET)
 {
 	if(created)
@@ -86,6 +89,23 @@ int PhysicalMemManager::Handle(Registers *regs)
 		
 	// get the address of the page fault
 	asm __volatile__ ("movl %%cr2, %%eax;\n movl %%eax, %0": "=r" (addr) : : "%eax");
+	
+	// a write to a page a forked process still has, from the process or from the kernel copying to it
+	if(addr < KERNEL_BASE_ADDR && HandleCopyOnWrite(RoundDownAPage(addr), regs->err_code))
+		return(0);
+	
+	// a page of a mapped file that isn't read in yet, or a write to a private one,
+	// this comes first so a system call copying to or from a mapping gets the page
+	if(addr < KERNEL_BASE_ADDR && PageCache::GetInstance().HandleFault(RoundDownAPage(addr), regs->err_code))
+		return(0);
+	
+	// a bad pointer passed to a system call, the copy routine returns EFAULT
+	if(FixupUserAccessFault(regs))
+		return(0);
+	
+	// only the guard pages are unmapped in the stack region
+	if(addr >= KERNEL_STACK_REGION && addr < KERNEL_STACK_REGION + PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES)
+		PANIC("Thread stack overflow, FAULT ADDR: 0x%x  EIP: 0x%x\n", addr, regs->eip);
 		
 	PANIC("FAULT ADDR: 0x%x  ERROR CODE: 0x%x\n", addr, regs->err_code);
 // 	DEBUG("CURRENT PAGE DIR: 0x%x   KERNEL PAGE DIR: 0x%x\n", currentPageDirectory, ulong(pageDir) - VIRTUAL_OFFSET);
@@ -141,7 +161,40 @@ int PhysicalMemManager::Handle(Registers *regs)
 	return(0);
 }
 
-void PhysicalMemManager::MapPage(ulong virtualAddress, ulong physicalPage, ulong pageDirPhysAddress, ulong procID)
+bool PhysicalMemManager::HandleCopyOnWrite(ulong virtualAddress, ulong errorCode)
+{
+	AutoDisable	lock;
+	
+	// for error codes see Intel Vol 3 5-45, this has to be a write to a page that is there
+	if((errorCode & 0x3) != 0x3 || thePageDir[AddressToDirIndex(virtualAddress)].present != 1)
+		return(false);
+	
+	PageTableEntry	&entry = thePageTables[AddressToPageNumber(virtualAddress)];
+	
+	if(entry.present != 1 || !(entry.sysProgUse & PAGE_COPY_ON_WRITE))
+		return(false);
+	
+	ulong	page = entry.pageAddr << 12;
+	
+	// the other processes have made their own copies, so this one can have the page
+	if(pageShares[(page - startAddr) / PAGE_SIZE] == 0)
+	{
+		entry.readWrite = 1;
+		entry.sysProgUse &= ~PAGE_COPY_ON_WRITE;
+		FlushTLB();
+		
+		return(true);
+	}
+	
+	CopyPage(virtualAddress, currentPageDirectory, ProcessManager::GetInstance().GetCurrentProcID());
+	
+	// this only lets go of our share of the page
+	FreePage(page);
+	
+	return(true);
+}
+
+void PhysicalMemManager::MapPage(ulong virtualAddress, ulong physicalPage, ulong pageDirPhysAddress, ulong procID, bool writable)
 {
 	if(currentPageDirectory == ulong(pageDir) || pageDirPhysAddress == ulong(pageDir))
 		PANIC("WRONG PAGE DIR");
@@ -182,8 +235,9 @@ void PhysicalMemManager::MapPage(ulong virtualAddress, ulong physicalPage, ulong
 	// add it to the page table
 	thePageTables[pageNumber].pageAddr = PHYS2STRUCTADDR(physicalPage);
 	thePageTables[pageNumber].present = 1;		// set the present bit
-	thePageTables[pageNumber].readWrite = 1;	// set the read/write bit
+	thePageTables[pageNumber].readWrite = writable;	// set the read/write bit
 	thePageTables[pageNumber].userSuper = priv;	// set the privledge level
+	thePageTables[pageNumber].sysProgUse = 0;	// it isn't shared with anyone
 
 	if(pageDirPhysAddress != currentPageDirectory)	// reset to the oldPageDir if needed
 		SetPageDirectory(oldPageDir);
@@ -234,6 +288,41 @@ ulong PhysicalMemManager::CopyPageDirectory(ulong procID, ulong srcPageDir)
 {
 	AutoDisable	lock;
 	
+	ulong	oldPageDir = currentPageDirectory;
+	
+	// the source's page tables have to be mapped in to mark its pages
+	SetPageDirectory(srcPageDir);
+	
+	// the writable user pages are shared until one of the processes writes to them
+	for(uint i=0; i < AddressToDirIndex(KERNEL_BASE_ADDR); ++i)
+	{
+		if(thePageDir[i].present != 1 || !thePageDir[i].userSuper)
+			continue;
+		
+		for(uint j = i * NUM_PAGE_TABLE_ENTRIES; j < (i + 1) * NUM_PAGE_TABLE_ENTRIES; ++j)
+		{
+			PageTableEntry	&entry = thePageTables[j];
+			ulong		page = entry.pageAddr << 12;
+			
+			// memory outside of RAM, like the video card's, stays shared
+			if(entry.present != 1 || page < startAddr || page >= endAddr)
+				continue;
+			
+			// the other read-only pages are the page cache's, they're never written
+			if(entry.readWrite != 1 && !(entry.sysProgUse & PAGE_COPY_ON_WRITE))
+				continue;
+			
+			entry.readWrite = 0;
+			entry.sysProgUse |= PAGE_COPY_ON_WRITE;
+			
+			// the new process holds the page too, it lets go when it copies the page or exits
+			++pageShares[(page - startAddr) / PAGE_SIZE];
+			usedPages.push_back(PageInfo(procID, page, j * PAGE_SIZE));
+		}
+	}
+	
+	FlushTLB();
+	
 	ulong	retPhysAddr = FindFreePage();
 	
 	if(procID != KERNEL_PID)	// keep only if NOT kernel
@@ -271,33 +360,44 @@ ulong PhysicalMemManager::CopyPageDirectory(ulong procID, ulong srcPageDir)
 	
 	MemCopy(pDirEntry, thePageDir, sizeof(PageTableEntry) * NUM_PAGE_TABLE_ENTRIES);
 	
-	// go through each page table entry in user-land and make those that are present read-only
-	for(int i=0; i < NUM_PAGE_TABLE_ENTRIES; ++i)
-	{
-		// only set those that are user-land and present
-		if(pDirEntry[i].userSuper && pDirEntry[i].present)
-		{
-			DEBUG("SETTING ENTRY: %d\n", i);
-			pDirEntry[i].readWrite = 0;	// make read-only
-		}
-	}
-	
 	// restore the entries
 	theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1] = tmpEntry1;
 	theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-2] = tmpEntry2;
 	
 	FlushTLB();	// do another flush here so that we're back to where we were
+	
+	// give the copy its own page tables, so a page mapped into one process isn't mapped into both
+	SetPageDirectory(retPhysAddr);
+	
+	for(uint i=0; i < AddressToDirIndex(KERNEL_BASE_ADDR); ++i)
+	{
+		if(thePageDir[i].present != 1 || !thePageDir[i].userSuper)
+			continue;
+		
+		ulong	table = FindFreePage();
+		
+		usedPages.push_back(PageInfo(procID, table, i * PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES));
+		CopyToPage(table, &thePageTables[i * NUM_PAGE_TABLE_ENTRIES]);
+		
+		thePageDir[i].pageTableAddr = theVirtualPageTable[i].pageAddr = PHYS2STRUCTADDR(table);
+	}
+	
+	FlushTLB();
+	SetPageDirectory(oldPageDir);
 
 	return(retPhysAddr);
 }
 
-void PhysicalMemManager::CopyPage(ulong virtualAddress, ulong pageDirPhysAddress)
+void PhysicalMemManager::CopyPage(ulong virtualAddress, ulong pageDirPhysAddress, ulong procID)
 {
 	AutoDisable lock;
 	
 	ulong	newPage = FindFreePage();	// get a new page
 	ulong	oldPageDir = currentPageDirectory;
 	
+	if(procID != KERNEL_PID)	// keep only if NOT kernel
+		usedPages.push_back(PageInfo(procID, newPage, virtualAddress));
+	
 	
 	// see if we need to map a new page directory in
 	if(pageDirPhysAddress != currentPageDirectory)
@@ -306,7 +406,7 @@ void PhysicalMemManager::CopyPage(ulong virtualAddress, ulong pageDirPhysAddress
 	uint	pageNumber = AddressToPageNumber(virtualAddress);
 
 	DEBUG("PAGE NUMBER: %d\n", pageNumber);
-	DEBUG("%s\n", theVirtualPageTable[pageNumber].readWrite == 0 ? "READ" : "WRITE");
+	DEBUG("%s\n", thePageTables[pageNumber].readWrite == 0 ? "READ" : "WRITE");
 			
 	// save off the last entry, the page directory
 	PageTableEntry	tmpEntry = theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1];
@@ -328,8 +428,9 @@ void PhysicalMemManager::CopyPage(ulong virtualAddress, ulong pageDirPhysAddress
 	theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1] = tmpEntry;
 
 	// map in the new page
-	theVirtualPageTable[pageNumber].pageAddr = PHYS2STRUCTADDR(newPage);
-	theVirtualPageTable[pageNumber].readWrite = 1;	// allow writes
+	thePageTables[pageNumber].pageAddr = PHYS2STRUCTADDR(newPage);
+	thePageTables[pageNumber].readWrite = 1;	// allow writes
+	thePageTables[pageNumber].sysProgUse &= ~PAGE_COPY_ON_WRITE;	// the copy is ours alone
 	
 	// reset to the oldPageDir if needed
 	if(pageDirPhysAddress != currentPageDirectory)
@@ -339,6 +440,31 @@ void PhysicalMemManager::CopyPage(ulong virtualAddress, ulong pageDirPhysAddress
 		FlushTLB();
 }
 
+void PhysicalMemManager::CopyToPage(ulong physicalPage, const void *src)
+{
+	AutoDisable lock;
+	
+	// save off the last entry, the page directory
+	PageTableEntry	tmpEntry = theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1];
+	
+	// zero it out the entry
+	MemSet(&theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1], 0, sizeof(PageTableEntry));
+	
+	// map in the page where the page directory was
+	theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1].pageAddr  = PHYS2STRUCTADDR(physicalPage);
+	theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1].present   = 1;	// set to present
+	theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1].readWrite = 1;	// set so we can write to it
+	
+	FlushTLB();	// do a flush here so we're sure we're copying to the right spot
+	
+	MemCopy(thePageDir, src, PAGE_SIZE);
+	
+	// restore the entry to what it was before we got here
+	theVirtualPageTable[NUM_PAGE_TABLE_ENTRIES-1] = tmpEntry;
+	
+	FlushTLB();	// do another flush here so that we're back to where we were
+}
+
 void PhysicalMemManager::SetToKernelPageDirectory()
 {
 	PhysicalMemManager::GetInstancePtr()->SetPageDirectory(ulong(pageDir) - VIRTUAL_OFFSET);
@@ -408,6 +534,43 @@ ulong PhysicalMemManager::FindFreePage()
 	return (lastFree - freePages.begin()) * PAGE_SIZE + startAddr;
 }
 
+void PhysicalMemManager::FreePage(ulong physicalPage)
+{
+	AutoDisable	lock;
+	
+	ulong	index = (physicalPage - startAddr) / PAGE_SIZE;
+	
+	// a forked process still has the page, so only the current process lets go of it
+	if(pageShares[index] != 0)
+	{
+		ulong	procID = ProcessManager::GetInstance().GetCurrentProcID();
+		
+		--pageShares[index];
+		
+		for(usedPageIt_t it = usedPages.begin(); it != usedPages.end(); ++it)
+		{
+			if((*it).procID == procID && (*it).physcialAddr == physicalPage)
+			{
+				usedPages.erase(it);
+				break;
+			}
+		}
+		
+		return;
+	}
+	
+	for(usedPageIt_t it = usedPages.begin(); it != usedPages.end(); ++it)
+	{
+		if((*it).physcialAddr == physicalPage)
+		{
+			usedPages.erase(it);
+			break;
+		}
+	}
+	
+	freePages[index] = true;
+}
+
 void PhysicalMemManager::FreeProcPages(ulong procID)
 {
 	AutoDisable	lock;
@@ -429,7 +592,16 @@ void PhysicalMemManager::FreeProcPages(ulong procID)
 
 	// go through the list getting the physical addresses and freeing them in the free table
 	for(usedPageIt_t it = first; it != last; ++it)
-		freePages[((*it).physcialAddr - startAddr)/PAGE_SIZE] = true;
+	{
+		ulong	index = ((*it).physcialAddr - startAddr)/PAGE_SIZE;
+		
+		// a forked process still has it mapped
+		if(pageShares[index] != 0)
+			--pageShares[index];
+		
+		else
+			freePages[index] = true;
+	}
 
 	// remove them from the used list
 	usedPages.erase(first, last);
@@ -440,12 +612,9 @@ void PhysicalMemManager::MapMemoryFromFile(FileDescriptorBase *fd, int offset, u
 	AutoDisable		lock;
 	int			ret;
 	
-	// seek to the proper offset
-	ret = fd->GetFileSystem()->Seek(fd, offset, FileSystemBase::SEEK_SET);
-	
-	if(ret < 0)
+	if(offset < 0)
 	{
-		DEBUG("SEEK RETURNED: %d\n", ret);
+		DEBUG("BAD OFFSET: %d\n", offset);
 		return;
 	}
 	
@@ -459,8 +628,8 @@ void PhysicalMemManager::MapMemoryFromFile(FileDescriptorBase *fd, int offset, u
 	// make a pointer to the spot in memory to write the data
 	uchar	*memAddr = reinterpret_cast<uchar*>(addr);
 	
-	// read the data into that memory location
-	ret = fd->GetFileSystem()->Read(fd, memAddr, amount);
+	// read the data into that memory location, straight from the offset without seeking
+	ret = fd->GetFileSystem()->ReadAt(fd, memAddr, amount, offset);
 	
 	if(ret < 0)
 	{
@@ -496,6 +665,39 @@ void PhysicalMemManager::GetStats(ulong &usedPageCount, ulong &freePageCount)
 }
 
 
+ulong PhysicalMemManager::UnmapPage(ulong virtualAddress)
+{
+	// the page table isn't there, so neither is the page
+	if(thePageDir[AddressToDirIndex(virtualAddress)].present != 1)
+		return(0);
+	
+	PageTableEntry	&entry = thePageTables[AddressToPageNumber(virtualAddress)];
+	
+	if(entry.present != 1)
+		return(0);
+	
+	ulong	physicalPage = entry.pageAddr << 12;
+	
+	MemSet(&entry, 0, sizeof(PageTableEntry));
+	FlushTLB();
+	
+	return(physicalPage);
+}
+
+ulong PhysicalMemManager::VirtualToPhysical(ulong virtualAddress)
+{
+	// the page table isn't there, so neither is the page
+	if(thePageDir[AddressToDirIndex(virtualAddress)].present != 1)
+		return(0);
+	
+	PageTableEntry	&entry = thePageTables[AddressToPageNumber(virtualAddress)];
+	
+	if(entry.present != 1)
+		return(0);
+	
+	return((entry.pageAddr << 12) | (virtualAddress % PAGE_SIZE));
+}
+
 
 ulong PhysicalMemManager::RoundDownAPage(ulong arg)
 {
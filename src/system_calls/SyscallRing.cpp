@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file SyscallRing.cpp
+ *
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <errno.h>
+#include <i386.h>
+#include <SyscallRing.h>
+#include <ProcessManager.h>
+#include <FileSystemManager.h>
+#include <UserAccess.h>
+#include <AutoDisable.h>
+#include <mem_utils.h>
+#include <Debug.h>
+
+SyscallRing::SyscallRing(RingHeader *ring, ulong numEntries, uint procID)
+	: procID(procID), toRun(0), consumeLock(1), worker(NULL)
+{
+	Attach(ring, numEntries);
+}
+
+void SyscallRing::Attach(RingHeader *ring, ulong numEntries)
+{
+	header = ring;
+	mask = numEntries - 1;
+	toRun = 0;
+
+	// the submit entries follow the header, and the completions follow them
+	submitEntries = reinterpret_cast<SubmitEntry*>(ring + 1);
+	completeEntries = reinterpret_cast<CompleteEntry*>(submitEntries + numEntries);
+}
+
+int SyscallRing::ReadHeader(RingHeader &copy)
+{
+	return(CopyFromUser(&copy, header, sizeof(RingHeader)));
+}
+
+int SyscallRing::WriteIndex(volatile ulong *index, ulong value)
+{
+	return(CopyToUser(const_cast<ulong*>(index), &value, sizeof(ulong)));
+}
+
+int SyscallRing::Setup(RingHeader *ring, ulong numEntries)
+{
+	ProcessManager	&procMan = ProcessManager::GetInstance();
+
+	// only user processes have a ring
+	if(procMan.GetCurrentProcID() == KERNEL_PID)
+		return(-1 * EINVAL);
+
+	// must be a power of 2 so the indexes can be masked
+	if(ring == NULL || numEntries == 0 || numEntries > MAX_ENTRIES || (numEntries & (numEntries - 1)) != 0)
+		return(-1 * EINVAL);
+
+	// the whole ring must live in the process's part of the address space
+	if(!IsValidUserRange(ring, GetRingSize(numEntries)))
+		return(-1 * EFAULT);
+
+	SyscallRing	*cur = procMan.GetSyscallRing();
+
+	if(cur != NULL && cur->header != NULL)
+		return(-1 * EBUSY);
+
+	RingHeader	empty;
+
+	MemSet(&empty, 0, sizeof(RingHeader));
+	empty.numEntries = numEntries;
+
+	if(CopyToUser(ring, &empty, sizeof(RingHeader)) < 0)
+		return(-1 * EFAULT);
+
+	if(cur == NULL)
+		procMan.SetSyscallRing(new SyscallRing(ring, numEntries, procMan.GetCurrentProcID()));
+
+	else	// re-attach the old object, it might still own a worker thread
+	{
+		cur->consumeLock.Wait();
+		cur->Attach(ring, numEntries);
+		cur->consumeLock.Signal();
+	}
+
+	return(0);
+}
+
+int SyscallRing::Destroy()
+{
+	SyscallRing	*ring = ProcessManager::GetInstance().GetSyscallRing();
+
+	if(ring == NULL || ring->header == NULL)
+		return(-1 * EINVAL);
+
+	// wait for any consumer to finish before detaching
+	ring->consumeLock.Wait();
+	ring->header = NULL;
+	ring->consumeLock.Signal();
+
+	// let anyone waiting on completions see the ring is gone
+	ring->completions.SignalAll();
+
+	// the object, and the worker thread, stay with the process until it exits
+	return(0);
+}
+
+int SyscallRing::Submit(ulong toSubmit, ulong flags)
+{
+	ProcessManager	&procMan = ProcessManager::GetInstance();
+	SyscallRing	*ring = procMan.GetSyscallRing();
+	RingHeader	copy;
+
+	if(ring == NULL || ring->header == NULL)
+		return(-1 * EINVAL);
+
+	if(ring->ReadHeader(copy) < 0)
+		return(-1 * EFAULT);
+
+	ulong	pending = copy.submitTail - copy.submitHead;
+
+	// the process has corrupted the indexes
+	if(pending > ring->mask + 1)
+		return(-1 * EINVAL);
+
+	{
+		AutoDisable	lock;
+
+		// the entries handed to the worker that it hasn't run yet can't be submitted again
+		toSubmit = MIN(toSubmit, pending - MIN(pending, ring->toRun));
+		ring->toRun += toSubmit;
+	}
+
+	if(flags & ENTER_ASYNC)
+	{
+		// the worker runs in the process's address space with its file descriptors
+		if(ring->worker == NULL)
+			ring->worker = procMan.CreateThread(Worker, ring, Thread::KERNEL, ring->procID);
+
+		ring->workPending.Signal();
+
+		return(toSubmit);
+	}
+
+	// entries handed to the worker earlier are ahead of these, so they are run here too
+	return(ring->Drain());
+}
+
+int SyscallRing::GetEvents(ulong minComplete)
+{
+	SyscallRing	*ring = ProcessManager::GetInstance().GetSyscallRing();
+	RingHeader	copy;
+
+	if(ring == NULL || ring->header == NULL || minComplete > ring->mask + 1)
+		return(-1 * EINVAL);
+
+	while(1)
+	{
+		if(ring->header == NULL)
+			return(-1 * EINVAL);
+
+		if(ring->ReadHeader(copy) < 0)
+			return(-1 * EFAULT);
+
+		// without a worker nothing else will ever post a completion
+		if(ring->worker == NULL || copy.completeTail - copy.completeHead >= minComplete)
+			break;
+
+		ring->completions.Wait();
+	}
+
+	return(copy.completeTail - copy.completeHead);
+}
+
+int SyscallRing::Drain()
+{
+	RingHeader	copy;
+	ulong		consumed = 0;
+	int		ret = 0;
+
+	consumeLock.Wait();
+
+	// the process can change or unmap the ring at any time, so it is only read through copies
+	while(header != NULL && toRun != 0)
+	{
+		if((ret = ReadHeader(copy)) < 0)
+			break;
+
+		// the process took back entries it had submitted
+		if(copy.submitHead == copy.submitTail)
+		{
+			AutoDisable	lock;
+
+			toRun = 0;
+			break;
+		}
+
+		// leave the entry queued if there is no room for its completion
+		if(copy.completeTail - copy.completeHead > mask)
+			break;
+
+		SubmitEntry	entry;
+
+		if((ret = CopyFromUser(&entry, &submitEntries[copy.submitHead & mask], sizeof(SubmitEntry))) < 0)
+			break;
+
+		if((ret = WriteIndex(&header->submitHead, copy.submitHead + 1)) < 0)
+			break;
+
+		{
+			AutoDisable	lock;
+
+			--toRun;
+		}
+
+		CompleteEntry	complete;
+
+		complete.userData = entry.userData;
+		complete.result = Execute(entry);
+
+		if((ret = CopyToUser(&completeEntries[copy.completeTail & mask], &complete, sizeof(CompleteEntry))) < 0)
+			break;
+
+		if((ret = WriteIndex(&header->completeTail, copy.completeTail + 1)) < 0)
+			break;
+
+		completions.Signal();
+
+		++consumed;
+	}
+
+	consumeLock.Signal();
+
+	// a fault is only reported if nothing was run
+	return(consumed == 0 && ret < 0 ? ret : int(consumed));
+}
+
+int SyscallRing::Execute(const SubmitEntry &entry)
+{
+	switch(entry.opcode)
+	{
+	case OP_NOP:
+		return(0);
+
+	case OP_READ:
+		return(FileSystemManager::Read(entry.fd, reinterpret_cast<void*>(entry.addr), entry.length));
+
+	case OP_WRITE:
+		return(FileSystemManager::Write(entry.fd, reinterpret_cast<void*>(entry.addr), entry.length));
+
+	case OP_LSEEK:
+		return(FileSystemManager::Seek(entry.fd, entry.offset, entry.length));
+
+	case OP_OPEN:
+		return(FileSystemManager::Open(reinterpret_cast<const char*>(entry.addr), entry.length));
+
+	case OP_CLOSE:
+		FileSystemManager::Close(entry.fd);
+		return(0);
+
+	case OP_PREAD:
+		return(FileSystemManager::ReadAt(entry.fd, reinterpret_cast<void*>(entry.addr), entry.length, entry.offset));
+
+	case OP_PWRITE:
+		return(FileSystemManager::WriteAt(entry.fd, reinterpret_cast<void*>(entry.addr), entry.length, entry.offset));
+
+	default:
+		DEBUG("Unknown ring opcode: %d\n", entry.opcode);
+		return(-1 * EINVAL);
+	}
+}
+
+void SyscallRing::Worker(void *arg)
+{
+	SyscallRing	*ring = reinterpret_cast<SyscallRing*>(arg);
+
+	// this thread lives until the process exits
+	while(1)
+	{
+		ring->workPending.Wait();
+
+		ring->Drain();
+	}
+}
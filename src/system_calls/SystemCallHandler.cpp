@@ -20,6 +20,7 @@
 #include <constants.h>
 #include <types.h>
 #include <SystemCallHandler.h>
+#include <LatencyStats.h>
 #include <Debug.h>
 #include <errno.h>
 
@@ -42,6 +43,8 @@ int SystemCallHandler::Shutdown()
 
 int SystemCallHandler::Handle(Registers *regs)
 {
+	ulonglong	startTime = LatencyStats::ReadTimeStamp();
+	
 	if(regs->eax > systemCallTable.size())
 	{
 		ERROR("Invalid system call\n");
@@ -107,6 +110,8 @@ int SystemCallHandler::Handle(Registers *regs)
 			break;
 	}
 		
+	LatencyStats::RecordSystemCall(regs->eax, startTime);
+	
 	regs->eax = ret;	// set the return value
 	
 	return(ret);
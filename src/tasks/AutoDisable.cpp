@@ -20,6 +20,7 @@
 #include <constants.h>
 #include <types.h>
 #include <AutoDisable.h>
+#include <LatencyStats.h>
 #include <screen_utils.h>
 
 // Get the value in the EFLAGS register and check to see if interrupts are already on
@@ -35,6 +36,11 @@ AutoDisable::AutoDisable()
 	{
 		asm("cli");
 		turnOn = true;
+		
+		// record when and where so the irq off time can be tracked
+		startTime = LatencyStats::ReadTimeStamp();
+		switchCount = LatencyStats::GetSwitchCount();
+		location = reinterpret_cast<ulong>(__builtin_return_address(0));
 	}
 	
 	else	// they aren't on so we basically do nothing
@@ -45,14 +51,20 @@ AutoDisable::AutoDisable()
 AutoDisable::~AutoDisable()
 {
 	if(turnOn)
+	{
+		LatencyStats::RecordInterruptsOff(startTime, switchCount, location);
 		asm("sti");
+	}
 }
 
 // turn on interrupts if we should, and then don't turn off during destruction
 void AutoDisable::Enable()
 {
 	if(turnOn)
+	{
+		LatencyStats::RecordInterruptsOff(startTime, switchCount, location);
 		asm("sti");
+	}
 	
 	turnOn = false;
 }
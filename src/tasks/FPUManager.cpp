@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file FPUManager.cpp
+ *
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <AutoDisable.h>
+#include <FPUManager.h>
+#include <ProcessManager.h>
+#include <mem_utils.h>
+#include <Debug.h>
+
+FPUManager::FPUManager()
+	: owner(NULL), useFXSave(false), stateSize(FSAVE_SIZE), initialState(NULL),
+	  freeStates(NULL), pooled(0), reserved(0)
+{
+	;
+}
+
+int FPUManager::Startup()
+{
+	ulong	eax, ebx, ecx, edx;
+	ulong	cr0, cr4;
+
+	asm __volatile__ ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+
+	useFXSave = (edx & CPUID_FXSR) != 0;
+	stateSize = useFXSave ? FXSAVE_SIZE : FSAVE_SIZE;
+
+	// use the FPU directly and have it report errors as exceptions
+	asm __volatile__ ("movl %%cr0, %0" : "=r" (cr0));
+	cr0 = (cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE;
+	asm __volatile__ ("movl %0, %%cr0" : : "r" (cr0));
+
+	if(useFXSave)
+	{
+		asm __volatile__ ("movl %%cr4, %0" : "=r" (cr4));
+		cr4 |= CR4_OSFXSR;
+
+		if(edx & CPUID_SSE)
+			cr4 |= CR4_OSXMMEXCPT;
+
+		asm __volatile__ ("movl %0, %%cr4" : : "r" (cr4));
+	}
+
+	// record what a freshly initialized FPU looks like
+	asm __volatile__ ("fninit");
+
+	if(edx & CPUID_SSE)
+	{
+		ulong	mxcsr = DEFAULT_MXCSR;
+		asm __volatile__ ("ldmxcsr %0" : : "m" (mxcsr));
+	}
+
+	initialState = new uchar[stateSize + STATE_ALIGN];
+	initialState += STATE_ALIGN - (reinterpret_cast<ulong>(initialState) % STATE_ALIGN);	// never freed
+
+	Save(initialState);
+
+	// nobody owns the FPU yet, so the first user traps
+	SetTaskSwitched();
+
+	DEBUG("FPU: %s save areas of %d bytes\n", useFXSave ? "FXSAVE" : "FSAVE", stateSize);
+
+	return(0);
+}
+
+int FPUManager::Handle(Registers *regs)
+{
+	(void)regs;
+
+	Thread	*cur = ProcessManager::GetInstance().GetCurrentThread();
+
+	// let the FPU be used again
+	asm __volatile__ ("clts");
+
+	if(cur == owner)	// it's already loaded
+		return(0);
+
+	// put away the last owner's registers
+	if(owner != NULL)
+		Save(owner->fpuState);
+
+	// the thread's first FPU instruction, it gets its reserved area and a clean FPU
+	if(cur->fpuState == NULL)
+	{
+		cur->fpuState = TakeState();
+		Restore(initialState);
+	}
+
+	else
+		Restore(cur->fpuState);
+
+	owner = cur;
+
+	return(0);
+}
+
+int FPUManager::Shutdown()
+{
+	return(0);
+}
+
+void FPUManager::CreateState(Thread *theThread)
+{
+	theThread->fpuState = NULL;
+
+	Reserve();
+}
+
+void FPUManager::CopyState(const Thread &from, Thread &to)
+{
+	AutoDisable	lock;
+
+	to.fpuState = NULL;
+
+	Reserve();
+
+	// it has never used the FPU, so neither has the copy
+	if(from.fpuState == NULL)
+		return;
+
+	// the live copy is in the registers
+	if(&from == owner)
+	{
+		ulong	cr0;
+
+		asm __volatile__ ("movl %%cr0, %0" : "=r" (cr0));
+		asm __volatile__ ("clts");
+
+		Save(from.fpuState);
+
+		// fnsave re-initializes the FPU, so put it back
+		Restore(from.fpuState);
+
+		if(cr0 & CR0_TS)
+			SetTaskSwitched();
+	}
+
+	to.fpuState = TakeState();
+	MemCopy(to.fpuState, from.fpuState, stateSize);
+}
+
+void FPUManager::ReleaseState(Thread *theThread)
+{
+	AutoDisable	lock;
+
+	if(theThread == owner)
+		owner = NULL;
+
+	// back in the pool, the pool's memory is never freed
+	if(theThread->fpuState != NULL)
+	{
+		*reinterpret_cast<uchar**>(theThread->fpuState) = freeStates;
+		freeStates = theThread->fpuState;
+	}
+
+	theThread->fpuState = NULL;
+
+	--reserved;
+}
+
+void FPUManager::SetTaskSwitched()
+{
+	ulong	cr0;
+
+	asm __volatile__ ("movl %%cr0, %0" : "=r" (cr0));
+
+	if((cr0 & CR0_TS) == 0)
+		asm __volatile__ ("movl %0, %%cr0" : : "r" (cr0 | CR0_TS));
+}
+
+void FPUManager::Reserve()
+{
+	AutoDisable	lock;
+
+	if(++reserved <= pooled)
+		return;
+
+	// every area is either in use or reserved, so add a chunk of them
+	uint	stride = (stateSize + STATE_ALIGN - 1) & ~(STATE_ALIGN - 1);
+	uchar	*chunk = new uchar[STATES_PER_CHUNK * stride + STATE_ALIGN];
+
+	chunk += STATE_ALIGN - (reinterpret_cast<ulong>(chunk) % STATE_ALIGN);
+
+	for(uint i=0; i < STATES_PER_CHUNK; ++i, chunk += stride)
+	{
+		*reinterpret_cast<uchar**>(chunk) = freeStates;
+		freeStates = chunk;
+	}
+
+	pooled += STATES_PER_CHUNK;
+}
+
+uchar *FPUManager::TakeState()
+{
+	uchar	*state = freeStates;
+
+	// every thread reserves an area when it is made, so this can't happen
+	if(state == NULL)
+		PANIC("No FPU save area reserved\n");
+
+	freeStates = *reinterpret_cast<uchar**>(state);
+
+	return(state);
+}
+
+void FPUManager::Save(uchar *state)
+{
+	if(useFXSave)
+		asm __volatile__ ("fxsave (%0)" : : "r" (state) : "memory");
+	else
+		asm __volatile__ ("fnsave (%0)\n\tfwait" : : "r" (state) : "memory");
+}
+
+void FPUManager::Restore(uchar *state)
+{
+	if(useFXSave)
+		asm __volatile__ ("fxrstor (%0)" : : "r" (state));
+	else
+		asm __volatile__ ("frstor (%0)" : : "r" (state));
+}
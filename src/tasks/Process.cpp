@@ -26,6 +26,7 @@
 #include <PhysicalMemManager.h>
 #include <UserThread.h>
 #include <KernelThread.h>
+#include <SyscallRing.h>
 
 using k_std::find;
 
@@ -37,7 +38,7 @@ Process::Process(Thread **mainThread,
 		void *arg,
 		VirtualConsole *console,
 		ulong stackSize)
-	: procID(procID), parentID(parentID), name(name), theConsole(console)
+	: procID(procID), parentID(parentID), name(name), theConsole(console), theRing(NULL)
 {
 	AutoDisable	lock;	// lock this down
 		
@@ -66,6 +67,13 @@ Process &Process::operator=(const Process &right)
 // 	theThreads = right.theThreads;	// the thread copy is a bit harder
 	fileDescriptors = right.fileDescriptors;
 	
+	// the ring lives in the old process's memory, so it isn't shared
+	theRing = NULL;
+	
+	// the same files are mapped in the copy
+	mappings = right.mappings;
+	PageCache::GetInstance().HoldMappings(mappings);
+	
 	// the page directory will have to be setup once this process has an ID
 	pageDirAddr = 0;
 	
@@ -114,6 +122,13 @@ void Process::DestroyProcess()
 		delete (*it);
 	}
 	
+	// the ring's worker thread was destroyed above
+	delete theRing;
+	theRing = NULL;
+	
+	// the mapped files' pages can go once nobody else has them mapped
+	PageCache::GetInstance().ReleaseMappings(mappings);
+	
 	// TODO: We need to notify the parent that we've died
 }
 
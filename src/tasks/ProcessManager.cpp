@@ -31,6 +31,8 @@
 #include <KernelThread.h>
 #include <UserThread.h>
 #include <V86Thread.h>
+#include <LatencyStats.h>
+#include <FPUManager.h>
 
 using k_std::find;
 using k_std::find_if;
@@ -161,6 +163,16 @@ Thread *ProcessManager::CreateThread(ThreadFunction functionAddress,
 					     arg,
 					     stackSize,
 					     regs);
+		
+		// a kernel thread working for a process shares its address space and file descriptors
+		if(procID != KERNEL_PID)
+		{
+			if(uint(procID) >= theProcs.size() || theProcs[procID] == reinterpret_cast<Process*>(NULL))
+				PANIC("Error: Trying to add a thread to an invalid proc\n");
+			
+			tmpThread->procID = procID;
+			theProcs[procID]->AddThread(tmpThread);
+		}
 		break;
 		
 	case Thread::USER:
@@ -314,6 +326,12 @@ void ProcessManager::ScheduleNextProcess(ulong **oldESP, ulong **newESP)
 	if(*oldESP == *newESP)	// same stack... nothing needed
 		return;
 	
+	// any latency being measured now includes another thread's time
+	LatencyStats::TaskSwitched();
+	
+	// trap the new thread's first FPU instruction unless it owns the FPU
+	FPUManager::GetInstance().TaskSwitched(*curThreadIterator);
+	
 	// set the TSS esp0 field
 	theTSS.esp0 = (*curThreadIterator)->stackEnd;
 	
@@ -344,12 +362,20 @@ void ProcessManager::PerformTaskSwitch()
 
 ulong ProcessManager::GetProcPageDir(uint procID)
 {
-	if(procID > theProcs.size())
+	if(procID >= theProcs.size())
 		PANIC("Invalid proc ID: 0x%x   SIZE: %d\n", procID, theProcs.size());
 	
 	return(theProcs[procID]->pageDirAddr);
 }
 
+list<PageCache::Mapping> *ProcessManager::GetProcMappings(uint procID)
+{
+	if(procID >= theProcs.size())
+		PANIC("Invalid proc ID: 0x%x   SIZE: %d\n", procID, theProcs.size());
+	
+	return(&theProcs[procID]->mappings);
+}
+
 int ProcessManager::InsertFileDescriptor(FileDescriptorBase* ptr)
 {
 	AutoDisable	lock;
@@ -404,3 +430,17 @@ void ProcessManager::RemoveFileDescriptor(int fd)
 		curProc->fileDescriptors[fd] = NULL;
 }
 
+
+SyscallRing *ProcessManager::GetSyscallRing()
+{
+	AutoDisable	lock;
+	
+	return theProcs[curProcID]->theRing;
+}
+
+void ProcessManager::SetSyscallRing(SyscallRing *ring)
+{
+	AutoDisable	lock;
+	
+	theProcs[curProcID]->theRing = ring;
+}
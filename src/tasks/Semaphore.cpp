@@ -45,7 +45,10 @@ int Semaphore::Signal()
 	{
 		// we have just freed up a slot, so move a waiting thread over to the run queue
 		
-		theProcessManager.runQueue.push_back(waitingThreads.front());	// add to the running threads
+		Thread	*theThread = waitingThreads.front();
+		
+		theProcessManager.runQueue.push_back(theThread);	// add to the running threads
+		theThread->SetLocation(&theProcessManager.runQueue, --theProcessManager.runQueue.end());
 		waitingThreads.pop_front();	// remove it from the waiting list
 	}
 		
@@ -60,7 +63,10 @@ int Semaphore::Wait()
 	
 	if(count <= 0)	// we must wait for the count to be raised
 	{
-		waitingThreads.push_back(*(theProcessManager.curThreadIterator));	// add this thread to the end of the waiting list
+		Thread	*theThread = *(theProcessManager.curThreadIterator);
+		
+		waitingThreads.push_back(theThread);	// add this thread to the end of the waiting list
+		theThread->SetLocation(&waitingThreads, --waitingThreads.end());	// so Destroy finds it here
 		
 		theProcessManager.curThreadIterator = theProcessManager.runQueue.erase(theProcessManager.curThreadIterator);	// remove from the run queue
 		
@@ -83,7 +89,10 @@ void Semaphore::SignalAll()
 	
 	// simply take all of them threads in the wait queue and return them to the run queue
 	for(list<Thread *>::iterator it = waitingThreads.begin(); it != waitingThreads.end(); ++it)
+	{
 		theProcessManager.runQueue.push_back(*it);
+		(*it)->SetLocation(&theProcessManager.runQueue, --theProcessManager.runQueue.end());
+	}
 	
 	waitingThreads.clear();	// clear the list
 	count = 0;		// reset the count
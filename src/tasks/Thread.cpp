@@ -22,16 +22,18 @@
 #include <AutoDisable.h>
 #include <Thread.h>
 #include <ProcessManager.h>
+#include <FPUManager.h>
+#include <KernelStackPool.h>
 
 // This constructs the basic stack for all threads
 Thread::Thread(ThreadFunction functionAddress, void *arg, ulong stackSize)
-	: procID(0)
+	: procID(0), fpuState(NULL)
 {
 	(void)functionAddress;
 	AutoDisable	lock;
 		
 	// first we need to allocate a stack for the thread
-	stackMemory = new uchar[stackSize];
+	stackMemory = KernelStackPool::GetInstance().Allocate(stackSize);
 	
 // 	printf("GOT STACK MEMORY AT: 0x%x\n", stackMemory);
 	
@@ -50,6 +52,9 @@ Thread::Thread(ThreadFunction functionAddress, void *arg, ulong stackSize)
 	
 	// save this value so the other threads can finish their setup
 	espReg = reinterpret_cast<ulong>(stackPtr);
+	
+	// the #NM handler can't allocate, so a save area is reserved for the thread's first FPU instruction
+	FPUManager::GetInstance().CreateState(this);
 }
 	
 Thread &Thread::operator=(const Thread &right)
@@ -59,6 +64,9 @@ Thread &Thread::operator=(const Thread &right)
 	theList = right.theList;	// we put it in the same queue
 	procID = right.procID;		// proc id is the same
 	
+	// get our own copy of the FPU state
+	FPUManager::GetInstance().CopyState(right, *this);
+	
 	//
 	// stackMemory, espReg and stackEnd are taken care of in the other copy constructors
 	//
@@ -82,7 +90,9 @@ void Thread::Destroy()
 	
 	joiningThreads.SignalAll();	// signal all the threads waiting for this one to finish
 	
-	delete [] stackMemory;	// free the stack
+	FPUManager::GetInstance().ReleaseState(this);	// give back the FPU save area
+	
+	KernelStackPool::GetInstance().Free(stackMemory);	// free the stack
 }
 
 void Thread::Join()
@@ -22,6 +22,7 @@
 #include <UserThread.h>
 #include <AutoDisable.h>
 #include <mem_utils.h>
+#include <KernelStackPool.h>
 #include <screen_utils.h>
 
 
@@ -69,7 +70,7 @@ UserThread &UserThread::operator=(const UserThread &right)
 	uint	stackSize = reinterpret_cast<uchar*>(right.stackEnd) - right.stackMemory + sizeof(ulong);
 	
 	// need to make a copy of the stack
-	stackMemory = new uchar[stackSize];
+	stackMemory = KernelStackPool::GetInstance().Allocate(stackSize);
 	
 	MemCopy(stackMemory, right.stackMemory, stackSize); // prob don't need to copy all of this
 	
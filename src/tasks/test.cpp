@@ -26,6 +26,7 @@
 #include <Partition.h>
 #include <Ext2.h>
 #include <VirtualConsoleManager.h>
+#include <LatencyStats.h>
 
 #include <vector.h>
 #include <string.h>
@@ -203,6 +204,14 @@ void ShellMain(void *arg)
 		{
 			myConsole->ClearScreen();			
 		}
+		
+		else if(input.BeginsWith("latency"))	// "latency" dumps, "latency reset" dumps then clears
+		{
+			LatencyStats::Dump(myConsole);
+			
+			if(input == "latency reset")
+				LatencyStats::Reset();
+		}
 	}
 }
 
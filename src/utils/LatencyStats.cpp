@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file LatencyStats.cpp
+ * Interrupt and system call latency histograms.
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <LatencyStats.h>
+#include <SystemCallHandler.h>
+#include <VirtualConsole.h>
+#include <mem_utils.h>
+
+LatencyStats::Histogram	LatencyStats::interrupts[NUM_VECTORS];
+LatencyStats::Histogram	LatencyStats::systemCalls[MAX_SYS_CALL_NUM];
+LatencyStats::Histogram	LatencyStats::interruptsOff;
+ulong			LatencyStats::interruptsOffLocation;
+int			LatencyStats::interruptsOffVector;
+ulong			LatencyStats::switchCount;
+ulong			LatencyStats::discarded;
+
+ulong LatencyStats::AddSample(Histogram &hist, ulonglong startTime)
+{
+	ulonglong	elapsed = ReadTimeStamp() - startTime;
+	ulong		cycles = (elapsed >> 32) != 0 ? 0xFFFFFFFF : ulong(elapsed);
+
+	// the bucket is the index of the highest bit set
+	uint	bucket = cycles == 0 ? 0 : 31 - __builtin_clz(cycles);
+
+	hist.buckets[bucket]++;
+	hist.count++;
+
+	if(cycles > hist.max)
+		hist.max = cycles;
+
+	return(cycles);
+}
+
+void LatencyStats::RecordInterrupt(uint vector, ulonglong startTime, ulong switches)
+{
+	if(vector >= NUM_VECTORS)
+		return;
+
+	// the handler switched tasks, so the time includes other threads
+	if(switches != switchCount)
+	{
+		++discarded;
+		return;
+	}
+
+	AddSample(interrupts[vector], startTime);
+}
+
+void LatencyStats::RecordSystemCall(uint num, ulonglong startTime)
+{
+	if(num >= MAX_SYS_CALL_NUM)
+		return;
+
+	AddSample(systemCalls[num], startTime);
+}
+
+void LatencyStats::RecordInterruptsOff(ulonglong startTime, ulong switches, ulong location, int vector)
+{
+	if(switches != switchCount)
+	{
+		++discarded;
+		return;
+	}
+
+	ulong	oldMax = interruptsOff.max;
+
+	if(AddSample(interruptsOff, startTime) > oldMax)
+	{
+		interruptsOffLocation = location;
+		interruptsOffVector = vector;
+	}
+}
+
+ulong LatencyStats::Percentile(const Histogram &hist, uint percent)
+{
+	// rank of the sample we're looking for, computed so it can't overflow
+	ulong	rank = (hist.count / 100) * percent + ((hist.count % 100) * percent + 99) / 100;
+	ulong	seen = 0;
+
+	for(uint i=0; i < NUM_BUCKETS; ++i)
+	{
+		seen += hist.buckets[i];
+
+		if(seen >= rank)
+			return(i == NUM_BUCKETS - 1 ? 0xFFFFFFFF : (ulong(2) << i) - 1);
+	}
+
+	return(hist.max);
+}
+
+void LatencyStats::Print(VirtualConsole *console, const char *name, uint num, const Histogram &hist)
+{
+	console->printf("%s %u: n=%u p50<=%u p99<=%u max=%u\n",
+			name, num, hist.count, Percentile(hist, 50), Percentile(hist, 99), hist.max);
+
+	// print the non-empty buckets as log2(cycles):count
+	console->printf("   ");
+
+	for(uint i=0; i < NUM_BUCKETS; ++i)
+	{
+		if(hist.buckets[i] != 0)
+			console->printf(" %u:%u", i, hist.buckets[i]);
+	}
+
+	console->printf("\n");
+}
+
+void LatencyStats::Dump(VirtualConsole *console)
+{
+	console->printf("Latencies in cycles, buckets are log2(cycles):count\n");
+
+	for(uint i=0; i < NUM_VECTORS; ++i)
+	{
+		if(interrupts[i].count != 0)
+			Print(console, "INT", i, interrupts[i]);
+	}
+
+	for(uint i=0; i < MAX_SYS_CALL_NUM; ++i)
+	{
+		if(systemCalls[i].count != 0)
+			Print(console, "SYSCALL", i, systemCalls[i]);
+	}
+
+	if(interruptsOff.count != 0)
+	{
+		Print(console, "IRQ OFF", 0, interruptsOff);
+		if(interruptsOffVector < 0)
+			console->printf("Longest irq off: %u cycles, disabled at 0x%x\n", interruptsOff.max, interruptsOffLocation);
+
+		else
+			console->printf("Longest irq off: %u cycles, in INT %d from 0x%x\n",
+					interruptsOff.max, interruptsOffVector, interruptsOffLocation);
+	}
+
+	console->printf("Discarded %u samples that spanned a task switch\n", discarded);
+}
+
+void LatencyStats::Reset()
+{
+	// the caller might be interrupted, but a lost sample doesn't matter
+	MemSet(interrupts, 0, sizeof(interrupts));
+	MemSet(systemCalls, 0, sizeof(Histogram) * MAX_SYS_CALL_NUM);
+	MemSet(&interruptsOff, 0, sizeof(interruptsOff));
+
+	interruptsOffLocation = 0;
+	interruptsOffVector = -1;
+	discarded = 0;
+}
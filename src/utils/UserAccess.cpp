@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2005
+ * William R. Speirs
+ *
+ * Permission to use, copy, distribute, or modify this software for
+ * the purpose of education is herby granted without fee. Permission
+ * to sell this software or its documentation is hereby denied without
+ * first obtaining the written consent of the author. In all cases, the
+ * above copyright notice must appear and this permission notice must
+ * appear in the supporting documentation. William R. Speirs makes no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ */
+
+
+/** @file UserAccess.cpp
+ *
+ */
+
+#include <constants.h>
+#include <types.h>
+#include <errno.h>
+#include <i386.h>
+#include <UserAccess.h>
+#include <ProcessManager.h>
+
+/// An entry in the exception table, setup by user_copy.S
+struct ExceptionTableEntry
+{
+	ulong	faultAddr;	///< The instruction that may fault
+	ulong	fixupAddr;	///< Where to continue if it does
+};
+
+// setup by the linker for us
+extern ExceptionTableEntry exceptionTable[];
+extern ExceptionTableEntry exceptionTableEnd[];
+
+ulong GetAddressLimit()
+{
+	// threads working for a process (including kernel workers) get the user limit
+	if(ProcessManager::GetInstance().GetCurrentProcID() != KERNEL_PID)
+		return(KERNEL_BASE_ADDR - 1);
+
+	return(0xFFFFFFFF);
+}
+
+int CopyFromUser(void *dest, const void *userSrc, ulong size)
+{
+	if(!IsValidUserRange(userSrc, size))
+		return(-1 * EFAULT);
+
+	return(CopyUserMemory(dest, userSrc, size) == 0 ? 0 : -1 * EFAULT);
+}
+
+int CopyToUser(void *userDest, const void *src, ulong size)
+{
+	if(!IsValidUserRange(userDest, size))
+		return(-1 * EFAULT);
+
+	return(CopyUserMemory(userDest, src, size) == 0 ? 0 : -1 * EFAULT);
+}
+
+int CopyStringFromUser(char *dest, const char *userSrc, ulong size)
+{
+	ulong	limit = GetAddressLimit();
+	ulong	start = reinterpret_cast<ulong>(userSrc);
+
+	if(start > limit)
+		return(-1 * EFAULT);
+
+	if(size == 0)
+		return(-1 * ENAMETOOLONG);
+
+	// don't let the copy walk past the limit
+	ulong	room = limit - start;	// bytes after the first one
+	ulong	maxSize = room < size - 1 ? room + 1 : size;
+	long	ret = CopyUserString(dest, userSrc, maxSize);
+
+	if(ret < 0)
+		return(-1 * EFAULT);
+
+	if(ulong(ret) == maxSize)	// never found the NULL
+		return(maxSize == size ? -1 * ENAMETOOLONG : -1 * EFAULT);
+
+	return(ret);
+}
+
+bool FixupUserAccessFault(Registers *regs)
+{
+	for(ExceptionTableEntry *it = exceptionTable; it != exceptionTableEnd; ++it)
+	{
+		if(it->faultAddr == regs->eip)
+		{
+			regs->eip = it->fixupAddr;
+			return(true);
+		}
+	}
+
+	return(false);
+}
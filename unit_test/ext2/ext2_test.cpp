@@ -0,0 +1,272 @@
+// Runs the kernel's ext2 and buffer cache against an image made by mke2fs, see make_image.sh
+#include <Ext2.h>
+#include <BufferCache.h>
+#include "../mock/host.h"
+
+const char *IMAGE = "ext2_test.img";
+
+#define CHECK(cond) \
+	do { if(!(cond)) { printf("%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while(0)
+
+int	failures = 0;
+
+// the image file as a disk
+class ImageDevice : public BlockDevice
+{
+public:
+	ImageDevice(const char *path) : reads(0), failReads(false)
+	{
+		if((fd = open(path, HOST_O_RDWR)) < 0)
+		{
+			printf("Couldn't open %s, run make_image.sh\n", path);
+			exit(1);
+		}
+	}
+
+	~ImageDevice()
+	{ close(fd); }
+
+	int ReadBlocks(ulong address, int blockCount, void *dest)
+	{
+		++reads;
+		
+		if(failReads)
+			return(-1 * EIO);
+		
+		if(pread(fd, dest, blockCount * BLOCK_SIZE, address * BLOCK_SIZE) != int(blockCount * BLOCK_SIZE))
+			return(-1 * EIO);
+
+		return(blockCount);
+	}
+
+	int WriteBlocks(ulong address, int blockCount, void *src)
+	{
+		if(pwrite(fd, src, blockCount * BLOCK_SIZE, address * BLOCK_SIZE) != int(blockCount * BLOCK_SIZE))
+			return(-1 * EIO);
+
+		return(blockCount);
+	}
+
+	ulong GetBlockSize()
+	{ return(BLOCK_SIZE); }
+
+	ulong	reads;		///< The number of ReadBlocks calls
+	bool	failReads;	///< Set to make every read fail
+
+private:
+	int			fd;
+	static const ulong	BLOCK_SIZE = 512;
+};
+
+// protos
+FileDescriptorBase *OpenFile(ext2 &theFs, const char *name);
+void PwriteThenReadTest(ext2 &theFs);
+void HTreeLookupTest(ext2 &theFs, ImageDevice *device);
+void BlockMapTest(ext2 &theFs);
+
+int main()
+{
+	ImageDevice	*device = new ImageDevice(IMAGE);
+	ext2		*theFs = new ext2(device);
+
+	PwriteThenReadTest(*theFs);
+	HTreeLookupTest(*theFs, device);
+	BlockMapTest(*theFs);
+
+	CHECK(theFs->Sync() == 0);
+
+	// unmounting writes the super block and gives back the device
+	delete theFs;
+
+	printf("%s: %d failure(s)\n", IMAGE, failures);
+
+	return(failures == 0 ? 0 : 1);
+}
+
+FileDescriptorBase *OpenFile(ext2 &theFs, const char *name)
+{
+	uint	length = 0;
+
+	while(name[length] != '\0')
+		++length;
+
+	int			inode = theFs.Lookup(theFs.GetRootInode(), name, length);
+	FileDescriptorBase	*fd = theFs.CreateFileDescriptor(&theFs);
+
+	if(inode <= 0 || theFs.OpenInode(fd, inode, 0) < 0)
+	{
+		printf("Couldn't open /%s\n", name);
+		exit(1);
+	}
+
+	return(fd);
+}
+
+void PwriteThenReadTest(ext2 &theFs)
+{
+	// the file is empty, so it is opened without a data block
+	FileDescriptorBase	*fd = OpenFile(theFs, "empty");
+	uchar			*buff = new uchar[3000];
+	uchar			*check = new uchar[3000];
+
+	for(uint i=0; i < 3000; ++i)
+		buff[i] = uchar(i % 251);
+
+	// spans three 1K blocks
+	CHECK(theFs.WriteAt(fd, buff, 3000, 0) == 3000);
+
+	// Read has to load the block pwrite put there
+	MemSet(check, 0, 3000);
+	CHECK(theFs.Read(fd, check, 3000) == 3000);
+	CHECK(MemEqual(buff, check, 3000));
+	CHECK(theFs.Read(fd, check, 1) == 0);
+
+	theFs.Close(fd);
+	theFs.DestroyFileDescriptor(fd);
+
+	// Write at the start of an empty file's descriptor must merge with what pwrite put there
+	fd = OpenFile(theFs, "empty2");
+
+	CHECK(theFs.WriteAt(fd, buff, 100, 0) == 100);
+	CHECK(theFs.Write(fd, const_cast<char*>("abcd"), 4) == 4);
+
+	MemSet(check, 0, 100);
+	CHECK(theFs.ReadAt(fd, check, 100, 0) == 100);
+	CHECK(MemEqual(check, const_cast<char*>("abcd"), 4));
+	CHECK(MemEqual(check + 4, buff + 4, 96));
+
+	theFs.Close(fd);
+	theFs.DestroyFileDescriptor(fd);
+
+	// and Seek past the first block
+	fd = OpenFile(theFs, "empty3");
+
+	CHECK(theFs.WriteAt(fd, buff, 3000, 0) == 3000);
+	CHECK(theFs.Seek(fd, 2000, FileSystemBase::SEEK_SET) == 2000);
+
+	MemSet(check, 0, 1000);
+	CHECK(theFs.Read(fd, check, 1000) == 1000);
+	CHECK(MemEqual(check, buff + 2000, 1000));
+
+	theFs.Close(fd);
+	theFs.DestroyFileDescriptor(fd);
+
+	delete [] buff;
+	delete [] check;
+}
+
+void HTreeLookupTest(ext2 &theFs, ImageDevice *device)
+{
+	int	dir = theFs.Lookup(theFs.GetRootInode(), "big", 3);
+	char	name[16];
+	char	contents[16];
+
+	CHECK(dir > 0);
+
+	// every name finds the file that holds it
+	for(int i=0; i < 500; ++i)
+	{
+		int	length = sprintf(name, "file%03d", i);
+		int	inode = theFs.Lookup(dir, name, length);
+
+		CHECK(inode > 0);
+
+		if(inode <= 0)
+			continue;
+
+		FileDescriptorBase	*fd = theFs.CreateFileDescriptor(&theFs);
+
+		CHECK(theFs.OpenInode(fd, inode, 0) == 0);
+		CHECK(theFs.Read(fd, contents, sizeof(contents)) == length + 1);
+		CHECK(MemEqual(contents, name, length));
+
+		theFs.Close(fd);
+		theFs.DestroyFileDescriptor(fd);
+	}
+
+	CHECK(theFs.Lookup(dir, "file500", 7) == -1 * ENOENT);
+	CHECK(theFs.Lookup(dir, "nothere", 7) == -1 * ENOENT);
+
+	// with nothing cached, a lookup only reads the index root and one leaf, not all 11 blocks
+	CHECK(theFs.Sync() == 0);
+	BufferCache::GetInstance().Invalidate(device);
+
+	ulong	reads = device->reads;
+
+	CHECK(theFs.Lookup(dir, "file499", 7) > 0);
+	CHECK(device->reads - reads == 2);
+
+	// a name that isn't there stops at its leaf too
+	BufferCache::GetInstance().Invalidate(device);
+	reads = device->reads;
+
+	CHECK(theFs.Lookup(dir, "file500", 7) == -1 * ENOENT);
+	CHECK(device->reads - reads == 2);
+
+	// a directory that can't be read isn't the same as a name that isn't there
+	BufferCache::GetInstance().Invalidate(device);
+	device->failReads = true;
+
+	CHECK(theFs.Lookup(dir, "file001", 7) == -1 * EIO);
+	CHECK(theFs.Lookup(dir, "file500", 7) == -1 * EIO);
+
+	device->failReads = false;
+
+	CHECK(theFs.Lookup(dir, "file001", 7) > 0);
+}
+
+// what make_image.sh put in block i of data
+void DataBlock(uint i, uchar *block)
+{
+	MemSet(block, 0, 1024);
+
+	if(i < 100 || i >= 150)
+		sprintf(reinterpret_cast<char*>(block), "block %u\n", i);
+}
+
+void BlockMapTest(ext2 &theFs)
+{
+	FileDescriptorBase	*fd = OpenFile(theFs, "data");
+	uchar			*file = new uchar[300 * 1024];
+	uchar			*buff = new uchar[300 * 1024];
+
+	for(uint i=0; i < 300; ++i)
+		DataBlock(i, file + i * 1024);
+
+	// jump around so the map is searched rather than walked, 7 and 300 share no factors
+	for(uint i=0, block=0; i < 300; ++i, block = (block + 7) % 300)
+	{
+		CHECK(theFs.ReadAt(fd, buff, 1024, block * 1024) == 1024);
+		CHECK(MemEqual(buff, file + block * 1024, 1024));
+	}
+
+	// backwards, across the hole and the indirect blocks
+	for(int block=299; block >= 0; --block)
+	{
+		CHECK(theFs.ReadAt(fd, buff, 1024, block * 1024) == 1024);
+		CHECK(MemEqual(buff, file + block * 1024, 1024));
+	}
+
+	// a whole file read sends runs of blocks to the disk together
+	MemSet(buff, 0xFF, 300 * 1024);
+	CHECK(theFs.ReadAt(fd, buff, 300 * 1024, 0) == 300 * 1024);
+	CHECK(MemEqual(buff, file, 300 * 1024));
+
+	// and reading straight through in pieces that don't line up with the blocks
+	MemSet(buff, 0xFF, 300 * 1024);
+
+	uint	total = 0;
+	int	ret;
+
+	while((ret = theFs.Read(fd, buff + total, 4000)) > 0)
+		total += ret;
+
+	CHECK(total == 300 * 1024);
+	CHECK(MemEqual(buff, file, 300 * 1024));
+
+	theFs.Close(fd);
+	theFs.DestroyFileDescriptor(fd);
+
+	delete [] file;
+	delete [] buff;
+}
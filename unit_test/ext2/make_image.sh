@@ -0,0 +1,55 @@
+#!/bin/sh
+# Makes the 8M, 1K block ext2 image ext2_test runs against
+set -e
+
+IMAGE=${1:-ext2_test.img}
+FILES=`mktemp -d`
+
+trap 'rm -rf $FILES' EXIT
+
+dd if=/dev/zero of=$IMAGE bs=1K count=8192 2>/dev/null
+mke2fs -F -q -t ext2 -b 1024 -O dir_index $IMAGE
+
+# empty files for pwrite to fill in
+: > $FILES/empty
+
+# 300 blocks each starting with its number, past the double indirect block and with 100-149 left as a hole
+for i in `seq 0 299`; do
+	if [ $i -lt 100 -o $i -ge 150 ]; then
+		printf "block %u\n" $i | dd of=$FILES/data bs=1024 seek=$i conv=notrunc 2>/dev/null
+	fi
+done
+truncate -s 300K $FILES/data
+
+# every other filler is removed before data is written, so its blocks are scattered
+for i in `seq 0 39`; do
+	head -c 3072 /dev/zero | tr '\0' x > $FILES/fill$i
+done
+
+# a directory big enough to be indexed, each file holds its own name
+for i in `seq -w 0 499`; do
+	echo file$i > $FILES/file$i
+done
+
+{
+	echo "write $FILES/empty empty"
+	echo "write $FILES/empty empty2"
+	echo "write $FILES/empty empty3"
+	for i in `seq 0 39`; do
+		echo "write $FILES/fill$i fill$i"
+	done
+	for i in `seq 0 2 39`; do
+		echo "rm fill$i"
+	done
+	echo "write $FILES/data data"
+	echo "mkdir big"
+	for i in `seq -w 0 499`; do
+		echo "write $FILES/file$i big/file$i"
+	done
+} > $FILES/script
+
+debugfs -w -f $FILES/script $IMAGE > /dev/null 2>&1
+
+# -D rebuilds big with an htree index, e2fsck exits 1 when it changed something
+e2fsck -fyD $IMAGE > /dev/null 2>&1 || [ $? -eq 1 ]
+debugfs -R "htree big" $IMAGE 2>/dev/null | grep -q "Root node dump"
@@ -0,0 +1,22 @@
+#ifndef PROCESSMANAGER_H
+#define PROCESSMANAGER_H
+
+#include <Singleton.h>
+
+#define KERNEL_PID	0
+
+class Thread
+{
+public:
+	enum { KERNEL };
+};
+
+// the buffer cache's flusher never runs, the tests sync
+class ProcessManager : public Singleton<ProcessManager>
+{
+public:
+	Thread *CreateThread(void (*)(void*), void*, int, int) { return(NULL); }
+	void PerformTaskSwitch() { }
+};
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef AUTODISABLE_H
+#define AUTODISABLE_H
+
+// there is only one thread
+class AutoDisable
+{
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CLOCKDRIVER_H
+#define CLOCKDRIVER_H
+
+#include <types.h>
+#include <Singleton.h>
+
+class ClockDriver : public Singleton<ClockDriver>
+{
+public:
+	seconds_t GetTimeInSeconds() { return(0); }
+	void AddSecondCallback(void (*)()) { }
+};
+
+#endif
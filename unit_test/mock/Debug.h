@@ -0,0 +1,11 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include "host.h"
+
+#define DEBUG(...) printf(__VA_ARGS__)
+#define WARN(...) printf("WARN: " __VA_ARGS__)
+#define ERROR(...) printf("ERROR: " __VA_ARGS__)
+#define PANIC(...) do { printf("PANIC: " __VA_ARGS__); abort(); } while(0)
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include "host.h"
+
+// there is only one thread, so waiting on a semaphore that's taken would never return
+class Semaphore
+{
+public:
+	Semaphore(int value = 0) : count(value) { }
+	
+	int Wait()
+	{
+		if(--count < 0)
+		{
+			printf("DEADLOCK: waiting on a semaphore that is held\n");
+			abort();
+		}
+		
+		return(count);
+	}
+	
+	int Signal() { return(++count); }
+	int GetValue() { return(count); }
+	void SignalAll() { }
+	
+private:
+	int	count;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef HOST_H
+#define HOST_H
+
+// the kernel's headers shadow stdio.h's (stdarg.h, SEEK_SET), so only what the harness uses is declared
+extern "C"
+{
+	int printf(const char *format, ...);
+	int sprintf(char *str, const char *format, ...);
+	void exit(int status);
+	void abort();
+	int open(const char *path, int flags, ...);
+	int close(int fd);
+	int pread(int fd, void *buff, unsigned int count, long offset);
+	int pwrite(int fd, const void *buff, unsigned int count, long offset);
+}
+
+static const int	HOST_O_RDWR = 2;
+
+#endif
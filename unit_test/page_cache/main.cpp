@@ -0,0 +1,290 @@
+// Runs the kernel's page cache with a pretend MMU, the two processes map the same program text
+#include <PageCache.h>
+#include <PhysicalMemManager.h>
+#include <ProcessManager.h>
+#include <mem_utils.h>
+#include "../mock/host.h"
+
+#define CHECK(cond) \
+	do { if(!(cond)) { printf("%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while(0)
+
+int	failures = 0;
+
+const ulong	TEXT_ADDR = 0x08048000;
+const ulong	TEXT_SIZE = 3 * PAGE_SIZE + 100;	///< The last page is mostly past the end of the file
+const ulong	TEXT_PAGES = 4;
+const ulong	TEXT_INODE = 12;
+
+ulong	faultAddr = 0;	///< The page being faulted in, it mustn't be mapped while it's read
+
+// one file in memory, every byte is its offset plus its page number so pages can be told apart
+class TextFileSystem : public FileSystemBase
+{
+public:
+	TextFileSystem() : FileSystemBase(NULL, 0), reads(0), opens(0), closes(0)
+	{ }
+
+	FileDescriptorBase *CreateFileDescriptor(FileSystemBase *fsBase)
+	{ return(new FileDescriptorBase(fsBase)); }
+
+	void DestroyFileDescriptor(FileDescriptorBase *fd)
+	{ delete fd; }
+
+	int ReadAt(FileDescriptorBase *, void *buff, uint numBytes, uint position)
+	{
+		PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+
+		++reads;
+
+		// the process can't see the page until it's all there
+		CHECK(physMemMan->Find(physMemMan->GetCurrentPageDirectory(), faultAddr) == NULL);
+
+		if(position >= TEXT_SIZE)
+			return(0);
+
+		if(numBytes > TEXT_SIZE - position)
+			numBytes = TEXT_SIZE - position;
+
+		for(uint i=0; i < numBytes; ++i)
+			reinterpret_cast<uchar*>(buff)[i] = TextByte(position + i);
+
+		return(numBytes);
+	}
+
+	int FileStat(FileDescriptorBase *, stat *buff)
+	{
+		buff->inodeNumber = TEXT_INODE;
+		buff->fileSize = TEXT_SIZE;
+		return(0);
+	}
+
+	int OpenInode(FileDescriptorBase *, ulong inode, const int)
+	{
+		++opens;
+		return(inode == TEXT_INODE ? 0 : -1 * ENOENT);
+	}
+
+	void Close(FileDescriptorBase *)
+	{ ++closes; }
+
+	static uchar TextByte(ulong offset)
+	{ return(uchar(offset + offset / PAGE_SIZE)); }
+
+	int Open(FileDescriptorBase *, const string &, const int) { return(-1 * ENOSYS); }
+	int Read(FileDescriptorBase *, void *, uint) { return(-1 * ENOSYS); }
+	int Write(FileDescriptorBase *, void *, uint) { return(-1 * ENOSYS); }
+	int Seek(FileDescriptorBase *, int, int) { return(-1 * ENOSYS); }
+	int Stat(string, stat *) { return(-1 * ENOSYS); }
+	int LinkStat(string, stat *) { return(-1 * ENOSYS); }
+
+	uint	reads;
+	uint	opens;
+	uint	closes;
+};
+
+// protos
+uchar *Access(uint procID, ulong addr, bool write, bool user = true);
+ulong PhysicalPage(uint procID, ulong addr);
+bool IsWritable(uint procID, ulong addr);
+void SharedTextTest(TextFileSystem *theFs, FileDescriptorBase *fd);
+void ProtectionTest(FileDescriptorBase *fd);
+
+int main()
+{
+	// never deleted, FileSystemBase's destructor would sync a device it doesn't have
+	TextFileSystem		*theFs = new TextFileSystem;
+	FileDescriptorBase	*fd = theFs->CreateFileDescriptor(theFs);
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+	ProcessManager		&procMan = ProcessManager::GetInstance();
+	uint			freePages = physMemMan->FreeCount();
+
+	procMan.mappedFd = fd;
+
+	SharedTextTest(theFs, fd);
+	ProtectionTest(fd);
+
+	// the processes exit, the last one takes the cached pages and the page cache's descriptor with it
+	for(uint procID=1; procID < ProcessManager::NUM_PROCS; ++procID)
+	{
+		PageCache::GetInstance().ReleaseMappings(*procMan.GetProcMappings(procID));
+		physMemMan->FreeProcPages(procID);
+	}
+
+	CHECK(physMemMan->FreeCount() == freePages);
+	CHECK(theFs->opens == 1);
+	CHECK(theFs->closes == 1);
+
+	printf("page cache: %d failure(s)\n", failures);
+
+	return(failures == 0 ? 0 : 1);
+}
+
+// what the CPU does for an access, and what PhysicalMemManager::Handle does when it faults
+uchar *Access(uint procID, ulong addr, bool write, bool user)
+{
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+	ProcessManager		&procMan = ProcessManager::GetInstance();
+	ulong			page = addr & ~(PAGE_SIZE - 1);
+
+	procMan.currentProcID = procID;
+	physMemMan->SetPageDirectory(procMan.GetProcPageDir(procID));
+
+	// once to fault, once more to see the fault was fixed
+	for(int i=0; i < 2; ++i)
+	{
+		PhysicalMemManager::PageTableEntry	*entry = physMemMan->Find(procMan.GetProcPageDir(procID), page);
+
+		if(entry != NULL && (entry->writable || !write))
+			return(physMemMan->Memory(entry->physicalPage) + addr % PAGE_SIZE);
+
+		// with CR0.WP a write by the kernel to a read-only page faults the same as the process's does
+		ulong	errorCode = (entry != NULL ? 0x1 : 0) | (write ? 0x2 : 0) | (user ? 0x4 : 0);
+
+		faultAddr = page;
+
+		if(!PageCache::GetInstance().HandleFault(page, errorCode))
+			return(NULL);
+	}
+
+	return(NULL);
+}
+
+ulong PhysicalPage(uint procID, ulong addr)
+{
+	PhysicalMemManager::PageTableEntry	*entry =
+		PhysicalMemManager::GetInstancePtr()->Find(ProcessManager::GetInstance().GetProcPageDir(procID), addr);
+
+	return(entry == NULL ? 0 : entry->physicalPage);
+}
+
+bool IsWritable(uint procID, ulong addr)
+{
+	PhysicalMemManager::PageTableEntry	*entry =
+		PhysicalMemManager::GetInstancePtr()->Find(ProcessManager::GetInstance().GetProcPageDir(procID), addr);
+
+	return(entry != NULL && entry->writable);
+}
+
+void SharedTextTest(TextFileSystem *theFs, FileDescriptorBase *fd)
+{
+	PageCache		&pageCache = PageCache::GetInstance();
+	PhysicalMemManager	*physMemMan = PhysicalMemManager::GetInstancePtr();
+	uint			freePages = physMemMan->FreeCount();
+
+	// both processes load the same program, like CreateProcFromFile does
+	for(uint procID=1; procID <= 2; ++procID)
+	{
+		CHECK(pageCache.MapFile(procID, TEXT_ADDR, TEXT_SIZE,
+					PageCache::PROT_READ | PageCache::PROT_WRITE | PageCache::PROT_EXEC,
+					PageCache::MAP_PRIVATE | PageCache::MAP_FIXED, fd, 0) == int(TEXT_ADDR));
+	}
+
+	// the first process reads every page in
+	for(ulong i=0; i < TEXT_PAGES; ++i)
+	{
+		uchar	*page = Access(1, TEXT_ADDR + i * PAGE_SIZE, false);
+
+		CHECK(page != NULL);
+		CHECK(!IsWritable(1, TEXT_ADDR + i * PAGE_SIZE));
+
+		for(ulong j=0; page != NULL && j < PAGE_SIZE; ++j)
+		{
+			ulong	offset = i * PAGE_SIZE + j;
+
+			CHECK(page[j] == (offset < TEXT_SIZE ? TextFileSystem::TextByte(offset) : 0));
+		}
+	}
+
+	CHECK(theFs->reads == TEXT_PAGES);
+	CHECK(physMemMan->FreeCount() == freePages - TEXT_PAGES);
+
+	// the second one gets the same pages without reading the file again
+	for(ulong i=0; i < TEXT_PAGES; ++i)
+	{
+		ulong	addr = TEXT_ADDR + i * PAGE_SIZE;
+
+		CHECK(Access(2, addr, false) != NULL);
+		CHECK(PhysicalPage(2, addr) == PhysicalPage(1, addr));
+		CHECK(!IsWritable(2, addr));
+	}
+
+	CHECK(theFs->reads == TEXT_PAGES);
+	CHECK(physMemMan->FreeCount() == freePages - TEXT_PAGES);
+
+	// the second process writes to its text, it gets its own copy of that page and no other
+	ulong	addr = TEXT_ADDR + PAGE_SIZE + 10;
+	ulong	shared = PhysicalPage(1, TEXT_ADDR + PAGE_SIZE);
+	uchar	*byte = Access(2, addr, true);
+
+	CHECK(byte != NULL);
+
+	if(byte != NULL)
+		*byte = 0xAA;
+
+	CHECK(IsWritable(2, TEXT_ADDR + PAGE_SIZE));
+	CHECK(PhysicalPage(2, TEXT_ADDR + PAGE_SIZE) != shared);
+	CHECK(PhysicalPage(1, TEXT_ADDR + PAGE_SIZE) == shared);
+	CHECK(PhysicalPage(2, TEXT_ADDR) == PhysicalPage(1, TEXT_ADDR));
+	CHECK(physMemMan->FreeCount() == freePages - TEXT_PAGES - 1);
+
+	// the write doesn't leak into the first process or the cached page
+	CHECK(*Access(2, addr, false) == 0xAA);
+	CHECK(*Access(1, addr, false) == TextFileSystem::TextByte(PAGE_SIZE + 10));
+	CHECK(physMemMan->Memory(shared)[10] == TextFileSystem::TextByte(PAGE_SIZE + 10));
+
+	// the rest of the copy is the file's
+	CHECK(*Access(2, addr + 1, false) == TextFileSystem::TextByte(PAGE_SIZE + 11));
+
+	// a system call writing to the first process's text, like read(2) into it, copies the page too
+	addr = TEXT_ADDR + 2 * PAGE_SIZE;
+	byte = Access(1, addr, true, false);
+
+	CHECK(byte != NULL);
+
+	if(byte != NULL)
+		*byte = 0xBB;
+
+	CHECK(*Access(2, addr, false) == TextFileSystem::TextByte(2 * PAGE_SIZE));
+	CHECK(PhysicalPage(1, addr) != PhysicalPage(2, addr));
+
+	// a second mapping of the file shares the cached pages, a first touch that writes copies straight away
+	int	ret = PageCache::Map(0, PAGE_SIZE, PageCache::PROT_READ | PageCache::PROT_WRITE,
+				     PageCache::MAP_PRIVATE, ProcessManager::MAPPED_FD, 3 * PAGE_SIZE);
+
+	CHECK(ret == int(PageCache::MAP_BASE));
+
+	byte = Access(2, PageCache::MAP_BASE, true);
+
+	CHECK(byte != NULL && *byte == TextFileSystem::TextByte(3 * PAGE_SIZE));
+	CHECK(PhysicalPage(2, PageCache::MAP_BASE) != PhysicalPage(1, TEXT_ADDR + 3 * PAGE_SIZE));
+	CHECK(theFs->reads == TEXT_PAGES);
+
+	// munmap gives back the second process's copies, the first process still has the cached pages
+	freePages = physMemMan->FreeCount();
+
+	CHECK(PageCache::Unmap(TEXT_ADDR, TEXT_SIZE) == 0);
+	CHECK(PageCache::Unmap(PageCache::MAP_BASE, PAGE_SIZE) == 0);
+	CHECK(PhysicalPage(2, TEXT_ADDR) == 0);
+	CHECK(physMemMan->FreeCount() == freePages + 2);
+	CHECK(*Access(1, TEXT_ADDR + PAGE_SIZE + 10, false) == TextFileSystem::TextByte(PAGE_SIZE + 10));
+}
+
+void ProtectionTest(FileDescriptorBase *fd)
+{
+	PageCache	&pageCache = PageCache::GetInstance();
+	ulong		addr = 0x20000000;
+
+	// nothing writes shared pages back to the file
+	CHECK(pageCache.MapFile(2, addr, PAGE_SIZE, PageCache::PROT_READ | PageCache::PROT_WRITE,
+				PageCache::MAP_SHARED, fd, 0) == -1 * EACCES);
+
+	// a read-only mapping can be read but not written, by the process or a system call
+	CHECK(pageCache.MapFile(2, addr, PAGE_SIZE, PageCache::PROT_READ, PageCache::MAP_SHARED, fd, 0) == int(addr));
+	CHECK(Access(2, addr, true) == NULL);
+	CHECK(Access(2, addr, false) != NULL);
+	CHECK(Access(2, addr, true) == NULL);
+	CHECK(Access(2, addr, true, false) == NULL);
+
+	// outside a mapping isn't the page cache's to fix
+	CHECK(Access(2, addr + PAGE_SIZE, false) == NULL);
+}
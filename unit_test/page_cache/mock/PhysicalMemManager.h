@@ -0,0 +1,180 @@
+#ifndef PHYSICALMEMMANAGER_H
+#define PHYSICALMEMMANAGER_H
+
+#include <types.h>
+#include <i386.h>
+#include <mem_utils.h>
+#include <ProcessManager.h>
+#include <Debug.h>
+
+// a few pages of pretend physical memory and one page table for every page directory, the test plays the MMU
+class PhysicalMemManager
+{
+public:
+	enum { NUM_PAGES = 32, NUM_ENTRIES = 64 };
+
+	struct PageTableEntry
+	{
+		ulong	pageDir;
+		ulong	virtualAddress;
+		ulong	physicalPage;
+		bool	writable;
+	};
+
+	PhysicalMemManager() : currentPageDirectory(0), entryCount(0)
+	{
+		for(uint i=0; i < NUM_PAGES; ++i)
+		{
+			used[i] = false;
+			owner[i] = 0;
+		}
+	}
+
+	static PhysicalMemManager *GetInstancePtr()
+	{
+		static PhysicalMemManager	instance;
+
+		return(&instance);
+	}
+
+	// physical page 0 is never handed out, the page cache uses it for not read in
+	ulong FindFreePage()
+	{
+		for(uint i=0; i < NUM_PAGES; ++i)
+		{
+			if(!used[i])
+			{
+				used[i] = true;
+				return((i + 1) * PAGE_SIZE);
+			}
+		}
+
+		PANIC("Out of memory\n");
+		return(0);
+	}
+
+	void FreePage(ulong physicalPage)
+	{
+		if(!used[Index(physicalPage)])
+			PANIC("Freeing the free page 0x%x\n", physicalPage);
+
+		used[Index(physicalPage)] = false;
+		owner[Index(physicalPage)] = 0;
+	}
+
+	// only the copies are a proc's own pages here
+	void FreeProcPages(ulong procID)
+	{
+		for(uint i=0; i < NUM_PAGES; ++i)
+		{
+			if(used[i] && owner[i] == procID)
+				FreePage((i + 1) * PAGE_SIZE);
+		}
+	}
+
+	void MapPage(ulong virtualAddress, ulong physicalPage, ulong pageDirPhysAddress = 0, ulong procID = 0, bool writable = true)
+	{
+		(void)procID;
+
+		PageTableEntry	*entry = Find(pageDirPhysAddress, virtualAddress);
+
+		if(entry == NULL)
+		{
+			if(entryCount == NUM_ENTRIES)
+				PANIC("Out of page table entries\n");
+
+			entry = &entries[entryCount++];
+		}
+
+		entry->pageDir = pageDirPhysAddress;
+		entry->virtualAddress = virtualAddress;
+		entry->physicalPage = physicalPage;
+		entry->writable = writable;
+	}
+
+	ulong UnmapPage(ulong virtualAddress)
+	{
+		PageTableEntry	*entry = Find(currentPageDirectory, virtualAddress);
+
+		if(entry == NULL)
+			return(0);
+
+		ulong	physicalPage = entry->physicalPage;
+
+		*entry = entries[--entryCount];
+
+		return(physicalPage);
+	}
+
+	void CopyPage(ulong virtualAddress, ulong pageDirPhysAddress, ulong procID = KERNEL_PID)
+	{
+		PageTableEntry	*entry = Find(pageDirPhysAddress, virtualAddress);
+
+		if(entry == NULL)
+			PANIC("Copying the unmapped page 0x%x\n", virtualAddress);
+
+		ulong	newPage = FindFreePage();
+
+		MemCopy(Memory(newPage), Memory(entry->physicalPage), PAGE_SIZE);
+
+		owner[Index(newPage)] = procID;
+
+		entry->physicalPage = newPage;
+		entry->writable = true;
+	}
+
+	void CopyToPage(ulong physicalPage, const void *src)
+	{ MemCopy(Memory(physicalPage), src, PAGE_SIZE); }
+
+	//
+	// for the test
+	//
+
+	void SetPageDirectory(ulong pageDirPhysAddress)
+	{ currentPageDirectory = pageDirPhysAddress; }
+
+	ulong GetCurrentPageDirectory()
+	{ return(currentPageDirectory); }
+
+	PageTableEntry *Find(ulong pageDirPhysAddress, ulong virtualAddress)
+	{
+		for(uint i=0; i < entryCount; ++i)
+		{
+			if(entries[i].pageDir == pageDirPhysAddress && entries[i].virtualAddress == virtualAddress)
+				return(&entries[i]);
+		}
+
+		return(NULL);
+	}
+
+	uchar *Memory(ulong physicalPage)
+	{ return(memory[Index(physicalPage)]); }
+
+	uint FreeCount()
+	{
+		uint	count = 0;
+
+		for(uint i=0; i < NUM_PAGES; ++i)
+			count += used[i] ? 0 : 1;
+
+		return(count);
+	}
+
+private:
+	uint Index(ulong physicalPage)
+	{
+		if(physicalPage == 0 || physicalPage % PAGE_SIZE != 0 || physicalPage > NUM_PAGES * PAGE_SIZE)
+			PANIC("Bad physical page 0x%x\n", physicalPage);
+
+		return(physicalPage / PAGE_SIZE - 1);
+	}
+
+	ulong		currentPageDirectory;
+	bool		used[NUM_PAGES];
+	ulong		owner[NUM_PAGES];	///< The proc a copy was made for, 0 if it isn't a copy
+	uchar		memory[NUM_PAGES][PAGE_SIZE];
+	PageTableEntry	entries[NUM_ENTRIES];
+	uint		entryCount;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef PROCESSMANAGER_H
+#define PROCESSMANAGER_H
+
+#include <types.h>
+#include <list.h>
+#include <Singleton.h>
+#include <PageCache.h>
+#include <Debug.h>
+
+using k_std::list;
+
+#define KERNEL_PID	0
+
+class Thread
+{
+public:
+	enum { KERNEL };
+};
+
+// processes that are only a page directory and a list of mappings, the test picks which one is running
+class ProcessManager : public Singleton<ProcessManager>
+{
+public:
+	enum { NUM_PROCS = 3 };
+
+	ProcessManager() : currentProcID(KERNEL_PID), mappedFd(NULL) { }
+
+	// the buffer cache's flusher never runs
+	Thread *CreateThread(void (*)(void*), void*, int, int) { return(NULL); }
+	void PerformTaskSwitch() { }
+
+	uint GetCurrentProcID() { return(currentProcID); }
+
+	// made up, the mock PhysicalMemManager only uses them to tell the page tables apart
+	ulong GetProcPageDir(uint procID)
+	{
+		if(procID >= NUM_PROCS)
+			PANIC("Invalid proc ID: 0x%x\n", procID);
+
+		return((procID + 1) * 0x100000);
+	}
+
+	list<PageCache::Mapping> *GetProcMappings(uint procID)
+	{
+		if(procID >= NUM_PROCS)
+			PANIC("Invalid proc ID: 0x%x\n", procID);
+
+		return(&mappings[procID]);
+	}
+
+	FileDescriptorBase *GetFileDescriptor(int fd)
+	{ return(fd == MAPPED_FD ? mappedFd : NULL); }
+
+	static const int	MAPPED_FD = 3;
+
+	uint			currentProcID;
+	FileDescriptorBase	*mappedFd;	///< What MAPPED_FD is open to in every process
+
+private:
+	list<PageCache::Mapping>	mappings[NUM_PROCS];
+};
+
+#endif
@@ -0,0 +1,131 @@
+// Runs the kernel's partition scan against partition.dat, the first 8 sectors of a real disk
+#include <Devices.h>
+#include <Partition.h>
+#include <mem_utils.h>
+#include "../mock/host.h"
+
+const char *DISK = "partition.dat";
+
+#define CHECK(cond) \
+	do { if(!(cond)) { printf("%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while(0)
+
+int	failures = 0;
+
+// partition.dat's MBR has a Linux partition at 63 and an extended one at 84614355
+const ulong	EXTENDED_START = 84614355;
+const ulong	EXTENDED_SIZE = 32595885;
+const ulong	SECOND_EBR = 20000063;		///< Relative to the extended partition, like the links
+const ulong	THIRD_EBR = 25000126;
+
+// partition.dat stops before the extended partition, so its three EBRs are made up here
+class TestDisk : public BlockDevice
+{
+public:
+	TestDisk()
+	{
+		int	fd = open(DISK, HOST_O_RDWR);
+
+		if(fd < 0 || pread(fd, mbr, sizeof(mbr), 0) != int(sizeof(mbr)))
+		{
+			printf("Couldn't read %s\n", DISK);
+			exit(1);
+		}
+
+		close(fd);
+	}
+
+	int ReadBlocks(ulong address, int blockCount, void *dest)
+	{
+		uchar	*sector = reinterpret_cast<uchar*>(dest);
+
+		for(int i=0; i < blockCount; ++i, ++address, sector += 512)
+		{
+			MemSet(sector, 0, 512);
+
+			if(address < 8)
+				MemCopy(sector, mbr + address * 512, 512);
+
+			// a logical partition of 20000000 sectors, then a link to the next EBR
+			else if(address == EXTENDED_START)
+			{
+				SetEntry(sector, 0, 0x83, 63, 20000000);
+				SetEntry(sector, 1, Partition::EXTENDED_TYPE, SECOND_EBR, EXTENDED_SIZE - SECOND_EBR);
+			}
+
+			// the link is relative to the extended partition, not to this EBR
+			else if(address == EXTENDED_START + SECOND_EBR)
+			{
+				SetEntry(sector, 0, 0x83, 63, 5000000);
+				SetEntry(sector, 1, Partition::EXTENDED_TYPE, THIRD_EBR, EXTENDED_SIZE - THIRD_EBR);
+			}
+
+			// swap takes up the rest, and this is the last EBR
+			else if(address == EXTENDED_START + THIRD_EBR)
+				SetEntry(sector, 0, 0x82, 63, EXTENDED_SIZE - THIRD_EBR - 63);
+		}
+
+		return(blockCount);
+	}
+
+	int WriteBlocks(ulong, int, void *)
+	{ return(-1); }
+
+	ulong GetBlockSize()
+	{ return(512); }
+
+private:
+	void SetEntry(uchar *sector, int entry, uchar type, ulong start, ulong size)
+	{
+		uchar	*desc = sector + 446 + entry * 16;
+
+		desc[4] = type;
+		MemCopy(desc + 8, &start, 4);
+		MemCopy(desc + 12, &size, 4);
+
+		sector[510] = 0x55;
+		sector[511] = 0xAA;
+	}
+
+	uchar	mbr[8 * 512];
+};
+
+bool IsPartition(Partition::PartitionInfo &info, int number, uchar type, ulong start, ulong size)
+{
+	return(info.number == number && info.partitionType == type && info.start == start && info.size == size);
+}
+
+int main()
+{
+	TestDisk				disk;
+	vector<Partition::PartitionInfo>	partitions;
+
+	// the primary partition, then the logical ones from the EBR chain, the extended one isn't reported
+	CHECK(Partition::Scan(&disk, 0, partitions) == 4);
+	CHECK(partitions.size() == 4);
+
+	if(partitions.size() == 4)
+	{
+		CHECK(IsPartition(partitions[0], 1, Partition::LINUX_TYPE, 63, 84614292));
+		CHECK(partitions[0].bootable);
+		CHECK(IsPartition(partitions[1], 5, 0x83, EXTENDED_START + 63, 20000000));
+		CHECK(!partitions[1].bootable);
+		CHECK(IsPartition(partitions[2], 6, 0x83, EXTENDED_START + SECOND_EBR + 63, 5000000));
+		CHECK(IsPartition(partitions[3], 7, 0x82, EXTENDED_START + THIRD_EBR + 63, EXTENDED_SIZE - THIRD_EBR - 63));
+	}
+
+	// a smaller disk cuts the first logical partition short and drops the rest
+	partitions.clear();
+
+	CHECK(Partition::Scan(&disk, EXTENDED_START + 10000000, partitions) == 2);
+	CHECK(partitions.size() == 2);
+
+	if(partitions.size() == 2)
+	{
+		CHECK(IsPartition(partitions[0], 1, Partition::LINUX_TYPE, 63, 84614292));
+		CHECK(IsPartition(partitions[1], 5, 0x83, EXTENDED_START + 63, 10000000 - 63));
+	}
+
+	printf("%s: %d failure(s)\n", DISK, failures);
+
+	return(failures == 0 ? 0 : 1);
+}